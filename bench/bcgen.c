@@ -0,0 +1,195 @@
+#include "bcgen.h"
+#include "stringbuilder.h"
+#include "panic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+char* shape_names[ShapeCount] = {
+    "many-functions",
+    "huge-function",
+    "deep-nesting",
+    "long-expressions",
+    "heavy-imports"
+};
+
+char* BcShape_name(BcShape shape)
+{
+    return shape_names[shape];
+}
+
+int BcShape_from(char* name)
+{
+    for (int i = 0; i < ShapeCount; i++)
+        if (strcmp(shape_names[i], name) == 0)
+            return i;
+
+    return -1;
+}
+
+// xorshift64*, small and stable across platforms so a seed names a program
+uint64_t bcgen_next(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+int bcgen_range(uint64_t* state, int n)
+{
+    return (int)(bcgen_next(state) % (uint64_t)n);
+}
+
+void bcgen_add_int(StringBuilder* sb, int num)
+{
+    char buf[16];
+    sprintf(buf, "%i", num);
+    StringBuilder_add_arr(sb, buf);
+}
+
+void bcgen_add_operator(StringBuilder* sb, uint64_t* state)
+{
+    char* ops[] = { " + ", " - ", " * " };
+    StringBuilder_add_arr(sb, ops[bcgen_range(state, 3)]);
+}
+
+void bcgen_add_comparison(StringBuilder* sb, uint64_t* state)
+{
+    char* ops[] = { " > ", " < ", " == " };
+    StringBuilder_add_arr(sb, ops[bcgen_range(state, 3)]);
+}
+
+void bcgen_add_indent(StringBuilder* sb, int depth)
+{
+    for (int i = 0; i < depth; i++)
+        StringBuilder_add(sb, '\t');
+}
+
+void bcgen_many_functions(StringBuilder* sb, int size, uint64_t* state)
+{
+    for (int i = 0; i < size; i++) {
+        StringBuilder_add_arr(sb, "function calc");
+        bcgen_add_int(sb, i);
+        StringBuilder_add_arr(sb, "(a : i32) : i32\n{\n\tvar r : i32 = (a");
+        bcgen_add_operator(sb, state);
+        bcgen_add_int(sb, bcgen_range(state, 100));
+        StringBuilder_add_arr(sb, ")\n\tif (r");
+        bcgen_add_comparison(sb, state);
+        bcgen_add_int(sb, bcgen_range(state, 100));
+        StringBuilder_add_arr(sb, ") {\n\t\tr = (r * 2);\n\t}\n\tr\n}\n\n");
+    }
+
+    StringBuilder_add_arr(sb, "function main() : void\n{\n\tvar x : i32 = (1)\n");
+    for (int i = 0; i < size; i += 1 + bcgen_range(state, 4)) {
+        StringBuilder_add_arr(sb, "\tx = (calc");
+        bcgen_add_int(sb, i);
+        StringBuilder_add_arr(sb, "(x));\n");
+    }
+    StringBuilder_add_arr(sb, "}\n");
+}
+
+void bcgen_huge_function(StringBuilder* sb, int size, uint64_t* state)
+{
+    StringBuilder_add_arr(sb, "function main() : void\n{\n\tvar v0 : i32 = (1)\n");
+    for (int i = 1; i < size; i++) {
+        StringBuilder_add_arr(sb, "\tvar v");
+        bcgen_add_int(sb, i);
+        StringBuilder_add_arr(sb, " : i32 = (v");
+        bcgen_add_int(sb, bcgen_range(state, i));
+        bcgen_add_operator(sb, state);
+        bcgen_add_int(sb, bcgen_range(state, 100));
+        StringBuilder_add_arr(sb, ")\n");
+    }
+    StringBuilder_add_arr(sb, "}\n");
+}
+
+void bcgen_deep_nesting(StringBuilder* sb, int size, uint64_t* state)
+{
+    StringBuilder_add_arr(sb, "function main() : void\n{\n\tvar a : i32 = (0)\n");
+    for (int i = 0; i < size; i++) {
+        bcgen_add_indent(sb, i + 1);
+        StringBuilder_add_arr(sb, bcgen_range(state, 2) ? "if (a" : "while (a");
+        bcgen_add_comparison(sb, state);
+        bcgen_add_int(sb, bcgen_range(state, 100));
+        StringBuilder_add_arr(sb, ") {\n");
+        bcgen_add_indent(sb, i + 2);
+        StringBuilder_add_arr(sb, "a = (a + 1);\n");
+    }
+    for (int i = size; i > 0; i--) {
+        bcgen_add_indent(sb, i);
+        StringBuilder_add_arr(sb, "}\n");
+    }
+    StringBuilder_add_arr(sb, "}\n");
+}
+
+void bcgen_long_expressions(StringBuilder* sb, int size, uint64_t* state)
+{
+    StringBuilder_add_arr(sb, "function main() : void\n{\n\tvar a : i32 = (3)\n\tvar b : i32 = (5)\n\tvar r : i32\n\tr = (a");
+    for (int i = 1; i < size; i++) {
+        bcgen_add_operator(sb, state);
+        if (bcgen_range(state, 2))
+            StringBuilder_add_arr(sb, bcgen_range(state, 2) ? "a" : "b");
+        else
+            bcgen_add_int(sb, bcgen_range(state, 100));
+    }
+    StringBuilder_add_arr(sb, ");\n}\n");
+}
+
+void bcgen_heavy_imports(StringBuilder* sb, int size, uint64_t* state)
+{
+    for (int i = 0; i < size; i++) {
+        StringBuilder_add_arr(sb, "import m");
+        bcgen_add_int(sb, i);
+        StringBuilder_add(sb, '\n');
+    }
+    StringBuilder_add(sb, '\n');
+    bcgen_many_functions(sb, 4, state);
+}
+
+char* bcgen_program(BcShape shape, int size, uint64_t seed)
+{
+    StringBuilder* sb = StringBuilder_new();
+    // A zero state would stay zero forever
+    uint64_t state = seed ^ 0x9E3779B97F4A7C15ULL;
+
+    switch (shape) {
+    case ManyFunctions:
+        bcgen_many_functions(sb, size, &state);
+        break;
+    case HugeFunction:
+        bcgen_huge_function(sb, size, &state);
+        break;
+    case DeepNesting:
+        bcgen_deep_nesting(sb, size, &state);
+        break;
+    case LongExpressions:
+        bcgen_long_expressions(sb, size, &state);
+        break;
+    case HeavyImports:
+        bcgen_heavy_imports(sb, size, &state);
+        break;
+    default:
+        panic("Unknown program shape: %i", (int)shape);
+        break;
+    }
+
+    char* program = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+    return program;
+}
+
+void bcgen_write_modules(int size)
+{
+    char name[32];
+
+    for (int i = 0; i < size; i++) {
+        sprintf(name, "m%i.nnivm", i);
+        FILE* file = fopen(name, "w");
+        if (file == NULL)
+            panic("Could not create %s", name);
+        fprintf(file, "FS m%i_init\nNEW NUM\nSET 0 NUM %i\nFE m%i_init\n", i, i, i);
+        fclose(file);
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef BCGEN_H
+#define BCGEN_H
+
+#include <stdint.h>
+
+// Shapes of generated programs, each one stresses a different part of the
+// compiler when its size grows
+enum bc_shape
+{
+    // size functions with a handful of statements each
+    ManyFunctions,
+    // One main with size statements
+    HugeFunction,
+    // if/while blocks nested size deep
+    DeepNesting,
+    // One expression with size operands
+    LongExpressions,
+    // size imports in front of a small program
+    HeavyImports,
+    ShapeCount
+};
+
+typedef enum bc_shape BcShape;
+
+char* BcShape_name(BcShape shape);
+int BcShape_from(char* name);
+
+// Generates a BC program of the given shape and size. The same seed always
+// gives the same program
+char* bcgen_program(BcShape shape, int size, uint64_t seed);
+
+// Writes the modules imported by a HeavyImports program of the given size
+// into the working directory
+void bcgen_write_modules(int size);
+
+#endif
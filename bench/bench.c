@@ -0,0 +1,259 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "bcgen.h"
+#include "tokenizer.h"
+#include "ast.h"
+#include "nonamegenerator.h"
+#include "passmanager.h"
+#include "typecheck.h"
+#include "stringbuilder.h"
+#include "panic.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_PHASES 5
+// Each shape runs at its base size doubled BENCH_SIZES - 1 times
+#define BENCH_SIZES 4
+#define DEFAULT_SEED 1
+#define DEFAULT_REPS 3
+// Growth of time against size, 1 is linear and 2 quadratic. Anything above
+// this is reported, the margin absorbs timer noise
+#define SUPERLINEAR_EXPONENT 1.5
+// Phases faster than this at the largest size are too noisy to judge
+#define MIN_JUDGED_MS 1.0
+
+char* phase_names[BENCH_PHASES] = { "lex", "parse", "passes", "typecheck", "codegen" };
+int base_sizes[ShapeCount] = { 100, 250, 50, 100, 50 };
+
+struct bench_result
+{
+    int size;
+    long bytes;
+    long tokens;
+    // Best time of each phase over the repetitions
+    double ms[BENCH_PHASES];
+};
+
+typedef struct bench_result BenchResult;
+
+double bench_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void bench_keep_best(BenchResult* result, int phase, double ms, int rep)
+{
+    if (rep == 0 || ms < result->ms[phase])
+        result->ms[phase] = ms;
+}
+
+// Runs the whole pipeline over the program reps times
+void bench_program(char* program, int reps, BenchResult* result)
+{
+    GenOptions options;
+    GenOptions_init(&options);
+
+    result->bytes = strlen(program);
+
+    for (int rep = 0; rep < reps; rep++) {
+        char* code = String_from(program);
+        double start = bench_ms();
+
+        Arraylist* tokens = tokenize(code);
+        double lexed = bench_ms();
+        result->tokens = Arraylist_size(tokens);
+
+        AST* ast = AST_from(tokens);
+        double parsed = bench_ms();
+
+        PassManager* pm = PassManager_standard(DEFAULT_OPT_LEVEL);
+        PassManager_run(pm, ast, &options);
+        double optimized = bench_ms();
+
+        typecheck_run(ast);
+        double checked = bench_ms();
+
+        char* gen = ast_to_nni_with_options(ast, &options);
+        double generated = bench_ms();
+
+        bench_keep_best(result, 0, lexed - start, rep);
+        bench_keep_best(result, 1, parsed - lexed, rep);
+        bench_keep_best(result, 2, optimized - parsed, rep);
+        bench_keep_best(result, 3, checked - optimized, rep);
+        bench_keep_best(result, 4, generated - checked, rep);
+
+        PassManager_free(pm);
+        free(gen);
+        free(code);
+        AST_free(ast);
+        Arraylist_free(tokens);
+    }
+}
+
+double bench_total_ms(BenchResult* result)
+{
+    double total = 0;
+    for (int p = 0; p < BENCH_PHASES; p++)
+        total += result->ms[p];
+    return total;
+}
+
+// Least squares slope of log(time) against log(size) over every size, a
+// single step between two sizes is too easily thrown off by one slow run
+double bench_exponent(BenchResult* results, int phase)
+{
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    int n = 0;
+
+    for (int i = 0; i < BENCH_SIZES; i++) {
+        if (results[i].ms[phase] <= 0)
+            continue;
+        double x = log(results[i].size);
+        double y = log(results[i].ms[phase]);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        n++;
+    }
+
+    if (n < 2)
+        return 0;
+
+    return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+// Prints the results of one shape, returns how many phases grow super-linearly
+int bench_report(BcShape shape, BenchResult* results)
+{
+    int flagged = 0;
+
+    printf("\n%s\n", BcShape_name(shape));
+    printf("%8s %10s %8s", "size", "bytes", "tokens");
+    for (int p = 0; p < BENCH_PHASES; p++)
+        printf(" %10s", phase_names[p]);
+    printf(" %10s %12s\n", "total ms", "tokens/s");
+
+    for (int i = 0; i < BENCH_SIZES; i++) {
+        BenchResult* r = &results[i];
+        double total = bench_total_ms(r);
+
+        printf("%8i %10li %8li", r->size, r->bytes, r->tokens);
+        for (int p = 0; p < BENCH_PHASES; p++)
+            printf(" %10.3f", r->ms[p]);
+        printf(" %10.3f %12.0f\n", total, total > 0 ? r->tokens / (total / 1000.0) : 0);
+    }
+
+    printf("%8s", "scaling");
+    for (int p = 0; p < BENCH_PHASES; p++) {
+        BenchResult* large = &results[BENCH_SIZES - 1];
+        double k = bench_exponent(results, p);
+
+        printf("  %s n^%.2f", phase_names[p], k);
+        if (large->ms[p] >= MIN_JUDGED_MS && k > SUPERLINEAR_EXPONENT) {
+            printf(" SUPERLINEAR");
+            flagged++;
+        }
+    }
+    printf("\n");
+
+    return flagged;
+}
+
+int bench_shape(BcShape shape, int scale, uint64_t seed, int reps)
+{
+    BenchResult results[BENCH_SIZES];
+    int size = base_sizes[shape] * scale;
+
+    if (shape == HeavyImports)
+        bcgen_write_modules(size << (BENCH_SIZES - 1));
+
+    for (int i = 0; i < BENCH_SIZES; i++, size *= 2) {
+        char* program = bcgen_program(shape, size, seed);
+        results[i].size = size;
+        bench_program(program, reps, &results[i]);
+        free(program);
+    }
+
+    return bench_report(shape, results);
+}
+
+void bench_remove_modules(int size)
+{
+    char name[32];
+
+    for (int i = 0; i < size; i++) {
+        sprintf(name, "m%i.nnivm", i);
+        remove(name);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t seed = DEFAULT_SEED;
+    int reps = DEFAULT_REPS;
+    int scale = 1;
+    int only = -1;
+    bool strict = false;
+    char* dump = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--seed=", 7) == 0)
+            seed = strtoull(argv[i] + 7, NULL, 10);
+        else if (strncmp(argv[i], "--reps=", 7) == 0)
+            reps = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--scale=", 8) == 0)
+            scale = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--shape=", 8) == 0) {
+            only = BcShape_from(argv[i] + 8);
+            if (only < 0)
+                panic("Unknown shape: %s", argv[i] + 8);
+        }
+        else if (strncmp(argv[i], "--dump=", 7) == 0)
+            dump = argv[i] + 7;
+        else if (strcmp(argv[i], "--strict") == 0)
+            strict = true;
+        else
+            panic("Unknown option: %s", argv[i]);
+    }
+
+    if (reps < 1 || scale < 1)
+        panic("--reps and --scale must be positive");
+
+    // --dump=<size> writes the program of --shape instead of benchmarking
+    if (dump != NULL) {
+        if (only < 0)
+            panic("--dump needs --shape");
+        char* program = bcgen_program(only, atoi(dump), seed);
+        printf("%s", program);
+        free(program);
+        return 0;
+    }
+
+    // Imports are read from the working directory, keep the generated
+    // modules out of the tree
+    char dir[] = "/tmp/bc-bench-XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0)
+        panic("Could not create a scratch directory");
+
+    printf("seed %llu, best of %i, times in ms\n", (unsigned long long)seed, reps);
+
+    int flagged = 0;
+    for (int s = 0; s < ShapeCount; s++)
+        if (only < 0 || only == s)
+            flagged += bench_shape(s, scale, seed, reps);
+
+    bench_remove_modules((base_sizes[HeavyImports] * scale) << (BENCH_SIZES - 1));
+    rmdir(dir);
+
+    printf("\n%i super-linear phase%s\n", flagged, flagged == 1 ? "" : "s");
+    return strict && flagged > 0;
+}
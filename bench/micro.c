@@ -0,0 +1,399 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "arraylist.h"
+#include "hashmap.h"
+#include "stack.h"
+#include "stringbuilder.h"
+#include "panic.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MIN_SIZE 10
+#define MAX_SIZE 1000000
+#define WARMUP_REPS 1
+#define DEFAULT_REPS 11
+// Sizes stop growing once a repetition would take longer than this
+#define DEFAULT_BUDGET_MS 1000.0
+// Latency benchmarks time the operations in batches this large, one
+// clock_gettime per operation would cost more than the operation
+#define BATCH_OPS 64
+
+struct micro_samples
+{
+    // Nanoseconds per operation
+    double* ns;
+    int count;
+    int capacity;
+};
+
+typedef struct micro_samples MicroSamples;
+
+typedef void (*micro_run_t)(int n, MicroSamples* samples);
+
+struct micro_bench
+{
+    char* name;
+    // Runs the operation over a container of n elements and adds one sample
+    // per repetition, or one per batch for latency benchmarks
+    micro_run_t run;
+};
+
+typedef struct micro_bench MicroBench;
+
+// Keys and values shared by every benchmark, built once outside the timings
+char** keys;
+int* values;
+int* order;
+
+double micro_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void micro_add_sample(MicroSamples* samples, double ns)
+{
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 64;
+        samples->ns = realloc(samples->ns, sizeof(double) * samples->capacity);
+    }
+    samples->ns[samples->count++] = ns;
+}
+
+void micro_nofree(void* ptr)
+{
+}
+
+uint64_t micro_next(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+// A fixed random permutation of the first n indices lives at the front of
+// order, lookups walk it so that they do not follow insertion order
+void micro_shuffle(int n)
+{
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+    for (int i = 0; i < n; i++)
+        order[i] = i;
+    for (int i = n - 1; i > 0; i--) {
+        int j = (int)(micro_next(&state) % (uint64_t)(i + 1));
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+}
+
+Hashmap* micro_filled_map(int n)
+{
+    Hashmap* map = Hashmap_new(micro_nofree);
+    for (int i = 0; i < n; i++)
+        Hashmap_insert(map, keys[i], &values[i]);
+    return map;
+}
+
+Arraylist* micro_filled_list(int n)
+{
+    Arraylist* list = Arraylist_new(micro_nofree);
+    for (int i = 0; i < n; i++)
+        Arraylist_add(list, &values[i]);
+    return list;
+}
+
+void hashmap_insert_bench(int n, MicroSamples* samples)
+{
+    Hashmap* map = Hashmap_new(micro_nofree);
+    double start = micro_ns();
+
+    for (int i = 0; i < n; i++)
+        Hashmap_insert(map, keys[i], &values[i]);
+
+    micro_add_sample(samples, (micro_ns() - start) / n);
+    Hashmap_free(map);
+}
+
+void hashmap_lookup_bench(int n, MicroSamples* samples)
+{
+    Hashmap* map = micro_filled_map(n);
+    long sum = 0;
+    micro_shuffle(n);
+    double start = micro_ns();
+
+    for (int i = 0; i < n; i++)
+        sum += *(int*)Hashmap_get(map, keys[order[i]]);
+
+    micro_add_sample(samples, (micro_ns() - start) / n);
+    if (sum < 0)
+        panic("Lookup returned a wrong value");
+    Hashmap_free(map);
+}
+
+void hashmap_iterate_bench(int n, MicroSamples* samples)
+{
+    Hashmap* map = micro_filled_map(n);
+    long sum = 0;
+    double start = micro_ns();
+
+    for (Hashmap_Node* iter = Hashmap_get_iter(map); iter != NULL; iter = Hashmap_iter_next(iter))
+        sum += *(int*)iter->val;
+
+    micro_add_sample(samples, (micro_ns() - start) / n);
+    if (sum < 0)
+        panic("Iteration returned a wrong value");
+    Hashmap_free(map);
+}
+
+void arraylist_add_bench(int n, MicroSamples* samples)
+{
+    Arraylist* list = Arraylist_new(micro_nofree);
+    double start = micro_ns();
+
+    for (int i = 0; i < n; i++)
+        Arraylist_add(list, &values[i]);
+
+    micro_add_sample(samples, (micro_ns() - start) / n);
+    Arraylist_free(list);
+}
+
+void arraylist_get_bench(int n, MicroSamples* samples)
+{
+    Arraylist* list = micro_filled_list(n);
+    long sum = 0;
+    micro_shuffle(n);
+    double start = micro_ns();
+
+    for (int i = 0; i < n; i++)
+        sum += *(int*)Arraylist_get(list, order[i]);
+
+    micro_add_sample(samples, (micro_ns() - start) / n);
+    if (sum < 0)
+        panic("Get returned a wrong value");
+    Arraylist_free(list);
+}
+
+void arraylist_iterate_bench(int n, MicroSamples* samples)
+{
+    Arraylist* list = micro_filled_list(n);
+    long sum = 0;
+    double start = micro_ns();
+
+    for (int i = 0; i < Arraylist_size(list); i++)
+        sum += *(int*)Arraylist_get(list, i);
+
+    micro_add_sample(samples, (micro_ns() - start) / n);
+    if (sum < 0)
+        panic("Iteration returned a wrong value");
+    Arraylist_free(list);
+}
+
+void stack_push_bench(int n, MicroSamples* samples)
+{
+    Stack* stack = Stack_new(micro_nofree);
+
+    for (int i = 0; i < n; i += BATCH_OPS) {
+        int end = i + BATCH_OPS < n ? i + BATCH_OPS : n;
+        double start = micro_ns();
+        for (int j = i; j < end; j++)
+            Stack_push(stack, &values[j]);
+        micro_add_sample(samples, (micro_ns() - start) / (end - i));
+    }
+
+    Stack_free(stack);
+}
+
+void stack_pop_bench(int n, MicroSamples* samples)
+{
+    Stack* stack = micro_filled_list(n);
+    long sum = 0;
+
+    for (int i = 0; i < n; i += BATCH_OPS) {
+        int end = i + BATCH_OPS < n ? i + BATCH_OPS : n;
+        double start = micro_ns();
+        for (int j = i; j < end; j++)
+            sum += *(int*)Stack_pop(stack);
+        micro_add_sample(samples, (micro_ns() - start) / (end - i));
+    }
+
+    if (sum < 0)
+        panic("Pop returned a wrong value");
+    Stack_free(stack);
+}
+
+void stringbuilder_add_bench(int n, MicroSamples* samples)
+{
+    StringBuilder* sb = StringBuilder_new();
+    double start = micro_ns();
+
+    for (int i = 0; i < n; i++)
+        StringBuilder_add(sb, 'a' + i % 26);
+
+    micro_add_sample(samples, (micro_ns() - start) / n);
+    StringBuilder_free(sb);
+}
+
+void stringbuilder_add_arr_bench(int n, MicroSamples* samples)
+{
+    StringBuilder* sb = StringBuilder_new();
+    double start = micro_ns();
+
+    for (int i = 0; i < n; i++)
+        StringBuilder_add_arr(sb, keys[i]);
+
+    micro_add_sample(samples, (micro_ns() - start) / n);
+    StringBuilder_free(sb);
+}
+
+MicroBench benches[] = {
+    { "hashmap/insert", hashmap_insert_bench },
+    { "hashmap/lookup", hashmap_lookup_bench },
+    { "hashmap/iterate", hashmap_iterate_bench },
+    { "arraylist/add", arraylist_add_bench },
+    { "arraylist/get", arraylist_get_bench },
+    { "arraylist/iterate", arraylist_iterate_bench },
+    { "stack/push", stack_push_bench },
+    { "stack/pop", stack_pop_bench },
+    { "stringbuilder/add", stringbuilder_add_bench },
+    { "stringbuilder/add_arr", stringbuilder_add_arr_bench },
+};
+
+int compare_double(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of sorted samples
+double micro_percentile(MicroSamples* samples, double p)
+{
+    int rank = (int)(p / 100.0 * samples->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > samples->count)
+        rank = samples->count;
+    return samples->ns[rank - 1];
+}
+
+void micro_json_result(FILE* json, bool first, char* name, int n, int reps, MicroSamples* samples)
+{
+    fprintf(json, "%s\n    {\"name\": \"%s\", \"size\": %i, \"reps\": %i, \"samples\": %i, "
+        "\"min_ns\": %.2f, \"p50_ns\": %.2f, \"p90_ns\": %.2f, \"p99_ns\": %.2f, \"max_ns\": %.2f}",
+        first ? "" : ",", name, n, reps, samples->count, samples->ns[0],
+        micro_percentile(samples, 50), micro_percentile(samples, 90),
+        micro_percentile(samples, 99), samples->ns[samples->count - 1]);
+}
+
+int main(int argc, char** argv)
+{
+    int reps = DEFAULT_REPS;
+    int max_size = MAX_SIZE;
+    double budget_ms = DEFAULT_BUDGET_MS;
+    char* filter = NULL;
+    char* json_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--reps=", 7) == 0)
+            reps = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--max-size=", 11) == 0)
+            max_size = atoi(argv[i] + 11);
+        else if (strncmp(argv[i], "--budget-ms=", 12) == 0)
+            budget_ms = atof(argv[i] + 12);
+        else if (strncmp(argv[i], "--filter=", 9) == 0)
+            filter = argv[i] + 9;
+        else if (strncmp(argv[i], "--json=", 7) == 0)
+            json_path = argv[i] + 7;
+        else
+            panic("Unknown option: %s", argv[i]);
+    }
+
+    if (reps < 1 || max_size < MIN_SIZE)
+        panic("--reps must be positive and --max-size at least %i", MIN_SIZE);
+
+    keys = malloc(sizeof(char*) * max_size);
+    values = malloc(sizeof(int) * max_size);
+    order = malloc(sizeof(int) * max_size);
+    for (int i = 0; i < max_size; i++) {
+        char buf[MAX_KEY_SIZE];
+        sprintf(buf, "key%i", i);
+        keys[i] = String_from(buf);
+        values[i] = i;
+    }
+
+    FILE* json = NULL;
+    if (json_path != NULL) {
+        json = fopen(json_path, "w");
+        if (json == NULL)
+            panic("Could not open %s", json_path);
+        fprintf(json, "{\n  \"results\": [");
+    }
+
+    printf("%-24s %8s %5s %8s %10s %10s %10s %10s %10s\n", "benchmark", "size", "reps",
+        "samples", "min ns", "p50 ns", "p90 ns", "p99 ns", "max ns");
+
+    bool first = true;
+    for (int b = 0; b < sizeof(benches) / sizeof(MicroBench); b++) {
+        MicroBench* bench = &benches[b];
+        if (filter != NULL && strstr(bench->name, filter) == NULL)
+            continue;
+
+        for (int n = MIN_SIZE; n <= max_size; n *= 10) {
+            MicroSamples samples = { NULL, 0, 0 };
+            MicroSamples warmup = { NULL, 0, 0 };
+
+            double start = micro_ns();
+            for (int r = 0; r < WARMUP_REPS; r++)
+                bench->run(n, &warmup);
+            double rep_ms = (micro_ns() - start) / 1e6 / WARMUP_REPS;
+
+            // Large sizes of slow containers get fewer repetitions, but
+            // never less than three so the percentiles mean something
+            int size_reps = reps;
+            if (rep_ms * size_reps > budget_ms)
+                size_reps = budget_ms / rep_ms > 3 ? (int)(budget_ms / rep_ms) : 3;
+
+            start = micro_ns();
+            for (int r = 0; r < size_reps; r++)
+                bench->run(n, &samples);
+            double measured_ms = (micro_ns() - start) / 1e6 / size_reps;
+            if (measured_ms > rep_ms)
+                rep_ms = measured_ms;
+            qsort(samples.ns, samples.count, sizeof(double), compare_double);
+
+            printf("%-24s %8i %5i %8i %10.2f %10.2f %10.2f %10.2f %10.2f\n", bench->name, n,
+                size_reps, samples.count, samples.ns[0], micro_percentile(&samples, 50),
+                micro_percentile(&samples, 90), micro_percentile(&samples, 99),
+                samples.ns[samples.count - 1]);
+            fflush(stdout);
+
+            if (json != NULL)
+                micro_json_result(json, first, bench->name, n, size_reps, &samples);
+            first = false;
+
+            free(samples.ns);
+            free(warmup.ns);
+
+            // Growing by ten takes at least ten times longer
+            if (rep_ms * 10 > budget_ms && n * 10 <= max_size) {
+                printf("%-24s %8i skipped, over the %.0f ms budget\n", bench->name, n * 10, budget_ms);
+                break;
+            }
+        }
+    }
+
+    if (json != NULL) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+
+    return 0;
+}
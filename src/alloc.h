@@ -0,0 +1,26 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+// Charges the allocations of a file to its subsystem for --alloc-stats. The
+// file defines ALLOC_SUBSYSTEM and includes this after every other header.
+// The macros only set the tag, the call still goes to the wrapped malloc in
+// memstat.c (a macro is not expanded again inside its own definition)
+
+#include "memstat.h"
+#include "stringbuilder.h"
+
+#include <stdlib.h>
+
+#ifndef ALLOC_SUBSYSTEM
+#error "ALLOC_SUBSYSTEM has to be defined before including alloc.h"
+#endif
+
+#define malloc(size) (alloc_subsystem = ALLOC_SUBSYSTEM, malloc(size))
+#define calloc(count, size) (alloc_subsystem = ALLOC_SUBSYSTEM, calloc(count, size))
+#define realloc(ptr, size) (alloc_subsystem = ALLOC_SUBSYSTEM, realloc(ptr, size))
+
+// String copies are charged to the caller rather than to the containers
+#define String_from(str) String_from_tagged(str, ALLOC_SUBSYSTEM)
+#define String_from_int(num) String_from_int_tagged(num, ALLOC_SUBSYSTEM)
+
+#endif
@@ -4,8 +4,16 @@
 
 #include "arraylist.h"
 
+#define ALLOC_SUBSYSTEM ContainersAlloc
+#include "alloc.h"
+
 #define ARRAYLIST_POSITION_IN_BOUNDS(pos, size)  !(pos >= size || pos < 0)
 
+void Arraylist_no_free(void* ptr)
+{
+    (void)ptr;
+}
+
 Arraylist* Arraylist_new(free_ptr_t ptr)
 {
     return Arraylist_new_with_size(ptr, ARRAYLIST_DEFAULT_SIZE);
@@ -60,6 +68,23 @@ int Arraylist_set(Arraylist* array, void* value, int position)
     return 0;
 }
 
+int Arraylist_insert(Arraylist* array, void* value, int position)
+{
+    if (position > array->size || position < 0)
+        return -1;
+
+    if (++array->size > array->max_size)
+        if (Arraylist_expand(array))
+            return -1;
+
+    for (int i = array->size-1; i > position; i--)
+        array->arr[i] = array->arr[i-1];
+
+    array->arr[position] = value;
+
+    return 0;
+}
+
 void* Arraylist_get(Arraylist* array, int position)
 {
     if (!ARRAYLIST_POSITION_IN_BOUNDS(position, array->size)) {
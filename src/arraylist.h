@@ -8,6 +8,9 @@
 
 typedef void (*free_ptr_t)(void*);
 
+// Free function for containers that do not own their elements
+void Arraylist_no_free(void* ptr);
+
 struct arraylist 
 {
     int32_t size;
@@ -24,6 +27,8 @@ Arraylist* Arraylist_new_with_size(free_ptr_t ptr,
 int Arraylist_add(Arraylist* array, void* value);
 int Arraylist_set(Arraylist* array, 
     void* value, int position);
+int Arraylist_insert(Arraylist* array, 
+    void* value, int position);
 void* Arraylist_get(Arraylist* array, int position);
 int Arraylist_remove(Arraylist* array, int position);
 int Arraylist_size(Arraylist* array); 
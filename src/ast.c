@@ -10,6 +10,9 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#define ALLOC_SUBSYSTEM ParserAlloc
+#include "alloc.h"
+
 #define UNEXPECTED(val, line, col) \
 panic("Unexpected %s at line: %i:%i", String_from(val), line, col);
 
@@ -116,7 +119,7 @@ ExpressionNode* parse_expr(Arraylist* list, int* pos)
                             cn_arg = GenericNode_new(VariableNode_t, call_vn);
                         break;
                         case Number:
-                            call_ln = LiteralNode_new(String_from(tk->name), I32_t);
+                            call_ln = LiteralNode_new_number(tk->number);
                             cn_arg = GenericNode_new(LiteralNode_t, call_ln);
                         break;
                         case String:
@@ -127,6 +130,9 @@ ExpressionNode* parse_expr(Arraylist* list, int* pos)
                             ADVANCE_TOKEN()
                             continue;
                         break;
+                        default:
+                            UNEXPECTED("token", tk->line, tk->column)
+                        break;
                     }
                     CallNode_add_arg(cn, cn_arg);
                     ADVANCE_TOKEN()
@@ -140,27 +146,8 @@ ExpressionNode* parse_expr(Arraylist* list, int* pos)
             ADVANCE_TOKEN()
         }
         else if (tk->type == Number) {
-
-            StringBuilder* sb = StringBuilder_new();
-
-            StringBuilder_add_arr(sb, tk->name);
-            
-            ADVANCE_TOKEN() 
-            
-            if (tk->type == Dot) {
-
-                StringBuilder_add(sb, '.');
-                ADVANCE_TOKEN()
-            
-                if (tk->type != Number)
-                    UNEXPECTED("token", tk->line, tk->column)
-            
-                StringBuilder_add_arr(sb, tk->name);
-                ADVANCE_TOKEN()
-            }
-
-            ExpressionNode_add(expr, GenericNode_new(LiteralNode_t, LiteralNode_new(StringBuilder_get(sb), I32_t)));
-            StringBuilder_free(sb);
+            ExpressionNode_add(expr, GenericNode_new(LiteralNode_t, LiteralNode_new_number(tk->number)));
+            ADVANCE_TOKEN()
         }
         else if (IS_OPERATOR(tk->type) || IS_BOOLEAN_OPERATOR(tk->type) || IS_BRACKET(tk->type)) {
 
@@ -197,6 +184,7 @@ ExpressionNode* parse_expr(Arraylist* list, int* pos)
 
     }
 
+    Stack_free(op_stack);
     *pos = position;
     return expr;
 }
@@ -214,6 +202,7 @@ void AST_free(AST* ast)
 {
     Hashmap_free(ast->functions);
     Arraylist_free(ast->imports);
+    free(ast);
 }
 
 AST* AST_from(Arraylist* list)
@@ -560,7 +549,7 @@ AST* AST_from(Arraylist* list)
                                                 cn_arg = GenericNode_new(VariableNode_t, call_vn);
                                             break;
                                             case Number:
-                                                call_ln = LiteralNode_new(String_from(tk->name), I32_t);
+                                                call_ln = LiteralNode_new_number(tk->number);
                                                 cn_arg = GenericNode_new(LiteralNode_t, call_ln);
                                             break;
                                             case String:
@@ -571,6 +560,9 @@ AST* AST_from(Arraylist* list)
                                                 ADVANCE_TOKEN()
                                                 continue;
                                             break;
+                                            default:
+                                                UNEXPECTED("token", tk->line, tk->column)
+                                            break;
                                         }
                                         CallNode_add_arg(cn, cn_arg);
                                         ADVANCE_TOKEN()
@@ -627,7 +619,7 @@ AST* AST_from(Arraylist* list)
                                                 cn_arg = GenericNode_new(VariableNode_t, call_vn);
                                             break;
                                             case Number:
-                                                call_ln = LiteralNode_new(String_from(tk->name), I32_t);
+                                                call_ln = LiteralNode_new_number(tk->number);
                                                 cn_arg = GenericNode_new(LiteralNode_t, call_ln);
                                             break;
                                             case String:
@@ -638,6 +630,9 @@ AST* AST_from(Arraylist* list)
                                                 ADVANCE_TOKEN()
                                                 continue;
                                             break;
+                                            default:
+                                                UNEXPECTED("token", tk->line, tk->column)
+                                            break;
                                         }
                                         CallNode_add_arg(cn, cn_arg);
                                         ADVANCE_TOKEN()
@@ -667,7 +662,7 @@ AST* AST_from(Arraylist* list)
                                 cn_arg = GenericNode_new(VariableNode_t, call_vn);
                             break;
                             case Number:
-                                call_ln = LiteralNode_new(String_from(tk->name), I32_t);
+                                call_ln = LiteralNode_new_number(tk->number);
                                 cn_arg = GenericNode_new(LiteralNode_t, call_ln);
                             break;
                             case String:
@@ -678,6 +673,9 @@ AST* AST_from(Arraylist* list)
                                 ADVANCE_TOKEN()
                                 continue;
                             break;
+                            default:
+                                UNEXPECTED("token", tk->line, tk->column)
+                            break;
                         }
                         CallNode_add_arg(cn, cn_arg);
                         ADVANCE_TOKEN()
@@ -700,5 +698,14 @@ AST* AST_from(Arraylist* list)
         ADVANCE_TOKEN()
     }
 
+    // Every scope is closed by the end, also when the tokens are one
+    // function of the streaming modes
+    if (scope->size > 0) {
+        Token* end = Arraylist_get(list, Arraylist_size(list) - 1);
+        EXPECTED("}", end->line, end->column)
+    }
+
+    Stack_free(scope);
+    StringBuilder_free(sb);
     return ast;
 }
\ No newline at end of file
@@ -0,0 +1,205 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch.h"
+#include "tokenizer.h"
+#include "ast.h"
+#include "passmanager.h"
+#include "typecheck.h"
+#include "irbuilder.h"
+#include "stringbuilder.h"
+#include "workpool.h"
+#include "object.h"
+#include "panic.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define ALLOC_SUBSYSTEM OtherAlloc
+#include "alloc.h"
+
+// <outdir>/<file name without .bc><extension>
+char* batch_output_path(char* outdir, char* path, char* extension)
+{
+    char* name = strrchr(path, '/');
+    name = name != NULL ? name + 1 : path;
+    int length = strlen(name);
+    if (length > 3 && strcmp(name + length - 3, ".bc") == 0)
+        length -= 3;
+
+    StringBuilder* sb = StringBuilder_new();
+    StringBuilder_add_arr(sb, outdir);
+    if (sb->size > 0 && sb->str[sb->size - 1] != '/')
+        StringBuilder_add(sb, '/');
+    StringBuilder_add_n(sb, name, length);
+    StringBuilder_add_arr(sb, extension);
+
+    char* output = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+    return output;
+}
+
+Batch* Batch_new(Arraylist* paths, char* outdir, GenOptions* options, bool emit_ir, bool object, int opt_level, Arraylist* disabled)
+{
+    Batch* batch = malloc(sizeof(Batch));
+    batch->count = Arraylist_size(paths);
+    batch->files = calloc(batch->count, sizeof(BatchFile));
+    batch->outdir = outdir;
+    batch->options = options;
+    batch->emit_ir = emit_ir;
+    batch->object = object;
+    batch->opt_level = opt_level;
+    batch->disabled = disabled;
+    batch->cache = NULL;
+    batch->output_bytes = 0;
+    pthread_mutex_init(&batch->lock, NULL);
+
+    for (int i = 0; i < batch->count; i++) {
+        batch->files[i].path = Arraylist_get(paths, i);
+        batch->files[i].output = batch_output_path(outdir, batch->files[i].path, emit_ir ? ".ir" : object ? ".nnio" : ".nni");
+
+        for (int j = 0; j < i; j++)
+            if (strcmp(batch->files[i].output, batch->files[j].output) == 0)
+                panic("%s and %s would both be written to %s", batch->files[j].path,
+                    batch->files[i].path, batch->files[i].output);
+    }
+
+    return batch;
+}
+
+// The whole program pipeline of main for one file
+void batch_compile(Batch* batch, BatchFile* file)
+{
+    char* code = read_file(file->path);
+    char key[DISK_CACHE_KEY_SIZE];
+    char* cached = NULL;
+    long size;
+
+    if (batch->cache != NULL) {
+        DiskCache_key(batch->cache, code, key);
+        cached = DiskCache_get(batch->cache, key, &size);
+    }
+    if (cached != NULL) {
+        file->sink = Sink_file(file->output);
+        Sink_write(file->sink, cached, size);
+        free(cached);
+        free(code);
+        return;
+    }
+
+    PassManager* pm = PassManager_standard(batch->opt_level);
+    for (int i = 0; i < Arraylist_size(batch->disabled); i++)
+        PassManager_disable(pm, Arraylist_get(batch->disabled, i));
+
+    Arraylist* tokens = tokenize(code);
+    AST* ast = AST_from(tokens);
+    PassManager_run(pm, ast, batch->options);
+    typecheck_run(ast);
+
+    // Kept in memory to be stored before it is written out
+    file->sink = batch->cache != NULL ? Sink_memory() : Sink_file(file->output);
+    if (batch->emit_ir) {
+        char* dump = AST_dump_ir(ast);
+        Sink_write_str(file->sink, dump);
+        free(dump);
+    }
+    else if (batch->object) {
+        ObjectFile* object = ObjectFile_from_ast(ast, batch->options);
+        ObjectFile_write(object, file->sink);
+        ObjectFile_free(object);
+    }
+    else {
+        ast_to_nni_sink(ast, file->sink, batch->options);
+        Sink_write_str(file->sink, "\n");
+    }
+
+    if (batch->cache != NULL) {
+        char* output = Sink_memory_get(file->sink);
+        size = file->sink->written;
+        Sink_free(file->sink);
+        file->sink = NULL;
+
+        DiskCache_put(batch->cache, key, ast->imports, output, size);
+        file->sink = Sink_file(file->output);
+        Sink_write(file->sink, output, size);
+        free(output);
+    }
+
+    AST_free(ast);
+    Arraylist_free(tokens);
+    free(code);
+    PassManager_free(pm);
+}
+
+// A panic inside the compile lands back here. Whatever the compile held at
+// that point is leaked, the process is short lived and the other files
+// still get compiled
+void batch_run_file(Batch* batch, BatchFile* file)
+{
+    PanicHandler handler;
+
+    if (setjmp(handler.env) == 0) {
+        panic_push_handler(&handler);
+        batch_compile(batch, file);
+        panic_pop_handler();
+    }
+    else {
+        file->error = String_from(handler.message);
+        if (file->sink != NULL) {
+            // Half a program is worse than none
+            file->sink->used = 0;
+            Sink_free(file->sink);
+            file->sink = NULL;
+            remove(file->output);
+        }
+        return;
+    }
+
+    long written = file->sink->written;
+    Sink_free(file->sink);
+    file->sink = NULL;
+
+    pthread_mutex_lock(&batch->lock);
+    batch->output_bytes += written;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+void batch_work(void* arg, int index)
+{
+    Batch* batch = arg;
+    batch_run_file(batch, &batch->files[index]);
+}
+
+int Batch_run(Batch* batch, int jobs, TimeReport* report)
+{
+    if (mkdir(batch->outdir, 0777) != 0 && errno != EEXIST)
+        panic("Could not create %s: %s", batch->outdir, strerror(errno));
+
+    TimeReport_start(report, "compile");
+    WorkPool_run(jobs, batch->count, batch_work, batch);
+    TimeReport_stop(report);
+    report->output_bytes = batch->output_bytes;
+
+    int failed = 0;
+    for (int i = 0; i < batch->count; i++) {
+        if (batch->files[i].error == NULL)
+            continue;
+        fprintf(stderr, "%s: Error: %s\n", batch->files[i].path, batch->files[i].error);
+        failed++;
+    }
+
+    return failed;
+}
+
+void Batch_free(Batch* batch)
+{
+    for (int i = 0; i < batch->count; i++) {
+        free(batch->files[i].output);
+        free(batch->files[i].error);
+    }
+
+    pthread_mutex_destroy(&batch->lock);
+    free(batch->files);
+    free(batch);
+}
@@ -0,0 +1,57 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "arraylist.h"
+#include "nonamegenerator.h"
+#include "timereport.h"
+#include "sink.h"
+#include "diskcache.h"
+
+#include <stdbool.h>
+#include <pthread.h>
+
+// One input of a batch and what became of it
+struct batch_file
+{
+    char* path;
+    char* output;
+    // Open while the file is written, closed again when a compile fails
+    Sink* sink;
+    // Message of the panic that stopped the compile, NULL when it succeeded
+    char* error;
+};
+
+typedef struct batch_file BatchFile;
+
+// Compiles many BC files at once, each one on its own and written to
+// <outdir>/<name>.nni (.ir with emit_ir, .nnio for objects) on a WorkPool. Everything a compile
+// touches belongs to that compile, only the output byte count is shared
+struct batch
+{
+    BatchFile* files;
+    int count;
+    char* outdir;
+    GenOptions* options;
+    bool emit_ir;
+    // Object files (.nnio) instead of programs
+    bool object;
+    int opt_level;
+    // char*, passes turned off in every compile
+    Arraylist* disabled;
+    // Where outputs are looked up and stored, NULL for none
+    DiskCache* cache;
+    long output_bytes;
+    pthread_mutex_t lock;
+};
+
+typedef struct batch Batch;
+
+// Takes the paths of the inputs, panics when two of them would be written
+// to the same output
+Batch* Batch_new(Arraylist* paths, char* outdir, GenOptions* options, bool emit_ir, bool object, int opt_level, Arraylist* disabled);
+// Runs the compiles on jobs threads and reports the failed files on stderr
+// in input order. Returns how many failed, a failure does not stop the rest
+int Batch_run(Batch* batch, int jobs, TimeReport* report);
+void Batch_free(Batch* batch);
+
+#endif
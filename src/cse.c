@@ -0,0 +1,674 @@
+#include "cse.h"
+#include "ast.h"
+#include "tree.h"
+#include "arraylist.h"
+#include "stringbuilder.h"
+#include "hashtable.h"
+#include "panic.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ALLOC_SUBSYSTEM PassesAlloc
+#include "alloc.h"
+
+// Starting capacity of the value and variable tables, a power of two
+#define CSE_TABLE_SIZE 64
+// Statements of a block are numbered this far apart so that temporaries fit
+// in between, the block is renumbered once a gap runs out
+#define CSE_LABEL_GAP (1LL << 32)
+
+enum cse_kind
+{
+    CseVariable,
+    CseLiteral,
+    CseOperator
+};
+
+typedef enum cse_kind CseKind;
+
+struct cse_node;
+
+// Value number. Subtrees with the same value compute the same result, an
+// operator value is its operator and the values of its operands
+struct cse_value
+{
+    uint64_t hash;
+    CseKind kind;
+    int op;
+    int version;
+    // Name of a variable or text of a literal
+    char* text;
+    struct cse_value* left;
+    struct cse_value* right;
+    // Subtrees with this operator value in the order they were found,
+    // linked through next_same
+    struct cse_node* occurrences;
+    struct cse_node* last;
+    // Earliest occurrence still in the block, recomputed when it goes away
+    struct cse_node* first;
+    int count;
+};
+
+typedef struct cse_value CseValue;
+
+// Version of a variable, bumped on every write
+struct cse_symbol
+{
+    uint64_t hash;
+    char* name;
+    int version;
+};
+
+typedef struct cse_symbol CseSymbol;
+
+struct cse_entry;
+
+// Node of an expression of the block, in tree form
+struct cse_node
+{
+    GenericNode* gn;
+    struct cse_node* left;
+    struct cse_node* right;
+    struct cse_node* parent;
+    struct cse_entry* entry;
+    // NULL when the subtree is not pure
+    CseValue* value;
+    struct cse_node* next_same;
+    // Index in the postfix list the node came from, orders the nodes of a
+    // statement
+    int post;
+    // Dispatch cost of evaluating the subtree with the stack code generator
+    int cost;
+    bool dead;
+};
+
+typedef struct cse_node CseNode;
+
+// Statement of the block. Temporaries are added in front of the statement
+// that first uses them
+struct cse_entry
+{
+    GenericNode* gn;
+    // Set for assignments with more than one node on the right
+    CseNode* root;
+    int64_t label;
+    // Added by the pass
+    bool added;
+    // The right side has to be written back from the tree
+    bool dirty;
+    struct cse_entry* prev;
+    struct cse_entry* next;
+};
+
+typedef struct cse_entry CseEntry;
+
+struct cse_block
+{
+    // CseValue* and CseSymbol* by their hash
+    HashTable* values;
+    HashTable* symbols;
+    // CseNode*, every node of the block
+    Arraylist* nodes;
+    // CseValue*, operator values seen at least twice
+    Arraylist* candidates;
+    CseEntry* head;
+};
+
+typedef struct cse_block CseBlock;
+
+struct cse_state
+{
+    int next_id;
+    int replaced;
+};
+
+typedef struct cse_state CseState;
+
+uint64_t cse_mix(uint64_t hash, uint64_t value)
+{
+    return hash ^ (value + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2));
+}
+
+void CseValue_free(void* ptr)
+{
+    CseValue* value = ptr;
+    free(value->text);
+    free(value);
+}
+
+void CseSymbol_free(void* ptr)
+{
+    CseSymbol* symbol = ptr;
+    free(symbol->name);
+    free(symbol);
+}
+
+CseSymbol* cse_symbol(CseBlock* block, char* name)
+{
+    uint64_t hash = fnv1a_hash(name, strlen(name));
+    int position;
+
+    for (CseSymbol* symbol = HashTable_first(block->symbols, hash, &position); symbol != NULL;
+         symbol = HashTable_next(block->symbols, hash, &position)) {
+        if (strcmp(symbol->name, name) == 0)
+            return symbol;
+    }
+
+    CseSymbol* symbol = malloc(sizeof(CseSymbol));
+    symbol->hash = hash;
+    symbol->name = String_from(name);
+    symbol->version = 0;
+    HashTable_add(block->symbols, symbol);
+    return symbol;
+}
+
+// Every write gives the variable a new version, so values computed from the
+// old one no longer match
+void cse_write(CseBlock* block, char* name)
+{
+    cse_symbol(block, name)->version++;
+}
+
+void cse_write_call(CseBlock* block, CallNode* cn)
+{
+    for (int i = 0; i < Arraylist_size(cn->args); i++) {
+        GenericNode* gn = Arraylist_get(cn->args, i);
+        if (gn->type == VariableNode_t)
+            cse_write(block, ((VariableNode*)gn->node)->name);
+    }
+}
+
+bool cse_value_equal(CseValue* value, CseKind kind, int op, int version, char* text, CseValue* left, CseValue* right)
+{
+    if (value->kind != kind)
+        return false;
+
+    switch (kind) {
+    case CseVariable:
+        return value->version == version && strcmp(value->text, text) == 0;
+    case CseLiteral:
+        return strcmp(value->text, text) == 0;
+    default:
+        return value->op == op && value->left == left && value->right == right;
+    }
+}
+
+// The value of the given parts, made on first use. Takes the text
+CseValue* cse_value(CseBlock* block, CseKind kind, int op, int version, char* text, CseValue* left, CseValue* right)
+{
+    uint64_t hash;
+    if (kind == CseOperator)
+        hash = cse_mix(cse_mix(cse_mix(CseOperator, op), left != NULL ? left->hash : 0), right->hash);
+    else
+        hash = cse_mix(cse_mix(fnv1a_hash(text, strlen(text)), kind), version);
+
+    int position;
+    for (CseValue* value = HashTable_first(block->values, hash, &position); value != NULL;
+         value = HashTable_next(block->values, hash, &position)) {
+        if (cse_value_equal(value, kind, op, version, text, left, right)) {
+            free(text);
+            return value;
+        }
+    }
+
+    CseValue* value = calloc(1, sizeof(CseValue));
+    value->hash = hash;
+    value->kind = kind;
+    value->op = op;
+    value->version = version;
+    value->text = text;
+    value->left = left;
+    value->right = right;
+    HashTable_add(block->values, value);
+    return value;
+}
+
+CseNode* cse_node_new(CseBlock* block, GenericNode* gn, CseEntry* entry, int post)
+{
+    CseNode* node = calloc(1, sizeof(CseNode));
+    node->gn = gn;
+    node->entry = entry;
+    node->post = post;
+    Arraylist_add(block->nodes, node);
+    return node;
+}
+
+bool cse_before(CseNode* a, CseNode* b)
+{
+    return a->entry->label < b->entry->label || (a->entry == b->entry && a->post < b->post);
+}
+
+void cse_add_occurrence(CseBlock* block, CseValue* value, CseNode* node)
+{
+    if (value->occurrences == NULL)
+        value->occurrences = node;
+    else
+        value->last->next_same = node;
+    value->last = node;
+
+    if (value->first == NULL)
+        value->first = node;
+    if (++value->count == 2)
+        Arraylist_add(block->candidates, value);
+}
+
+// Builds the tree of the postfix list and numbers its operator subtrees
+CseNode* cse_tree(CseBlock* block, CseEntry* entry, ExpressionNode* en)
+{
+    int size = Arraylist_size(en->nodes);
+    CseNode** stack = malloc(sizeof(CseNode*) * size);
+    int top = 0;
+
+    for (int i = 0; i < size; i++) {
+        GenericNode* gn = Arraylist_get(en->nodes, i);
+        CseNode* node = cse_node_new(block, gn, entry, i);
+        StringBuilder* sb;
+        OpType op;
+
+        switch (gn->type) {
+        case VariableNode_t:
+            node->cost = 1;
+            node->value = cse_value(block, CseVariable, 0, cse_symbol(block, ((VariableNode*)gn->node)->name)->version,
+                String_from(((VariableNode*)gn->node)->name), NULL, NULL);
+            break;
+        case LiteralNode_t:
+            // NEW, SET and PUSH
+            node->cost = 3;
+            sb = StringBuilder_new();
+            StringBuilder_add_arr(sb, ((LiteralNode*)gn->node)->type == Char_t ? "s" : "n");
+            LiteralNode_append(sb, (LiteralNode*)gn->node);
+            node->value = cse_value(block, CseLiteral, 0, 0, StringBuilder_get(sb), NULL, NULL);
+            StringBuilder_free(sb);
+            break;
+        case OperatorNode_t:
+            op = ((OperatorNode*)gn->node)->op_t;
+            if (top < (op == Not_t ? 1 : 2))
+                panic("Malformed expression, report bug: https://github.com/alexburroughs/BC-2/issues");
+
+            node->right = stack[--top];
+            node->right->parent = node;
+            node->cost = node->right->cost + (op == NotEqual_t ? 2 : 1);
+            if (op != Not_t) {
+                node->left = stack[--top];
+                node->left->parent = node;
+                node->cost += node->left->cost;
+            }
+
+            if (node->right->value != NULL && (node->left == NULL || node->left->value != NULL)) {
+                node->value = cse_value(block, CseOperator, op, 0, NULL,
+                    node->left != NULL ? node->left->value : NULL, node->right->value);
+                cse_add_occurrence(block, node->value, node);
+            }
+            break;
+        default:
+            node->cost = 1;
+            break;
+        }
+
+        stack[top++] = node;
+    }
+
+    CseNode* root = stack[0];
+    free(stack);
+    return root;
+}
+
+CseEntry* cse_entry_new(GenericNode* gn)
+{
+    CseEntry* entry = calloc(1, sizeof(CseEntry));
+    entry->gn = gn;
+    return entry;
+}
+
+void cse_relabel(CseBlock* block)
+{
+    int64_t label = 0;
+    for (CseEntry* entry = block->head; entry != NULL; entry = entry->next, label += CSE_LABEL_GAP)
+        entry->label = label;
+}
+
+// Adds a statement right in front of at
+CseEntry* cse_entry_insert(CseBlock* block, CseEntry* at, GenericNode* gn)
+{
+    if (at->label - (at->prev != NULL ? at->prev->label : at->label - CSE_LABEL_GAP) < 2)
+        cse_relabel(block);
+    int64_t low = at->prev != NULL ? at->prev->label : at->label - CSE_LABEL_GAP;
+
+    CseEntry* entry = cse_entry_new(gn);
+    entry->label = low + (at->label - low) / 2;
+    entry->added = true;
+    entry->prev = at->prev;
+    entry->next = at;
+    if (at->prev != NULL)
+        at->prev->next = entry;
+    else
+        block->head = entry;
+    at->prev = entry;
+    return entry;
+}
+
+// Numbers the block the way it runs, variables take a new version on every
+// assignment, declaration or call argument
+void cse_scan(CseBlock* block, Arraylist* statements, int begin, int end)
+{
+    CseEntry* last = NULL;
+
+    for (int s = begin; s < end; s++) {
+        GenericNode* gn = Arraylist_get(statements, s);
+        CseEntry* entry = cse_entry_new(gn);
+        AssignmentNode* an;
+
+        entry->label = (s - begin) * CSE_LABEL_GAP;
+        entry->prev = last;
+        if (last != NULL)
+            last->next = entry;
+        else
+            block->head = entry;
+        last = entry;
+
+        switch (gn->type) {
+        case AssignmentNode_t:
+            an = (AssignmentNode*)gn->node;
+            if (Arraylist_size(an->right->nodes) > 1)
+                entry->root = cse_tree(block, entry, an->right);
+            else if (Arraylist_size(an->right->nodes) == 1 && ((GenericNode*)Arraylist_get(an->right->nodes, 0))->type == CallNode_t)
+                cse_write_call(block, ((GenericNode*)Arraylist_get(an->right->nodes, 0))->node);
+            cse_write(block, an->left);
+            break;
+        case DeclarationNode_t:
+            cse_write(block, ((DeclarationNode*)gn->node)->name);
+            break;
+        case CallNode_t:
+            cse_write_call(block, (CallNode*)gn->node);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Earliest occurrence of the value still in the block
+CseNode* cse_first(CseValue* value)
+{
+    if (!value->first->dead)
+        return value->first;
+
+    value->first = NULL;
+    for (CseNode* node = value->occurrences; node != NULL; node = node->next_same)
+        if (!node->dead && (value->first == NULL || cse_before(node, value->first)))
+            value->first = node;
+    return value->first;
+}
+
+// The repeated value that saves the most dispatches, the earliest one of
+// equal savings. NULL once nothing saves any
+CseValue* cse_best(CseBlock* block)
+{
+    CseValue* best = NULL;
+    int best_saving = 0;
+
+    for (int i = 0; i < Arraylist_size(block->candidates);) {
+        CseValue* value = Arraylist_get(block->candidates, i);
+        if (value->count < 2) {
+            // Counts only go down, swap it out for the last one
+            int last = Arraylist_size(block->candidates) - 1;
+            Arraylist_set(block->candidates, Arraylist_get(block->candidates, last), i);
+            Arraylist_remove(block->candidates, last);
+            continue;
+        }
+        i++;
+
+        CseNode* first = cse_first(value);
+        // Computed once and POPed into the temporary, then one PUSH per use
+        int saving = value->count * first->cost - (first->cost + 1 + value->count);
+        if (saving > best_saving || (saving == best_saving && best != NULL && cse_before(first, best->first))) {
+            best_saving = saving;
+            best = value;
+        }
+    }
+
+    return best;
+}
+
+// Puts node in the place of old in its tree
+void cse_put(CseNode* old, CseNode* node)
+{
+    node->parent = old->parent;
+    if (old->parent == NULL)
+        old->entry->root = node;
+    else if (old->parent->left == old)
+        old->parent->left = node;
+    else
+        old->parent->right = node;
+    old->parent = NULL;
+}
+
+// Removes the subtree from the block
+void cse_kill(CseBlock* block, CseNode* root)
+{
+    CseNode** stack = malloc(sizeof(CseNode*) * Arraylist_size(block->nodes));
+    int top = 0;
+
+    stack[top++] = root;
+    while (top > 0) {
+        CseNode* node = stack[--top];
+        node->dead = true;
+        if (node->gn->type == OperatorNode_t && node->value != NULL)
+            node->value->count--;
+        GenericNode_free(node->gn);
+
+        if (node->left != NULL)
+            stack[top++] = node->left;
+        if (node->right != NULL)
+            stack[top++] = node->right;
+    }
+
+    free(stack);
+}
+
+// Moves the subtree to the entry, its occurrences may now be the first ones
+void cse_move(CseBlock* block, CseNode* root, CseEntry* entry)
+{
+    CseNode** stack = malloc(sizeof(CseNode*) * Arraylist_size(block->nodes));
+    int top = 0;
+
+    entry->root = root;
+    stack[top++] = root;
+    while (top > 0) {
+        CseNode* node = stack[--top];
+        node->entry = entry;
+        if (node->gn->type == OperatorNode_t && node->value != NULL && node->value->count > 0
+            && !node->value->first->dead && cse_before(node, node->value->first))
+            node->value->first = node;
+
+        if (node->left != NULL)
+            stack[top++] = node->left;
+        if (node->right != NULL)
+            stack[top++] = node->right;
+    }
+
+    free(stack);
+}
+
+// Computes the value once into a new temporary in front of its first use
+// and replaces every occurrence with the temporary
+void cse_replace(CseState* state, CseBlock* block, CseValue* value)
+{
+    StringBuilder* sb = StringBuilder_new();
+    StringBuilder_add_arr(sb, "CSE ");
+    StringBuilder_add_arr(sb, String_from_int(state->next_id++));
+    char* name = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+
+    CseNode* first = cse_first(value);
+    int saved = first->cost - 1;
+    CseEntry* at = first->entry;
+
+    cse_entry_insert(block, at, GenericNode_new(DeclarationNode_t, DeclarationNode_new(String_from(name), I64_t)));
+    CseEntry* definition = cse_entry_insert(block, at, GenericNode_new(AssignmentNode_t, AssignmentNode_new(name, ExpressionNode_new())));
+    definition->dirty = true;
+
+    for (CseNode* node = value->occurrences; node != NULL; node = node->next_same) {
+        if (node->dead)
+            continue;
+
+        CseNode* leaf = cse_node_new(block, GenericNode_new(VariableNode_t, VariableNode_new(String_from(name), NULL, I64_t)), node->entry, node->post);
+        leaf->cost = 1;
+        cse_put(node, leaf);
+        for (CseNode* parent = leaf->parent; parent != NULL; parent = parent->parent)
+            parent->cost -= saved;
+        node->entry->dirty = true;
+
+        if (node == first)
+            cse_move(block, node, definition);
+        else
+            cse_kill(block, node);
+        state->replaced++;
+    }
+
+    value->count = 0;
+}
+
+// Postfix list of the tree, into the expression
+void cse_emit(CseBlock* block, CseNode* root, ExpressionNode* en)
+{
+    CseNode** stack = malloc(sizeof(CseNode*) * Arraylist_size(block->nodes));
+    CseNode** order = malloc(sizeof(CseNode*) * Arraylist_size(block->nodes));
+    int top = 0;
+    int count = 0;
+
+    // Node, right, left is the postfix order backwards
+    stack[top++] = root;
+    while (top > 0) {
+        CseNode* node = stack[--top];
+        order[count++] = node;
+        if (node->left != NULL)
+            stack[top++] = node->left;
+        if (node->right != NULL)
+            stack[top++] = node->right;
+    }
+
+    // The nodes belong to the tree now, the list only drops its pointers
+    en->nodes->size = 0;
+    for (int i = count - 1; i >= 0; i--)
+        Arraylist_add(en->nodes, order[i]->gn);
+
+    free(order);
+    free(stack);
+}
+
+// Writes the changed expressions back and adds the temporaries to the
+// statements, returns the number of added statements
+int cse_write_back(CseBlock* block, Arraylist* statements, int begin)
+{
+    int added = 0;
+    int index = begin;
+
+    for (CseEntry* entry = block->head; entry != NULL; entry = entry->next, index++) {
+        if (entry->dirty)
+            cse_emit(block, entry->root, ((AssignmentNode*)entry->gn->node)->right);
+        if (entry->added) {
+            Arraylist_insert(statements, entry->gn, index);
+            added++;
+        }
+    }
+
+    return added;
+}
+
+void cse_block_free(CseBlock* block)
+{
+    CseEntry* entry = block->head;
+    while (entry != NULL) {
+        CseEntry* next = entry->next;
+        free(entry);
+        entry = next;
+    }
+
+    HashTable_free(block->values);
+    HashTable_free(block->symbols);
+    Arraylist_free(block->candidates);
+    Arraylist_free(block->nodes);
+}
+
+// Value numbers the statements begin to end once, then eliminates the most
+// profitable repeated subexpression until none is left. Returns the number
+// of statements added
+int cse_basic_block(CseState* state, Arraylist* statements, int begin, int end)
+{
+    if (begin >= end)
+        return 0;
+
+    CseBlock block;
+    block.values = HashTable_new(CseValue_free, CSE_TABLE_SIZE);
+    block.symbols = HashTable_new(CseSymbol_free, CSE_TABLE_SIZE);
+    block.nodes = Arraylist_new(free);
+    block.candidates = Arraylist_new_with_size(Arraylist_no_free, 16);
+    block.head = NULL;
+
+    cse_scan(&block, statements, begin, end);
+
+    bool changed = false;
+    CseValue* best;
+    while ((best = cse_best(&block)) != NULL) {
+        cse_replace(state, &block, best);
+        changed = true;
+    }
+
+    int added = changed ? cse_write_back(&block, statements, begin) : 0;
+    cse_block_free(&block);
+    return added;
+}
+
+void cse_block(CseState* state, Arraylist* statements)
+{
+    int begin = 0;
+
+    for (int i = 0; i <= Arraylist_size(statements); i++) {
+        GenericNode* gn = Arraylist_get(statements, i);
+
+        if (gn != NULL && (gn->type == AssignmentNode_t || gn->type == DeclarationNode_t || gn->type == CallNode_t))
+            continue;
+
+        // Control flow ends the basic block
+        i += cse_basic_block(state, statements, begin, i);
+
+        if (gn == NULL)
+            break;
+
+        switch (gn->type) {
+        case IfNode_t:
+            cse_block(state, ((IfNode*)gn->node)->statements);
+            break;
+        case ElseNode_t:
+            cse_block(state, ((ElseNode*)gn->node)->statements);
+            break;
+        case WhileNode_t:
+            cse_block(state, ((WhileNode*)gn->node)->statements);
+            break;
+        default:
+            break;
+        }
+        begin = i+1;
+    }
+}
+
+int cse_run(AST* ast)
+{
+    CseState state;
+    state.replaced = 0;
+
+    for (Hashmap_Node* iter = Hashmap_get_iter(ast->functions); iter != NULL; iter = Hashmap_iter_next(iter)) {
+        GenericNode* gn = iter->val;
+        if (gn->type != FunctionNode_t)
+            continue;
+
+        state.next_id = 0;
+        cse_block(&state, ((FunctionNode*)gn->node)->statements);
+    }
+
+    return state.replaced;
+}
@@ -0,0 +1,10 @@
+#ifndef CSE_H
+#define CSE_H
+
+#include "ast.h"
+
+// Computes repeated subexpressions of a basic block once into a temporary,
+// returns the number of replaced occurrences
+int cse_run(AST* ast);
+
+#endif
@@ -0,0 +1,330 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "diskcache.h"
+#include "hashtable.h"
+#include "sha256.h"
+#include "stringbuilder.h"
+#include "version.h"
+#include "panic.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ALLOC_SUBSYSTEM OtherAlloc
+#include "alloc.h"
+
+// First line of every entry, change it with the entry layout
+#define DISK_CACHE_MAGIC "bc-cache 1\n"
+// Eviction goes down to this percentage of max_size, so that it does not
+// run again on the next store
+#define DISK_CACHE_LOW_WATER 90
+// Temporary files this old were left by a compile that died
+#define DISK_CACHE_STALE_SECONDS 3600
+
+// An entry found while scanning the directory
+struct disk_cache_entry
+{
+    char* name;
+    long size;
+    // Modification time in nanoseconds
+    long long used;
+};
+
+typedef struct disk_cache_entry DiskCacheEntry;
+
+DiskCache* DiskCache_new(char* dir, long max_size, char* flags, ModuleRegistry* modules)
+{
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+        panic("Could not create %s: %s", dir, strerror(errno));
+
+    DiskCache* cache = malloc(sizeof(DiskCache));
+    cache->dir = String_from(dir);
+    cache->max_size = max_size;
+    cache->flags = String_from(flags);
+    cache->modules = modules;
+    cache->size = 0;
+    cache->scanned = false;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->stores = 0;
+    cache->evictions = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+void DiskCache_key(DiskCache* cache, char* source, char key[DISK_CACHE_KEY_SIZE])
+{
+    Sha256 sha;
+    Sha256_init(&sha);
+    Sha256_add(&sha, COMPILER_VERSION "\n", sizeof(COMPILER_VERSION));
+    Sha256_add(&sha, cache->flags, strlen(cache->flags));
+    Sha256_add(&sha, source, strlen(source));
+    Sha256_hex(&sha, key);
+}
+
+// <dir>/<name>, allocated
+char* disk_cache_path(DiskCache* cache, char* name)
+{
+    StringBuilder* sb = StringBuilder_new();
+    StringBuilder_add_arr(sb, cache->dir);
+    StringBuilder_add(sb, '/');
+    StringBuilder_add_arr(sb, name);
+
+    char* path = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+    return path;
+}
+
+// Whole file with a terminator after it, NULL when it can not be read
+char* disk_cache_read(char* path, long* size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    char* data = malloc(st.st_size + 1);
+    long done = 0;
+    while (done < st.st_size) {
+        ssize_t count = read(fd, data + done, st.st_size - done);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+        done += count;
+    }
+    close(fd);
+
+    if (done != st.st_size) {
+        free(data);
+        return NULL;
+    }
+
+    data[done] = '\0';
+    *size = done;
+    return data;
+}
+
+bool disk_cache_write(int fd, char* data, long size)
+{
+    while (size > 0) {
+        ssize_t count = write(fd, data, size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        data += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+// Start of the output in an entry, NULL when the entry is damaged or one of
+// its modules changed. Puts terminators into the header
+char* disk_cache_check(DiskCache* cache, char* data, long size)
+{
+    char* end = data + size;
+    char* pos = data + strlen(DISK_CACHE_MAGIC);
+
+    if (size < (long)strlen(DISK_CACHE_MAGIC) || strncmp(data, DISK_CACHE_MAGIC, strlen(DISK_CACHE_MAGIC)) != 0)
+        return NULL;
+
+    // One "<hash> <module>" line per import, then an empty line
+    while (pos < end && *pos != '\n') {
+        char* line_end = memchr(pos, '\n', end - pos);
+        char* name = memchr(pos, ' ', end - pos);
+        if (line_end == NULL || name == NULL || name > line_end)
+            return NULL;
+        *line_end = '\0';
+
+        Module* module = ModuleRegistry_find(cache->modules, name + 1);
+        if (module == NULL || module->hash != strtoull(pos, NULL, 16))
+            return NULL;
+        pos = line_end + 1;
+    }
+
+    return pos < end ? pos + 1 : NULL;
+}
+
+char* DiskCache_get(DiskCache* cache, char* key, long* size)
+{
+    char* path = disk_cache_path(cache, key);
+    long data_size;
+    char* data = disk_cache_read(path, &data_size);
+    char* output = data != NULL ? disk_cache_check(cache, data, data_size) : NULL;
+
+    if (output != NULL) {
+        *size = data + data_size - output;
+        memmove(data, output, *size + 1);
+        // The modification time is when the entry was last used
+        utimensat(AT_FDCWD, path, NULL, 0);
+    }
+    else {
+        free(data);
+        data = NULL;
+    }
+    free(path);
+
+    pthread_mutex_lock(&cache->lock);
+    if (data != NULL)
+        cache->hits++;
+    else
+        cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+
+    return data;
+}
+
+int disk_cache_entry_compare(const void* a, const void* b)
+{
+    const DiskCacheEntry* x = a;
+    const DiskCacheEntry* y = b;
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+// Finds the size of the directory and removes the least recently used
+// entries when it is too large. Called with the lock held
+void disk_cache_scan(DiskCache* cache)
+{
+    DIR* dir = opendir(cache->dir);
+    if (dir == NULL)
+        return;
+
+    int capacity = 64;
+    int count = 0;
+    DiskCacheEntry* entries = malloc(capacity * sizeof(DiskCacheEntry));
+    long total = 0;
+    long now = time(NULL);
+
+    for (struct dirent* de = readdir(dir); de != NULL; de = readdir(dir)) {
+        if (de->d_name[0] == '.')
+            continue;
+
+        struct stat st;
+        char* path = disk_cache_path(cache, de->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+
+        if (strlen(de->d_name) != DISK_CACHE_KEY_SIZE - 1) {
+            if (now - st.st_mtime > DISK_CACHE_STALE_SECONDS)
+                unlink(path);
+            free(path);
+            continue;
+        }
+        free(path);
+
+        if (count == capacity) {
+            capacity *= 2;
+            entries = realloc(entries, capacity * sizeof(DiskCacheEntry));
+        }
+        entries[count].name = String_from(de->d_name);
+        entries[count].size = st.st_size;
+        entries[count].used = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        total += st.st_size;
+        count++;
+    }
+    closedir(dir);
+
+    if (total > cache->max_size) {
+        qsort(entries, count, sizeof(DiskCacheEntry), disk_cache_entry_compare);
+        long target = cache->max_size / 100 * DISK_CACHE_LOW_WATER;
+
+        // Another process may have removed it already, it is gone either way
+        for (int i = 0; i < count && total > target; i++) {
+            char* path = disk_cache_path(cache, entries[i].name);
+            if (unlink(path) == 0)
+                cache->evictions++;
+            total -= entries[i].size;
+            free(path);
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+        free(entries[i].name);
+    free(entries);
+
+    cache->size = total;
+    cache->scanned = true;
+}
+
+void DiskCache_put(DiskCache* cache, char* key, Arraylist* imports, char* output, long size)
+{
+    StringBuilder* header = StringBuilder_new();
+    StringBuilder_add_arr(header, DISK_CACHE_MAGIC);
+
+    for (int i = 0; i < Arraylist_size(imports); i++) {
+        char line[32];
+        Module* module = ModuleRegistry_find(cache->modules, Arraylist_get(imports, i));
+        if (module == NULL) {
+            StringBuilder_free(header);
+            return;
+        }
+        sprintf(line, "%016llx ", (unsigned long long)module->hash);
+        StringBuilder_add_arr(header, line);
+        StringBuilder_add_arr(header, Arraylist_get(imports, i));
+        StringBuilder_add(header, '\n');
+    }
+    StringBuilder_add(header, '\n');
+
+    // Unique between the processes and the threads sharing the directory
+    static int temporaries = 0;
+    char name[DISK_CACHE_KEY_SIZE + 48];
+    sprintf(name, "%s.%li.%i.tmp", key, (long)getpid(), __atomic_fetch_add(&temporaries, 1, __ATOMIC_RELAXED));
+    char* temporary = disk_cache_path(cache, name);
+    char* path = disk_cache_path(cache, key);
+
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    bool stored = fd >= 0
+        && disk_cache_write(fd, header->str, header->size)
+        && disk_cache_write(fd, output, size);
+    if (fd >= 0 && close(fd) != 0)
+        stored = false;
+    if (stored)
+        stored = rename(temporary, path) == 0;
+    if (!stored && fd >= 0)
+        unlink(temporary);
+
+    if (stored) {
+        pthread_mutex_lock(&cache->lock);
+        cache->stores++;
+        if (!cache->scanned)
+            disk_cache_scan(cache);
+        else
+            cache->size += header->size + size;
+        if (cache->size > cache->max_size)
+            disk_cache_scan(cache);
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    StringBuilder_free(header);
+    free(temporary);
+    free(path);
+}
+
+void DiskCache_print_stats(DiskCache* cache, FILE* out)
+{
+    fprintf(out, "cache: %li hits, %li misses, %li stored, %li evicted\n",
+        cache->hits, cache->misses, cache->stores, cache->evictions);
+}
+
+void DiskCache_free(DiskCache* cache)
+{
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->dir);
+    free(cache->flags);
+    free(cache);
+}
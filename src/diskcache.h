@@ -0,0 +1,56 @@
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include "arraylist.h"
+#include "modules.h"
+#include "sha256.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// SHA-256 key in hex and its terminator. A key stands for the source in
+// every process sharing the directory, so no two sources may share one
+#define DISK_CACHE_KEY_SIZE SHA256_HEX_SIZE
+#define DISK_CACHE_DEFAULT_SIZE (256L << 20)
+
+// Outputs of earlier compiles in a directory, so that other processes and
+// machines sharing it can reuse them. An entry is named by the SHA-256 of the
+// compiler version, the flags and the source, and lists the modules the
+// source imports with a hash of their contents; it is only used while they
+// still match. Entries are written under a temporary name and renamed, so a
+// reader never sees half of one. Once the directory grows past max_size the
+// least recently used entries are removed
+struct disk_cache
+{
+    char* dir;
+    long max_size;
+    // Arguments that change the output, part of every key
+    char* flags;
+    // Where the imports of an entry are found to be checked
+    ModuleRegistry* modules;
+    // Bytes in the directory as of the last scan, plus what was added since
+    long size;
+    bool scanned;
+    long hits;
+    long misses;
+    long stores;
+    long evictions;
+    // Batch compiles share the cache
+    pthread_mutex_t lock;
+};
+
+typedef struct disk_cache DiskCache;
+
+// Creates the directory when needed, panics when that fails
+DiskCache* DiskCache_new(char* dir, long max_size, char* flags, ModuleRegistry* modules);
+void DiskCache_key(DiskCache* cache, char* source, char key[DISK_CACHE_KEY_SIZE]);
+// Stored output for the key, NULL on a miss
+char* DiskCache_get(DiskCache* cache, char* key, long* size);
+// Stores the output of a compile that imported the modules. Failures are
+// not errors, the output is just not cached
+void DiskCache_put(DiskCache* cache, char* key, Arraylist* imports, char* output, long size);
+void DiskCache_print_stats(DiskCache* cache, FILE* out);
+void DiskCache_free(DiskCache* cache);
+
+#endif
@@ -0,0 +1,90 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "filecache.h"
+#include "stringbuilder.h"
+#include "panic.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ALLOC_SUBSYSTEM OtherAlloc
+#include "alloc.h"
+
+void CachedFile_free(void* ptr)
+{
+    CachedFile* file = ptr;
+    free(file->content);
+    free(file);
+}
+
+FileCache* FileCache_new()
+{
+    FileCache* cache = malloc(sizeof(FileCache));
+    cache->files = Hashmap_new(CachedFile_free);
+    return cache;
+}
+
+char* FileCache_key(char* path)
+{
+    if (path[0] == '/')
+        return String_from(path);
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+        panic("Could not get the working directory: %s", strerror(errno));
+
+    StringBuilder* sb = StringBuilder_new();
+    StringBuilder_add_arr(sb, cwd);
+    StringBuilder_add(sb, '/');
+    StringBuilder_add_arr(sb, path);
+
+    char* key = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+    return key;
+}
+
+CachedFile* FileCache_get(FileCache* cache, char* path)
+{
+    char* key = FileCache_key(path);
+    struct stat st;
+
+    if (stat(key, &st) != 0) {
+        free(key);
+        panic("Could not open %s", path);
+    }
+
+    CachedFile* file = Hashmap_get(cache->files, key);
+    if (file != NULL && file->size == st.st_size
+        && file->mtime_sec == st.st_mtim.tv_sec && file->mtime_nsec == st.st_mtim.tv_nsec) {
+        free(key);
+        return file;
+    }
+
+    if (file == NULL) {
+        file = calloc(1, sizeof(CachedFile));
+        Hashmap_insert(cache->files, key, file);
+    }
+    free(key);
+
+    // Touched or rewritten. The hash says whether it really changed, results
+    // built from the same content stay valid
+    char* content = read_file(path);
+    free(file->content);
+    file->content = content;
+    file->size = st.st_size;
+    file->mtime_sec = st.st_mtim.tv_sec;
+    file->mtime_nsec = st.st_mtim.tv_nsec;
+    file->hash = fnv1a_hash(content, strlen(content));
+    return file;
+}
+
+void FileCache_free(FileCache* cache)
+{
+    Hashmap_free(cache->files);
+    free(cache);
+}
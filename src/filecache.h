@@ -0,0 +1,41 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include "hashmap.h"
+#include "hashtable.h"
+
+#include <stdint.h>
+
+// A file as it was when last read
+struct cached_file
+{
+    char* content;
+    long size;
+    // Modification time, seconds and nanoseconds
+    long mtime_sec;
+    long mtime_nsec;
+    // FNV-1a of the content, what cached results are checked against
+    uint64_t hash;
+};
+
+typedef struct cached_file CachedFile;
+
+// Files read before, by absolute path. Every lookup checks the file on disk
+// again but only reads it when its size or modification time changed
+struct file_cache
+{
+    Hashmap* files;
+};
+
+typedef struct file_cache FileCache;
+
+FileCache* FileCache_new();
+// The file as it is now, relative paths are taken from the working
+// directory. Panics when it can not be read. The entry stays owned by the
+// cache and is only valid until the next lookup of the same path
+CachedFile* FileCache_get(FileCache* cache, char* path);
+// Absolute form of path, allocated
+char* FileCache_key(char* path);
+void FileCache_free(FileCache* cache);
+
+#endif
@@ -0,0 +1,84 @@
+#include "fragcache.h"
+#include "object.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALLOC_SUBSYSTEM CodegenAlloc
+#include "alloc.h"
+
+#define FRAGMENT_CACHE_SIZE 1024
+// Compiles a fragment may go unused before it is dropped
+#define FRAGMENT_MAX_AGE 64
+
+void Fragment_free(void* ptr)
+{
+    Fragment* fragment = ptr;
+    free(fragment->code);
+    Arraylist_free(fragment->imports);
+    free(fragment);
+}
+
+FragmentCache* FragmentCache_new()
+{
+    FragmentCache* cache = malloc(sizeof(FragmentCache));
+    cache->fragments = HashTable_new(Fragment_free, FRAGMENT_CACHE_SIZE);
+    cache->generation = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    return cache;
+}
+
+bool fragment_recent(void* item, void* arg)
+{
+    FragmentCache* cache = arg;
+    return cache->generation - ((Fragment*)item)->used <= FRAGMENT_MAX_AGE;
+}
+
+void FragmentCache_next_generation(FragmentCache* cache)
+{
+    cache->generation++;
+    if (cache->generation % FRAGMENT_MAX_AGE == 0)
+        HashTable_retain(cache->fragments, fragment_recent, cache);
+}
+
+Fragment* FragmentCache_get(FragmentCache* cache, uint64_t key)
+{
+    int position;
+    Fragment* fragment = HashTable_first(cache->fragments, key, &position);
+
+    if (fragment != NULL) {
+        fragment->used = cache->generation;
+        cache->hits++;
+        return fragment;
+    }
+
+    cache->misses++;
+    return NULL;
+}
+
+Fragment* FragmentCache_add(FragmentCache* cache, uint64_t key, char* code, long size, int labels, Arraylist* imports)
+{
+    Fragment* fragment = malloc(sizeof(Fragment));
+    fragment->key = key;
+    fragment->code = code;
+    fragment->size = size;
+    fragment->labels = labels;
+    fragment->imports = imports;
+    fragment->used = cache->generation;
+
+    HashTable_add(cache->fragments, fragment);
+    return fragment;
+}
+
+void Fragment_write(Fragment* fragment, int label_base, Sink* out)
+{
+    relocate_labels(fragment->code, fragment->size, fragment->labels > 0 ? label_base : 0, out);
+}
+
+void FragmentCache_free(FragmentCache* cache)
+{
+    HashTable_free(cache->fragments);
+    free(cache);
+}
@@ -0,0 +1,52 @@
+#ifndef FRAGCACHE_H
+#define FRAGCACHE_H
+
+#include "arraylist.h"
+#include "hashtable.h"
+#include "sink.h"
+
+#include <stdint.h>
+
+// Generated code of one top level function. A function compiles the same
+// wherever it sits in the file, only its labels move: they are stored
+// numbered from 0 and moved when written out
+struct fragment
+{
+    // First, it is what the table hashes on
+    uint64_t key;
+    char* code;
+    long size;
+    int labels;
+    // char*, modules imported in front of the function
+    Arraylist* imports;
+    // Generation of the compile that last used the fragment
+    long used;
+};
+
+typedef struct fragment Fragment;
+
+// Fragments by a hash of the function source and the options, kept across
+// compiles. Fragments no compile used for a while are dropped
+struct fragment_cache
+{
+    // Fragment* by key
+    HashTable* fragments;
+    long generation;
+    long hits;
+    long misses;
+};
+
+typedef struct fragment_cache FragmentCache;
+
+FragmentCache* FragmentCache_new();
+// Starts a compile, and drops what the recent ones did not use
+void FragmentCache_next_generation(FragmentCache* cache);
+// NULL on a miss
+Fragment* FragmentCache_get(FragmentCache* cache, uint64_t key);
+// Takes the code and the imports
+Fragment* FragmentCache_add(FragmentCache* cache, uint64_t key, char* code, long size, int labels, Arraylist* imports);
+// Writes the code with its labels numbered from label_base
+void Fragment_write(Fragment* fragment, int label_base, Sink* out);
+void FragmentCache_free(FragmentCache* cache);
+
+#endif
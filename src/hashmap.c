@@ -2,10 +2,14 @@
 #include "stdlib.h"
 #include "string.h"
 
+#define ALLOC_SUBSYSTEM ContainersAlloc
+#include "alloc.h"
+
 Hashmap* Hashmap_new(free_ptr_t free_ptr)
 {
     Hashmap* map = (Hashmap*)malloc(sizeof(Hashmap));
     map->size = 0;
+    map->first = NULL;
     map->free_ptr = free_ptr;
 
     return map;
@@ -31,10 +35,11 @@ int Hashmap_insert(Hashmap* map, char* key, void* val)
 {
     Hashmap_Node* node = (Hashmap_Node*)malloc(sizeof(Hashmap_Node));
     
-    node->key = (char*)malloc(sizeof(char) * MAX_KEY_SIZE);
+    node->key = (char*)malloc(sizeof(char) * (strlen(key)+1));
     strcpy(node->key, key);
 
     node->val = val;
+    node->next = NULL;
 
     if (map->size == 0) {
         map->first = node;
@@ -0,0 +1,132 @@
+#include "hashtable.h"
+
+#include <stdlib.h>
+
+#define ALLOC_SUBSYSTEM ContainersAlloc
+#include "alloc.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+HashTable* HashTable_new(free_ptr_t free_ptr, int capacity)
+{
+    int size = 1;
+    while (size < capacity)
+        size *= 2;
+
+    HashTable* table = malloc(sizeof(HashTable));
+    table->slots = calloc(size, sizeof(void*));
+    table->capacity = size;
+    table->count = 0;
+    table->free_ptr = free_ptr;
+    return table;
+}
+
+uint64_t hashtable_hash(void* item)
+{
+    return *(uint64_t*)item;
+}
+
+void hashtable_place(HashTable* table, void* item)
+{
+    int mask = table->capacity - 1;
+    int i = (int)(hashtable_hash(item) & mask);
+    while (table->slots[i] != NULL)
+        i = (i + 1) & mask;
+
+    table->slots[i] = item;
+    table->count++;
+}
+
+// Moves the items into new slots of the capacity, without the ones keep
+// returns false for
+void hashtable_rebuild(HashTable* table, int capacity, bool (*keep)(void* item, void* arg), void* arg)
+{
+    void** slots = table->slots;
+    int old_capacity = table->capacity;
+
+    table->slots = calloc(capacity, sizeof(void*));
+    table->capacity = capacity;
+    table->count = 0;
+
+    for (int i = 0; i < old_capacity; i++) {
+        if (slots[i] == NULL)
+            continue;
+        if (keep != NULL && !keep(slots[i], arg))
+            table->free_ptr(slots[i]);
+        else
+            hashtable_place(table, slots[i]);
+    }
+
+    free(slots);
+}
+
+void HashTable_add(HashTable* table, void* item)
+{
+    if (2 * (table->count + 1) > table->capacity)
+        hashtable_rebuild(table, table->capacity * 2, NULL, NULL);
+
+    hashtable_place(table, item);
+}
+
+// From position on, the next slot of the probe sequence holding the hash
+void* hashtable_probe(HashTable* table, uint64_t hash, int* position)
+{
+    int mask = table->capacity - 1;
+
+    for (int i = *position; table->slots[i] != NULL; i = (i + 1) & mask) {
+        if (hashtable_hash(table->slots[i]) == hash) {
+            *position = i;
+            return table->slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+void* HashTable_first(HashTable* table, uint64_t hash, int* position)
+{
+    *position = (int)(hash & (table->capacity - 1));
+    return hashtable_probe(table, hash, position);
+}
+
+void* HashTable_next(HashTable* table, uint64_t hash, int* position)
+{
+    *position = (*position + 1) & (table->capacity - 1);
+    return hashtable_probe(table, hash, position);
+}
+
+void HashTable_retain(HashTable* table, bool (*keep)(void* item, void* arg), void* arg)
+{
+    hashtable_rebuild(table, table->capacity, keep, arg);
+}
+
+int HashTable_size(HashTable* table)
+{
+    return table->count;
+}
+
+void HashTable_free(HashTable* table)
+{
+    for (int i = 0; i < table->capacity; i++)
+        if (table->slots[i] != NULL)
+            table->free_ptr(table->slots[i]);
+
+    free(table->slots);
+    free(table);
+}
+
+uint64_t fnv1a_hash(char* data, long size)
+{
+    return fnv1a_hash_continue(FNV_OFFSET_BASIS, data, size);
+}
+
+uint64_t fnv1a_hash_continue(uint64_t hash, char* data, long size)
+{
+    for (long i = 0; i < size; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
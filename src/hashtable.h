@@ -0,0 +1,41 @@
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+#include "arraylist.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Open addressing over items whose first member is their 64 bit hash, for
+// lookups too frequent for Hashmap. The table only compares hashes: a
+// lookup walks the items with the hash using HashTable_first and
+// HashTable_next and checks the rest of the key itself
+struct hashtable
+{
+    void** slots;
+    // A power of two, kept at least twice the count so probes stay short
+    int capacity;
+    int count;
+    free_ptr_t free_ptr;
+};
+
+typedef struct hashtable HashTable;
+
+// The capacity is rounded up to a power of two
+HashTable* HashTable_new(free_ptr_t free_ptr, int capacity);
+void HashTable_add(HashTable* table, void* item);
+// First item with the hash, NULL when there is none. Sets position for
+// HashTable_next
+void* HashTable_first(HashTable* table, uint64_t hash, int* position);
+// Item with the hash after the one at position, NULL after the last
+void* HashTable_next(HashTable* table, uint64_t hash, int* position);
+// Frees the items keep returns false for and rebuilds the table
+void HashTable_retain(HashTable* table, bool (*keep)(void* item, void* arg), void* arg);
+int HashTable_size(HashTable* table);
+void HashTable_free(HashTable* table);
+
+uint64_t fnv1a_hash(char* data, long size);
+// Hash of the data hashed so far followed by this data
+uint64_t fnv1a_hash_continue(uint64_t hash, char* data, long size);
+
+#endif
@@ -0,0 +1,409 @@
+#include "ir.h"
+#include "arraylist.h"
+#include "hashmap.h"
+#include "stringbuilder.h"
+#include "tree.h"
+#include "type.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define ALLOC_SUBSYSTEM CodegenAlloc
+#include "alloc.h"
+
+char* ir_type_names[] = {"i64", "i32", "i16", "i8", "u64", "u32", "u16", "u8", "f64", "f32", "char", "void"};
+
+char* ir_op_names[] = {"add", "sub", "mul", "div", "mod", "and", "or", "gt", "lt", "ge", "le", "ne", "not", "eq", "shl", "shr", "band"};
+
+void IrInst_free(void* ptr)
+{
+    IrInst* inst = (IrInst*)ptr;
+
+    if (inst->text)
+        free(inst->text);
+    Arraylist_free(inst->operands);
+    free(inst);
+}
+
+void IrBlock_free(void* ptr)
+{
+    IrBlock* block = (IrBlock*)ptr;
+
+    Arraylist_free(block->insts);
+    Arraylist_free(block->preds);
+    Hashmap_free(block->defs);
+    Arraylist_free(block->incomplete);
+    Arraylist_free(block->incomplete_names);
+    free(block);
+}
+
+IrFunction* IrFunction_new(char* name, Type return_type)
+{
+    IrFunction* fn = malloc(sizeof(IrFunction));
+
+    fn->name = String_from(name);
+    fn->return_type = return_type;
+    fn->params = Arraylist_new(Arraylist_no_free);
+    fn->blocks = Arraylist_new(IrBlock_free);
+    fn->next_value = 0;
+    fn->next_block = 0;
+
+    return fn;
+}
+
+void IrFunction_free(IrFunction* fn)
+{
+    free(fn->name);
+    Arraylist_free(fn->params);
+    Arraylist_free(fn->blocks);
+    free(fn);
+}
+
+IrBlock* IrBlock_new(IrFunction* fn)
+{
+    IrBlock* block = malloc(sizeof(IrBlock));
+
+    block->id = fn->next_block++;
+    block->insts = Arraylist_new(IrInst_free);
+    block->preds = Arraylist_new(Arraylist_no_free);
+    block->sealed = false;
+    block->defs = Hashmap_new(Arraylist_no_free);
+    block->incomplete = Arraylist_new(Arraylist_no_free);
+    block->incomplete_names = Arraylist_new(free);
+
+    Arraylist_add(fn->blocks, block);
+    return block;
+}
+
+IrInst* IrInst_new(IrFunction* fn, IrOpcode opcode, Type type)
+{
+    IrInst* inst = malloc(sizeof(IrInst));
+
+    inst->opcode = opcode;
+    inst->id = IR_IS_TERMINATOR(opcode) || opcode == IR_Copy ? -1 : fn->next_value++;
+    inst->type = type;
+    inst->op = Add_t;
+    inst->operand_type = Void_t;
+    inst->text = NULL;
+    inst->index = 0;
+    inst->operands = Arraylist_new_with_size(Arraylist_no_free, 2);
+    inst->targets[0] = NULL;
+    inst->targets[1] = NULL;
+    inst->block = NULL;
+    inst->replacement = NULL;
+
+    return inst;
+}
+
+void IrBlock_append(IrBlock* block, IrInst* inst)
+{
+    inst->block = block;
+    Arraylist_add(block->insts, inst);
+}
+
+IrInst* IrBlock_terminator(IrBlock* block)
+{
+    IrInst* last = Arraylist_get(block->insts, Arraylist_size(block->insts)-1);
+
+    if (last != NULL && IR_IS_TERMINATOR(last->opcode))
+        return last;
+    return NULL;
+}
+
+void IrBlock_add_pred(IrBlock* block, IrBlock* pred)
+{
+    Arraylist_add(block->preds, pred);
+}
+
+IrInst* IrInst_resolve(IrInst* inst)
+{
+    while (inst != NULL && inst->replacement != NULL)
+        inst = inst->replacement;
+    return inst;
+}
+
+IrInst* IrInst_operand(IrInst* inst, int index)
+{
+    return IrInst_resolve(Arraylist_get(inst->operands, index));
+}
+
+void ir_dump_value(StringBuilder* sb, IrInst* inst)
+{
+    StringBuilder_add(sb, '%');
+    StringBuilder_add_arr(sb, String_from_int(IrInst_resolve(inst)->id));
+}
+
+void ir_dump_block_name(StringBuilder* sb, IrBlock* block)
+{
+    StringBuilder_add(sb, 'B');
+    StringBuilder_add_arr(sb, String_from_int(block->id));
+}
+
+void ir_dump_operands(StringBuilder* sb, IrInst* inst, int from)
+{
+    for (int i = from; i < Arraylist_size(inst->operands); i++) {
+        StringBuilder_add_arr(sb, i > from ? ", " : " ");
+        ir_dump_value(sb, Arraylist_get(inst->operands, i));
+    }
+}
+
+void ir_dump_inst(StringBuilder* sb, IrInst* inst)
+{
+    StringBuilder_add_arr(sb, "    ");
+
+    if (inst->id >= 0) {
+        ir_dump_value(sb, inst);
+        StringBuilder_add_arr(sb, " = ");
+    }
+
+    switch (inst->opcode) {
+    case IR_Const:
+        StringBuilder_add_arr(sb, "const ");
+        StringBuilder_add_arr(sb, ir_type_names[inst->type]);
+        StringBuilder_add_arr(sb, inst->type == Char_t ? " \"" : " ");
+        StringBuilder_add_arr(sb, inst->text);
+        if (inst->type == Char_t)
+            StringBuilder_add(sb, '"');
+        break;
+    case IR_Param:
+        StringBuilder_add_arr(sb, "param ");
+        StringBuilder_add_arr(sb, String_from_int(inst->index));
+        break;
+    case IR_Undef:
+        StringBuilder_add_arr(sb, "undef ");
+        StringBuilder_add_arr(sb, ir_type_names[inst->type]);
+        break;
+    case IR_Binary:
+    case IR_Unary:
+        StringBuilder_add_arr(sb, ir_op_names[inst->op]);
+        ir_dump_operands(sb, inst, 0);
+        break;
+    case IR_Call:
+        StringBuilder_add_arr(sb, "call ");
+        StringBuilder_add_arr(sb, inst->text);
+        ir_dump_operands(sb, inst, 0);
+        break;
+    case IR_Phi:
+        StringBuilder_add_arr(sb, "phi");
+        for (int i = 0; i < Arraylist_size(inst->operands); i++) {
+            StringBuilder_add_arr(sb, i ? ", [" : " [");
+            ir_dump_value(sb, Arraylist_get(inst->operands, i));
+            StringBuilder_add_arr(sb, ", ");
+            ir_dump_block_name(sb, Arraylist_get(inst->block->preds, i));
+            StringBuilder_add(sb, ']');
+        }
+        break;
+    case IR_Copy:
+        StringBuilder_add_arr(sb, "copy ");
+        StringBuilder_add_arr(sb, String_from_int(inst->index));
+        ir_dump_operands(sb, inst, 0);
+        break;
+    case IR_Jump:
+        StringBuilder_add_arr(sb, "jmp ");
+        ir_dump_block_name(sb, inst->targets[0]);
+        break;
+    case IR_Branch:
+        StringBuilder_add_arr(sb, "br");
+        ir_dump_operands(sb, inst, 0);
+        StringBuilder_add_arr(sb, ", ");
+        ir_dump_block_name(sb, inst->targets[0]);
+        StringBuilder_add_arr(sb, ", ");
+        ir_dump_block_name(sb, inst->targets[1]);
+        break;
+    case IR_Return:
+        StringBuilder_add_arr(sb, "ret");
+        ir_dump_operands(sb, inst, 0);
+        break;
+    }
+
+    StringBuilder_add(sb, '\n');
+}
+
+void IrFunction_dump(IrFunction* fn, StringBuilder* sb)
+{
+    StringBuilder_add_arr(sb, "function ");
+    StringBuilder_add_arr(sb, fn->name);
+    StringBuilder_add(sb, '(');
+    for (int i = 0; i < Arraylist_size(fn->params); i++) {
+        IrInst* param = Arraylist_get(fn->params, i);
+        if (i)
+            StringBuilder_add_arr(sb, ", ");
+        ir_dump_value(sb, param);
+        StringBuilder_add_arr(sb, " : ");
+        StringBuilder_add_arr(sb, ir_type_names[param->type]);
+    }
+    StringBuilder_add_arr(sb, ") : ");
+    StringBuilder_add_arr(sb, ir_type_names[fn->return_type]);
+    StringBuilder_add(sb, '\n');
+
+    for (int b = 0; b < Arraylist_size(fn->blocks); b++) {
+        IrBlock* block = Arraylist_get(fn->blocks, b);
+
+        ir_dump_block_name(sb, block);
+        StringBuilder_add(sb, ':');
+        for (int i = 0; i < Arraylist_size(block->preds); i++) {
+            StringBuilder_add_arr(sb, i ? ", " : " ; preds ");
+            ir_dump_block_name(sb, Arraylist_get(block->preds, i));
+        }
+        StringBuilder_add(sb, '\n');
+
+        for (int i = 0; i < Arraylist_size(block->insts); i++)
+            ir_dump_inst(sb, Arraylist_get(block->insts, i));
+    }
+}
+
+void ir_error(StringBuilder* errors, int* count, IrFunction* fn, IrBlock* block, char* msg)
+{
+    (*count)++;
+    if (errors == NULL)
+        return;
+
+    StringBuilder_add_arr(errors, fn->name);
+    StringBuilder_add_arr(errors, ": B");
+    StringBuilder_add_arr(errors, String_from_int(block->id));
+    StringBuilder_add_arr(errors, ": ");
+    StringBuilder_add_arr(errors, msg);
+    StringBuilder_add(errors, '\n');
+}
+
+int ir_block_index(IrFunction* fn, IrBlock* block)
+{
+    for (int i = 0; i < Arraylist_size(fn->blocks); i++)
+        if (Arraylist_get(fn->blocks, i) == block)
+            return i;
+    return -1;
+}
+
+// dom[b * n + d] is true when block d dominates block b
+bool* ir_dominators(IrFunction* fn)
+{
+    int n = Arraylist_size(fn->blocks);
+    bool* dom = malloc(sizeof(bool) * n * n);
+    bool changed = true;
+
+    for (int b = 0; b < n; b++)
+        for (int d = 0; d < n; d++)
+            dom[b*n + d] = b == 0 ? d == 0 : true;
+
+    while (changed) {
+        changed = false;
+        for (int b = 1; b < n; b++) {
+            IrBlock* block = Arraylist_get(fn->blocks, b);
+
+            for (int d = 0; d < n; d++) {
+                bool value = Arraylist_size(block->preds) > 0;
+                for (int p = 0; p < Arraylist_size(block->preds) && value; p++) {
+                    int pred = ir_block_index(fn, Arraylist_get(block->preds, p));
+                    value = pred >= 0 && dom[pred*n + d];
+                }
+                value = value || d == b;
+
+                if (dom[b*n + d] != value) {
+                    dom[b*n + d] = value;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    return dom;
+}
+
+// Whether def is available at position index of block
+bool ir_available(IrFunction* fn, bool* dom, IrInst* def, IrBlock* block, int index)
+{
+    int n = Arraylist_size(fn->blocks);
+    int def_block = ir_block_index(fn, def->block);
+    int use_block = ir_block_index(fn, block);
+
+    if (def_block < 0 || use_block < 0)
+        return false;
+
+    if (def_block == use_block) {
+        for (int i = 0; i < index; i++)
+            if (Arraylist_get(block->insts, i) == def)
+                return true;
+        return false;
+    }
+
+    return dom[use_block*n + def_block];
+}
+
+// Checks the structural SSA invariants, returns the number of errors and
+// describes them in errors when it is not NULL
+int IrFunction_verify(IrFunction* fn, StringBuilder* errors)
+{
+    int count = 0;
+    bool* dom = ir_dominators(fn);
+
+    for (int b = 0; b < Arraylist_size(fn->blocks); b++) {
+        IrBlock* block = Arraylist_get(fn->blocks, b);
+        int size = Arraylist_size(block->insts);
+        bool phis_done = false;
+
+        if (size == 0 || IrBlock_terminator(block) == NULL)
+            ir_error(errors, &count, fn, block, "block does not end with a terminator");
+
+        if (b > 0 && Arraylist_size(block->preds) == 0)
+            ir_error(errors, &count, fn, block, "unreachable block");
+
+        for (int i = 0; i < size; i++) {
+            IrInst* inst = Arraylist_get(block->insts, i);
+
+            if (inst->block != block)
+                ir_error(errors, &count, fn, block, "instruction owned by another block");
+
+            if (inst->replacement != NULL)
+                ir_error(errors, &count, fn, block, "removed phi still in block");
+
+            if (IR_IS_TERMINATOR(inst->opcode) && i != size-1)
+                ir_error(errors, &count, fn, block, "terminator in the middle of a block");
+
+            if (inst->opcode == IR_Phi) {
+                if (phis_done)
+                    ir_error(errors, &count, fn, block, "phi after a non phi instruction");
+                if (Arraylist_size(inst->operands) != Arraylist_size(block->preds))
+                    ir_error(errors, &count, fn, block, "phi operand count does not match predecessors");
+            }
+            else {
+                phis_done = true;
+            }
+
+            for (int o = 0; o < Arraylist_size(inst->operands); o++) {
+                IrInst* operand = IrInst_operand(inst, o);
+
+                if (operand == NULL || operand->id < 0) {
+                    ir_error(errors, &count, fn, block, "operand without a value");
+                    continue;
+                }
+
+                if (inst->opcode == IR_Phi) {
+                    IrBlock* pred = Arraylist_get(block->preds, o);
+                    if (pred != NULL && !ir_available(fn, dom, operand, pred, Arraylist_size(pred->insts)))
+                        ir_error(errors, &count, fn, block, "phi operand does not dominate its predecessor");
+                }
+                else if (!ir_available(fn, dom, operand, block, i)) {
+                    ir_error(errors, &count, fn, block, "use not dominated by its definition");
+                }
+            }
+
+            for (int t = 0; t < 2; t++) {
+                IrBlock* target = inst->targets[t];
+                bool found = false;
+
+                if (target == NULL)
+                    continue;
+
+                for (int p = 0; p < Arraylist_size(target->preds); p++)
+                    found = found || Arraylist_get(target->preds, p) == block;
+
+                if (!found)
+                    ir_error(errors, &count, fn, block, "branch target does not list the block as a predecessor");
+            }
+        }
+    }
+
+    free(dom);
+    return count;
+}
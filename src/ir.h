@@ -0,0 +1,98 @@
+#ifndef IR_H
+#define IR_H
+
+#include "arraylist.h"
+#include "hashmap.h"
+#include "stringbuilder.h"
+#include "tree.h"
+#include "type.h"
+
+#include <stdbool.h>
+
+enum ir_opcode
+{
+    IR_Const,
+    IR_Param,
+    IR_Undef,
+    IR_Binary,
+    IR_Unary,
+    IR_Call,
+    IR_Phi,
+    IR_Copy,
+    IR_Jump,
+    IR_Branch,
+    IR_Return
+};
+
+typedef enum ir_opcode IrOpcode;
+
+#define IR_IS_TERMINATOR(opcode) \
+(opcode >= IR_Jump)
+
+struct ir_block;
+
+struct ir_inst
+{
+    IrOpcode opcode;
+    // Value number, -1 for instructions without a result
+    int id;
+    Type type;
+    OpType op;
+    // Operand type of a binary operation proven by the type checker, Void_t if unknown
+    Type operand_type;
+    // Literal text or callee name
+    char* text;
+    // Parameter index, or for a copy the id of the value whose slot it writes
+    int index;
+    // IrInst* operands, phis have one per predecessor of their block
+    Arraylist* operands;
+    struct ir_block* targets[2];
+    struct ir_block* block;
+    // Set when a trivial phi is removed, uses are forwarded to it
+    struct ir_inst* replacement;
+};
+
+typedef struct ir_inst IrInst;
+
+struct ir_block
+{
+    int id;
+    Arraylist* insts;
+    Arraylist* preds;
+    bool sealed;
+    // Current SSA value of every variable written in the block
+    Hashmap* defs;
+    // Phis created before the block was sealed and the variable they stand for
+    Arraylist* incomplete;
+    Arraylist* incomplete_names;
+};
+
+typedef struct ir_block IrBlock;
+
+struct ir_function
+{
+    char* name;
+    Type return_type;
+    Arraylist* params;
+    Arraylist* blocks;
+    int next_value;
+    int next_block;
+};
+
+typedef struct ir_function IrFunction;
+
+IrFunction* IrFunction_new(char* name, Type return_type);
+void IrFunction_free(IrFunction* fn);
+IrBlock* IrBlock_new(IrFunction* fn);
+void IrInst_free(void* ptr);
+IrInst* IrInst_new(IrFunction* fn, IrOpcode opcode, Type type);
+void IrBlock_append(IrBlock* block, IrInst* inst);
+IrInst* IrBlock_terminator(IrBlock* block);
+void IrBlock_add_pred(IrBlock* block, IrBlock* pred);
+IrInst* IrInst_resolve(IrInst* inst);
+IrInst* IrInst_operand(IrInst* inst, int index);
+
+void IrFunction_dump(IrFunction* fn, StringBuilder* sb);
+int IrFunction_verify(IrFunction* fn, StringBuilder* errors);
+
+#endif
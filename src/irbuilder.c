@@ -0,0 +1,553 @@
+#include "irbuilder.h"
+#include "ir.h"
+#include "ast.h"
+#include "tree.h"
+#include "type.h"
+#include "hashmap.h"
+#include "arraylist.h"
+#include "stringbuilder.h"
+#include "panic.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define ALLOC_SUBSYSTEM CodegenAlloc
+#include "alloc.h"
+
+struct ir_builder
+{
+    IrFunction* fn;
+    // NULL after a return until the next join
+    IrBlock* current;
+    Hashmap* types;
+    // IrInst* of every parameter by name
+    Hashmap* params;
+};
+
+typedef struct ir_builder IrBuilder;
+
+IrInst* ir_read_variable(IrBuilder* b, IrBlock* block, char* name);
+
+// Removes an element without handing it to the list's free function
+void ir_unlink(Arraylist* list, int position)
+{
+    free_ptr_t free_ptr = list->free_ptr;
+    list->free_ptr = Arraylist_no_free;
+    Arraylist_remove(list, position);
+    list->free_ptr = free_ptr;
+}
+
+Type ir_declared_type(IrBuilder* b, char* name)
+{
+    Type* type = Hashmap_get(b->types, name);
+    return type ? *type : I64_t;
+}
+
+void ir_declare(IrBuilder* b, char* name, Type type)
+{
+    Type* t = malloc(sizeof(Type));
+    *t = type;
+    Hashmap_insert_or_set(b->types, name, t);
+}
+
+void ir_write_variable(IrBlock* block, char* name, IrInst* value)
+{
+    Hashmap_insert_or_set(block->defs, name, value);
+}
+
+// Index after the phis at the top of the block
+int ir_phi_end(IrBlock* block)
+{
+    int i = 0;
+    while (i < Arraylist_size(block->insts) && ((IrInst*)Arraylist_get(block->insts, i))->opcode == IR_Phi)
+        i++;
+    return i;
+}
+
+IrInst* ir_insert(IrBlock* block, IrInst* inst, int index)
+{
+    inst->block = block;
+    Arraylist_insert(block->insts, inst, index);
+    return inst;
+}
+
+IrInst* ir_undef(IrBuilder* b, IrBlock* block, Type type)
+{
+    return ir_insert(block, IrInst_new(b->fn, IR_Undef, type), ir_phi_end(block));
+}
+
+IrInst* ir_new_phi(IrBuilder* b, IrBlock* block, char* name)
+{
+    return ir_insert(block, IrInst_new(b->fn, IR_Phi, ir_declared_type(b, name)), 0);
+}
+
+// A phi whose operands are all the same value (or itself) is that value
+IrInst* ir_try_remove_trivial_phi(IrBuilder* b, IrInst* phi)
+{
+    IrInst* same = NULL;
+
+    for (int i = 0; i < Arraylist_size(phi->operands); i++) {
+        IrInst* operand = IrInst_operand(phi, i);
+        if (operand == same || operand == phi)
+            continue;
+        if (same != NULL)
+            return phi;
+        same = operand;
+    }
+
+    if (same == NULL)
+        same = ir_undef(b, phi->block, phi->type);
+
+    phi->replacement = same;
+    return same;
+}
+
+IrInst* ir_add_phi_operands(IrBuilder* b, char* name, IrInst* phi)
+{
+    for (int i = 0; i < Arraylist_size(phi->block->preds); i++)
+        Arraylist_add(phi->operands, ir_read_variable(b, Arraylist_get(phi->block->preds, i), name));
+
+    return ir_try_remove_trivial_phi(b, phi);
+}
+
+IrInst* ir_read_variable_recursive(IrBuilder* b, IrBlock* block, char* name)
+{
+    IrInst* value;
+
+    if (!block->sealed) {
+        // More predecessors may still be added, finish the phi when sealing
+        value = ir_new_phi(b, block, name);
+        Arraylist_add(block->incomplete, value);
+        Arraylist_add(block->incomplete_names, String_from(name));
+    }
+    else if (Arraylist_size(block->preds) == 1) {
+        value = ir_read_variable(b, Arraylist_get(block->preds, 0), name);
+    }
+    else if (Arraylist_size(block->preds) == 0) {
+        value = ir_undef(b, block, ir_declared_type(b, name));
+    }
+    else {
+        // Written first to break cycles through loops
+        value = ir_new_phi(b, block, name);
+        ir_write_variable(block, name, value);
+        value = ir_add_phi_operands(b, name, value);
+    }
+
+    ir_write_variable(block, name, value);
+    return value;
+}
+
+IrInst* ir_read_variable(IrBuilder* b, IrBlock* block, char* name)
+{
+    IrInst* value = Hashmap_get(block->defs, name);
+
+    if (value != NULL)
+        return IrInst_resolve(value);
+    return ir_read_variable_recursive(b, block, name);
+}
+
+void ir_seal(IrBuilder* b, IrBlock* block)
+{
+    for (int i = 0; i < Arraylist_size(block->incomplete); i++)
+        ir_add_phi_operands(b, Arraylist_get(block->incomplete_names, i), Arraylist_get(block->incomplete, i));
+
+    block->sealed = true;
+}
+
+IrBlock* ir_current(IrBuilder* b)
+{
+    // Code after a return is unreachable, give it a block without predecessors
+    if (b->current == NULL) {
+        b->current = IrBlock_new(b->fn);
+        b->current->sealed = true;
+    }
+    return b->current;
+}
+
+IrInst* ir_emit(IrBuilder* b, IrInst* inst)
+{
+    IrBlock_append(ir_current(b), inst);
+    return inst;
+}
+
+void ir_jump(IrBuilder* b, IrBlock* target)
+{
+    IrInst* inst = ir_emit(b, IrInst_new(b->fn, IR_Jump, Void_t));
+    inst->targets[0] = target;
+    IrBlock_add_pred(target, b->current);
+    b->current = NULL;
+}
+
+void ir_branch(IrBuilder* b, IrInst* cond, IrBlock* if_true, IrBlock* if_false)
+{
+    IrInst* inst = ir_emit(b, IrInst_new(b->fn, IR_Branch, Void_t));
+    Arraylist_add(inst->operands, cond);
+    inst->targets[0] = if_true;
+    inst->targets[1] = if_false;
+    IrBlock_add_pred(if_true, b->current);
+    IrBlock_add_pred(if_false, b->current);
+    b->current = NULL;
+}
+
+IrInst* ir_const(IrBuilder* b, LiteralNode* ln)
+{
+    IrInst* inst = ir_emit(b, IrInst_new(b->fn, IR_Const, ln->type));
+    inst->text = LiteralNode_text(ln);
+    return inst;
+}
+
+IrInst* ir_operand(IrBuilder* b, GenericNode* gn)
+{
+    if (gn->type == LiteralNode_t)
+        return ir_const(b, (LiteralNode*)gn->node);
+    return ir_read_variable(b, ir_current(b), ((VariableNode*)gn->node)->name);
+}
+
+IrInst* ir_call(IrBuilder* b, CallNode* cn, Type type)
+{
+    IrInst* inst = IrInst_new(b->fn, IR_Call, type);
+    inst->text = String_from(cn->name);
+
+    for (int i = 0; i < Arraylist_size(cn->args); i++)
+        Arraylist_add(inst->operands, ir_operand(b, Arraylist_get(cn->args, i)));
+
+    return ir_emit(b, inst);
+}
+
+// New value holding what src holds when the copy runs
+IrInst* ir_value_copy(IrBuilder* b, IrInst* src, Type type)
+{
+    IrInst* copy = IrInst_new(b->fn, IR_Copy, type);
+    copy->id = b->fn->next_value++;
+    copy->index = copy->id;
+    Arraylist_add(copy->operands, src);
+    return ir_emit(b, copy);
+}
+
+// type is the declared type of the variable receiving the value
+IrInst* ir_expression(IrBuilder* b, ExpressionNode* en, Type type)
+{
+    int size = Arraylist_size(en->nodes);
+    IrInst** stack = malloc(sizeof(IrInst*) * (size+1));
+    int top = 0;
+
+    for (int i = 0; i < size; i++) {
+        GenericNode* gn = Arraylist_get(en->nodes, i);
+        IrInst* inst;
+        OpType op;
+
+        switch (gn->type) {
+        case OperatorNode_t:
+            op = ((OperatorNode*)gn->node)->op_t;
+            if (op == Not_t) {
+                inst = IrInst_new(b->fn, IR_Unary, I32_t);
+                Arraylist_add(inst->operands, stack[--top]);
+            }
+            else {
+                inst = IrInst_new(b->fn, IR_Binary, I32_t);
+                IrInst* right = stack[--top];
+                IrInst* left = stack[--top];
+                Arraylist_add(inst->operands, left);
+                Arraylist_add(inst->operands, right);
+                if (op <= Mod_t || op >= Shl_t)
+                    inst->type = left->type;
+                inst->operand_type = ((OperatorNode*)gn->node)->type;
+            }
+            inst->op = op;
+            stack[top++] = ir_emit(b, inst);
+            break;
+        case CallNode_t:
+            stack[top++] = ir_call(b, (CallNode*)gn->node, type);
+            break;
+        default:
+            stack[top++] = ir_operand(b, gn);
+            break;
+        }
+    }
+
+    IrInst* result = top ? stack[top-1] : ir_undef(b, ir_current(b), type);
+    free(stack);
+    return result;
+}
+
+void ir_statements(IrBuilder* b, Arraylist* statements);
+
+void ir_if(IrBuilder* b, IfNode* in, ElseNode* en)
+{
+    IrInst* cond = ir_expression(b, in->condition, I32_t);
+    IrBlock* then_block = IrBlock_new(b->fn);
+    IrBlock* else_block = en ? IrBlock_new(b->fn) : NULL;
+    IrBlock* join = IrBlock_new(b->fn);
+
+    ir_branch(b, cond, then_block, en ? else_block : join);
+
+    ir_seal(b, then_block);
+    b->current = then_block;
+    ir_statements(b, in->statements);
+    if (b->current)
+        ir_jump(b, join);
+
+    if (en) {
+        ir_seal(b, else_block);
+        b->current = else_block;
+        ir_statements(b, en->statements);
+        if (b->current)
+            ir_jump(b, join);
+    }
+
+    ir_seal(b, join);
+    b->current = join;
+}
+
+void ir_while(IrBuilder* b, WhileNode* wn)
+{
+    IrBlock* header = IrBlock_new(b->fn);
+    ir_jump(b, header);
+
+    // The back edge is not known yet, so the header stays unsealed
+    b->current = header;
+    IrInst* cond = ir_expression(b, wn->condition, I32_t);
+    IrBlock* body = IrBlock_new(b->fn);
+    IrBlock* exit = IrBlock_new(b->fn);
+    ir_branch(b, cond, body, exit);
+
+    ir_seal(b, body);
+    b->current = body;
+    ir_statements(b, wn->statements);
+    if (b->current)
+        ir_jump(b, header);
+
+    ir_seal(b, header);
+    ir_seal(b, exit);
+    b->current = exit;
+}
+
+// Calls get the slots of their arguments and write to them, so the caller
+// sees what the callee assigned to its parameters. The slot of a value is
+// then the variable it was last assigned to: a variable copied from another
+// gets a value of its own, and assigning a parameter copies the value into
+// the parameter's slot
+void ir_assign(IrBuilder* b, AssignmentNode* an, IrInst* inst)
+{
+    GenericNode* first = Arraylist_get(an->right->nodes, 0);
+    if (Arraylist_size(an->right->nodes) == 1 && first->type == VariableNode_t)
+        inst = ir_value_copy(b, inst, ir_declared_type(b, an->left));
+
+    IrInst* param = Hashmap_get(b->params, an->left);
+    if (param != NULL) {
+        IrInst* store = IrInst_new(b->fn, IR_Copy, param->type);
+        store->index = param->id;
+        Arraylist_add(store->operands, inst);
+        ir_emit(b, store);
+        inst = param;
+    }
+
+    ir_write_variable(ir_current(b), an->left, inst);
+}
+
+void ir_statements(IrBuilder* b, Arraylist* statements)
+{
+    for (int i = 0; i < Arraylist_size(statements); i++) {
+        GenericNode* gn = Arraylist_get(statements, i);
+        GenericNode* next = Arraylist_get(statements, i+1);
+        DeclarationNode* dn;
+        AssignmentNode* an;
+        IrInst* inst;
+
+        switch (gn->type) {
+        case DeclarationNode_t:
+            dn = (DeclarationNode*)gn->node;
+            // Reads before the first assignment find no definition and become undef
+            ir_declare(b, dn->name, dn->type);
+            break;
+        case AssignmentNode_t:
+            an = (AssignmentNode*)gn->node;
+            inst = ir_expression(b, an->right, ir_declared_type(b, an->left));
+            ir_assign(b, an, inst);
+            break;
+        case CallNode_t:
+            ir_call(b, (CallNode*)gn->node, I64_t);
+            break;
+        case IfNode_t:
+            if (next != NULL && next->type == ElseNode_t) {
+                ir_if(b, (IfNode*)gn->node, (ElseNode*)next->node);
+                i++;
+            }
+            else {
+                ir_if(b, (IfNode*)gn->node, NULL);
+            }
+            break;
+        case WhileNode_t:
+            ir_while(b, (WhileNode*)gn->node);
+            break;
+        case ReturnNode_t:
+            inst = IrInst_new(b->fn, IR_Return, Void_t);
+            Arraylist_add(inst->operands, ir_read_variable(b, ir_current(b), ((ReturnNode*)gn->node)->name));
+            ir_emit(b, inst);
+            b->current = NULL;
+            break;
+        default:
+            panic("Invalid node: %i, report bug: https://github.com/alexburroughs/BC-2/issues", (int)gn->type);
+            break;
+        }
+    }
+}
+
+void ir_mark_reachable(IrBlock* block, Hashmap* seen, Arraylist* postorder)
+{
+    char* key = String_from_int(block->id);
+
+    if (Hashmap_get(seen, key) == NULL) {
+        Hashmap_insert(seen, key, block);
+
+        IrInst* term = IrBlock_terminator(block);
+        for (int t = 1; term != NULL && t >= 0; t--)
+            if (term->targets[t] != NULL)
+                ir_mark_reachable(term->targets[t], seen, postorder);
+
+        Arraylist_add(postorder, block);
+    }
+    free(key);
+}
+
+// Forwards removed phis, drops unreachable blocks and lays the rest out in
+// reverse postorder
+void ir_finish(IrFunction* fn)
+{
+    Hashmap* seen = Hashmap_new(Arraylist_no_free);
+    Arraylist* postorder = Arraylist_new(Arraylist_no_free);
+    Arraylist* removed = Arraylist_new(Arraylist_no_free);
+
+    ir_mark_reachable(Arraylist_get(fn->blocks, 0), seen, postorder);
+
+    for (int b = 0; b < Arraylist_size(fn->blocks); b++) {
+        IrBlock* block = Arraylist_get(fn->blocks, b);
+        char* key = String_from_int(block->id);
+        bool reachable = Hashmap_get(seen, key) != NULL;
+        free(key);
+
+        if (reachable)
+            continue;
+
+        // Edges out of dead code disappear together with their phi operands
+        IrInst* term = IrBlock_terminator(block);
+        for (int t = 0; term != NULL && t < 2; t++) {
+            IrBlock* target = term->targets[t];
+            if (target == NULL)
+                continue;
+
+            for (int p = Arraylist_size(target->preds)-1; p >= 0; p--) {
+                if (Arraylist_get(target->preds, p) != block)
+                    continue;
+
+                Arraylist_remove(target->preds, p);
+                for (int i = 0; i < Arraylist_size(target->insts); i++) {
+                    IrInst* phi = Arraylist_get(target->insts, i);
+                    if (phi->opcode == IR_Phi && Arraylist_size(phi->operands) > p)
+                        Arraylist_remove(phi->operands, p);
+                }
+            }
+        }
+    }
+
+    for (int b = 0; b < Arraylist_size(fn->blocks); b++) {
+        IrBlock* block = Arraylist_get(fn->blocks, b);
+
+        for (int i = 0; i < Arraylist_size(block->insts); i++) {
+            IrInst* inst = Arraylist_get(block->insts, i);
+            for (int o = 0; o < Arraylist_size(inst->operands); o++)
+                Arraylist_set(inst->operands, IrInst_operand(inst, o), o);
+        }
+    }
+
+    for (int b = 0; b < Arraylist_size(fn->blocks); b++) {
+        IrBlock* block = Arraylist_get(fn->blocks, b);
+
+        for (int i = Arraylist_size(block->insts)-1; i >= 0; i--) {
+            IrInst* inst = Arraylist_get(block->insts, i);
+            if (inst->replacement == NULL)
+                continue;
+
+            // Other removed phis may still forward through this one
+            Arraylist_add(removed, inst);
+            ir_unlink(block->insts, i);
+        }
+    }
+
+    // Rebuild the block list in reverse postorder, freeing dead blocks
+    Arraylist* blocks = fn->blocks;
+    fn->blocks = Arraylist_new(blocks->free_ptr);
+    for (int b = Arraylist_size(postorder)-1; b >= 0; b--) {
+        IrBlock* block = Arraylist_get(postorder, b);
+        block->id = Arraylist_size(fn->blocks);
+        Arraylist_add(fn->blocks, block);
+    }
+    for (int b = 0; b < Arraylist_size(blocks); b++) {
+        for (int i = 0; i < Arraylist_size(fn->blocks); i++)
+            if (Arraylist_get(blocks, b) == Arraylist_get(fn->blocks, i))
+                blocks->arr[b] = NULL;
+    }
+    Arraylist_free(blocks);
+    fn->next_block = Arraylist_size(fn->blocks);
+
+    for (int i = 0; i < Arraylist_size(removed); i++) {
+        IrInst_free(Arraylist_get(removed, i));
+    }
+
+    Arraylist_free(removed);
+    Arraylist_free(postorder);
+    Hashmap_free(seen);
+}
+
+IrFunction* IrFunction_from(FunctionNode* fn)
+{
+    IrBuilder b;
+    b.fn = IrFunction_new(fn->name, fn->return_type);
+    b.types = Hashmap_new(free);
+    b.params = Hashmap_new(Arraylist_no_free);
+    b.current = IrBlock_new(b.fn);
+    b.current->sealed = true;
+
+    for (int i = 0; i < Arraylist_size(fn->args); i++) {
+        VariableNode* arg = Arraylist_get(fn->args, i);
+        IrInst* param = ir_emit(&b, IrInst_new(b.fn, IR_Param, arg->type));
+        param->index = i;
+        Arraylist_add(b.fn->params, param);
+        ir_declare(&b, arg->name, arg->type);
+        Hashmap_insert_or_set(b.params, arg->name, param);
+        ir_write_variable(b.current, arg->name, param);
+    }
+
+    ir_statements(&b, fn->statements);
+
+    if (b.current != NULL)
+        ir_emit(&b, IrInst_new(b.fn, IR_Return, Void_t));
+
+    ir_finish(b.fn);
+    Hashmap_free(b.types);
+    Hashmap_free(b.params);
+
+    return b.fn;
+}
+
+char* AST_dump_ir(AST* ast)
+{
+    StringBuilder* sb = StringBuilder_new();
+
+    for (Hashmap_Node* iter = Hashmap_get_iter(ast->functions); iter != NULL; iter = Hashmap_iter_next(iter)) {
+        GenericNode* gn = iter->val;
+        if (gn->type != FunctionNode_t)
+            continue;
+
+        IrFunction* ir = IrFunction_from((FunctionNode*)gn->node);
+        IrFunction_dump(ir, sb);
+        if (IrFunction_verify(ir, sb) != 0)
+            StringBuilder_add_arr(sb, "; verification failed\n");
+        StringBuilder_add(sb, '\n');
+        IrFunction_free(ir);
+    }
+
+    char* dump = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+    return dump;
+}
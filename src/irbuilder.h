@@ -0,0 +1,12 @@
+#ifndef IRBUILDER_H
+#define IRBUILDER_H
+
+#include "ast.h"
+#include "ir.h"
+
+// Builds pruned-as-you-go SSA for a function: variables are tracked per
+// block and phis are only placed where definitions meet at if/else/while joins
+IrFunction* IrFunction_from(FunctionNode* fn);
+char* AST_dump_ir(AST* ast);
+
+#endif
@@ -0,0 +1,374 @@
+#include "irlower.h"
+#include "ir.h"
+#include "nonamegenerator.h"
+#include "arraylist.h"
+#include "stringbuilder.h"
+#include "type.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define ALLOC_SUBSYSTEM CodegenAlloc
+#include "alloc.h"
+
+struct ir_lowering
+{
+    IrFunction* fn;
+    StringBuilder* code_sb;
+    GenOptions* options;
+    // Indexed by value id
+    int* slots;
+    Type* types;
+    bool* used;
+    int ret_slot;
+    int label_base;
+};
+
+typedef struct ir_lowering IrLowering;
+
+IrInst* ir_copy(IrFunction* fn, int dst, IrInst* src)
+{
+    IrInst* copy = IrInst_new(fn, IR_Copy, src->type);
+    copy->index = dst;
+    Arraylist_add(copy->operands, src);
+    return copy;
+}
+
+IrInst* ir_before_terminator(IrBlock* block, IrInst* inst)
+{
+    inst->block = block;
+    Arraylist_insert(block->insts, inst, Arraylist_size(block->insts)-1);
+    return inst;
+}
+
+bool ir_has_phis(IrBlock* block)
+{
+    IrInst* first = Arraylist_get(block->insts, 0);
+    return first != NULL && first->opcode == IR_Phi;
+}
+
+// An edge from a block with several successors to a block with several
+// predecessors has nowhere to put the phi copies, give it its own block
+void ir_split_critical_edges(IrFunction* fn)
+{
+    int count = Arraylist_size(fn->blocks);
+
+    for (int b = 0; b < count; b++) {
+        IrBlock* block = Arraylist_get(fn->blocks, b);
+        if (Arraylist_size(block->preds) < 2 || !ir_has_phis(block))
+            continue;
+
+        for (int p = 0; p < Arraylist_size(block->preds); p++) {
+            IrBlock* pred = Arraylist_get(block->preds, p);
+            IrInst* term = IrBlock_terminator(pred);
+            if (term->opcode != IR_Branch)
+                continue;
+
+            IrBlock* edge = IrBlock_new(fn);
+            IrInst* jump = IrInst_new(fn, IR_Jump, Void_t);
+            jump->targets[0] = block;
+            IrBlock_append(edge, jump);
+            IrBlock_add_pred(edge, pred);
+
+            for (int t = 0; t < 2; t++)
+                if (term->targets[t] == block)
+                    term->targets[t] = edge;
+            Arraylist_set(block->preds, edge, p);
+        }
+    }
+}
+
+// Replaces the phis of every block by copies in its predecessors. The copies
+// on an edge are parallel, so when a phi reads another phi of the same block
+// every operand on that edge goes through a fresh temporary first
+void ir_eliminate_phis(IrFunction* fn)
+{
+    for (int b = 0; b < Arraylist_size(fn->blocks); b++) {
+        IrBlock* block = Arraylist_get(fn->blocks, b);
+        int phis = 0;
+
+        while (phis < Arraylist_size(block->insts) && ((IrInst*)Arraylist_get(block->insts, phis))->opcode == IR_Phi)
+            phis++;
+        if (phis == 0)
+            continue;
+
+        for (int p = 0; p < Arraylist_size(block->preds); p++) {
+            IrBlock* pred = Arraylist_get(block->preds, p);
+            IrInst** temps = malloc(sizeof(IrInst*) * phis);
+            bool through_temps = false;
+
+            for (int i = 0; i < phis; i++) {
+                IrInst* phi = Arraylist_get(block->insts, i);
+                IrInst* operand = Arraylist_get(phi->operands, p);
+                through_temps = through_temps || (operand != phi && operand->block == block && operand->opcode == IR_Phi);
+            }
+
+            for (int i = 0; i < phis; i++) {
+                IrInst* phi = Arraylist_get(block->insts, i);
+                IrInst* operand = Arraylist_get(phi->operands, p);
+                temps[i] = operand;
+
+                if (through_temps && operand != phi) {
+                    // A copy into a fresh value, read by the second round of copies
+                    IrInst* temp = ir_copy(fn, fn->next_value++, operand);
+                    temp->id = temp->index;
+                    temps[i] = ir_before_terminator(pred, temp);
+                }
+            }
+
+            for (int i = 0; i < phis; i++) {
+                IrInst* phi = Arraylist_get(block->insts, i);
+                if (temps[i] != phi)
+                    ir_before_terminator(pred, ir_copy(fn, phi->id, temps[i]));
+            }
+
+            free(temps);
+        }
+    }
+}
+
+void ir_collect_values(IrLowering* lw)
+{
+    IrFunction* fn = lw->fn;
+
+    lw->types = malloc(sizeof(Type) * fn->next_value);
+    lw->slots = malloc(sizeof(int) * fn->next_value);
+    lw->used = malloc(sizeof(bool) * fn->next_value);
+    for (int i = 0; i < fn->next_value; i++) {
+        lw->types[i] = Void_t;
+        lw->slots[i] = -1;
+        lw->used[i] = false;
+    }
+
+    for (int b = 0; b < Arraylist_size(fn->blocks); b++) {
+        IrBlock* block = Arraylist_get(fn->blocks, b);
+
+        for (int i = 0; i < Arraylist_size(block->insts); i++) {
+            IrInst* inst = Arraylist_get(block->insts, i);
+            for (int o = 0; o < Arraylist_size(inst->operands); o++)
+                lw->used[((IrInst*)Arraylist_get(inst->operands, o))->id] = true;
+        }
+    }
+
+    for (int b = 0; b < Arraylist_size(fn->blocks); b++) {
+        IrBlock* block = Arraylist_get(fn->blocks, b);
+
+        for (int i = 0; i < Arraylist_size(block->insts); i++) {
+            IrInst* inst = Arraylist_get(block->insts, i);
+
+            // Nothing reads an unused undef, so it needs no slot
+            if (inst->id >= 0 && (inst->opcode != IR_Undef || lw->used[inst->id]))
+                lw->types[inst->id] = inst->type;
+        }
+    }
+}
+
+// Parameters keep their argument slots and RET LABEL follows them, like the
+// AST generator. Every other value gets a fresh slot, grouped by slot kind
+void ir_assign_slots(IrLowering* lw)
+{
+    IrFunction* fn = lw->fn;
+    int tos = Arraylist_size(fn->params);
+
+    for (int i = 0; i < Arraylist_size(fn->params); i++)
+        lw->slots[((IrInst*)Arraylist_get(fn->params, i))->id] = i;
+
+    lw->ret_slot = -1;
+    if (fn->return_type != Void_t) {
+        lw->ret_slot = tos++;
+        parse_declaration_batch(fn->return_type, 1, lw->code_sb, lw->options);
+    }
+
+    for (Type group = I64_t; group <= Char_t; group++) {
+        int count = 0;
+
+        for (int i = 0; i < fn->next_value; i++) {
+            if (lw->slots[i] >= 0 || lw->types[i] == Void_t || declaration_group(lw->types[i], lw->options) != group)
+                continue;
+
+            lw->slots[i] = tos++;
+            count++;
+        }
+
+        parse_declaration_batch(group, count, lw->code_sb, lw->options);
+    }
+}
+
+int ir_slot(IrLowering* lw, IrInst* inst)
+{
+    return lw->slots[inst->id];
+}
+
+void ir_add_line(IrLowering* lw, char* instruction, int slot)
+{
+    StringBuilder_add_arr(lw->code_sb, instruction);
+    add_operand(lw->code_sb, slot);
+    StringBuilder_add_arr(lw->code_sb, "\n");
+}
+
+void ir_add_label(IrLowering* lw, char* instruction, IrBlock* block)
+{
+    StringBuilder_add_arr(lw->code_sb, instruction);
+    StringBuilder_add_arr(lw->code_sb, " CTR_L");
+    StringBuilder_add_arr(lw->code_sb, String_from_int(lw->label_base + block->id));
+    StringBuilder_add_arr(lw->code_sb, "\n");
+}
+
+void ir_lower_operation(IrLowering* lw, IrInst* inst)
+{
+    int count = Arraylist_size(inst->operands);
+    int dst = ir_slot(lw, inst);
+
+    // NOT only exists in stack form
+    if (lw->options->three_address && inst->opcode == IR_Binary) {
+        add_operator(lw->code_sb, inst->op, inst->operand_type, lw->options);
+        add_operand(lw->code_sb, inst->op == NotEqual_t ? STACK_OPERAND : dst);
+        for (int o = 0; o < count; o++)
+            add_operand(lw->code_sb, ir_slot(lw, Arraylist_get(inst->operands, o)));
+        StringBuilder_add_arr(lw->code_sb, "\n");
+    }
+    else {
+        for (int o = 0; o < count; o++)
+            ir_add_line(lw, "PUSH", ir_slot(lw, Arraylist_get(inst->operands, o)));
+        add_operator(lw->code_sb, inst->op, inst->operand_type, lw->options);
+        StringBuilder_add_arr(lw->code_sb, "\n");
+    }
+
+    if (inst->op == NotEqual_t)
+        StringBuilder_add_arr(lw->code_sb, "NOT\n");
+    if (!lw->options->three_address || inst->opcode != IR_Binary || inst->op == NotEqual_t)
+        ir_add_line(lw, "POP", dst);
+}
+
+void ir_lower_inst(IrLowering* lw, IrInst* inst, IrBlock* next)
+{
+    StringBuilder* code_sb = lw->code_sb;
+
+    switch (inst->opcode) {
+    case IR_Const:
+        StringBuilder_add_arr(code_sb, "SET");
+        add_operand(code_sb, ir_slot(lw, inst));
+        if (inst->type == Char_t) {
+            StringBuilder_add_arr(code_sb, " STR \"");
+            StringBuilder_add_arr(code_sb, inst->text);
+            StringBuilder_add_arr(code_sb, "\"\n");
+        }
+        else {
+            StringBuilder_add_arr(code_sb, " NUM ");
+            StringBuilder_add_arr(code_sb, inst->text);
+            StringBuilder_add_arr(code_sb, "\n");
+        }
+        break;
+    case IR_Param:
+    case IR_Undef:
+    case IR_Phi:
+        break;
+    case IR_Binary:
+    case IR_Unary:
+        ir_lower_operation(lw, inst);
+        break;
+    case IR_Call:
+        StringBuilder_add_arr(code_sb, "CALL ");
+        StringBuilder_add_arr(code_sb, inst->text);
+        for (int o = 0; o < Arraylist_size(inst->operands); o++)
+            add_operand(code_sb, ir_slot(lw, Arraylist_get(inst->operands, o)));
+        StringBuilder_add_arr(code_sb, "\n");
+        if (lw->used[inst->id]) {
+            StringBuilder_add_arr(code_sb, "SET");
+            add_operand(code_sb, ir_slot(lw, inst));
+            StringBuilder_add_arr(code_sb, " RET\n");
+        }
+        break;
+    case IR_Copy:
+        StringBuilder_add_arr(code_sb, "COPY");
+        add_operand(code_sb, lw->slots[inst->index]);
+        add_operand(code_sb, ir_slot(lw, Arraylist_get(inst->operands, 0)));
+        StringBuilder_add_arr(code_sb, "\n");
+        break;
+    case IR_Jump:
+        if (inst->targets[0] != next)
+            ir_add_label(lw, "JMP", inst->targets[0]);
+        break;
+    case IR_Branch:
+        ir_add_line(lw, "PUSH", ir_slot(lw, Arraylist_get(inst->operands, 0)));
+        if (inst->targets[0] == next) {
+            StringBuilder_add_arr(code_sb, "NOT\n");
+            ir_add_label(lw, "IFEQ", inst->targets[1]);
+        }
+        else {
+            ir_add_label(lw, "IFEQ", inst->targets[0]);
+            if (inst->targets[1] != next)
+                ir_add_label(lw, "JMP", inst->targets[1]);
+        }
+        break;
+    case IR_Return:
+        if (Arraylist_size(inst->operands) > 0 && lw->ret_slot >= 0) {
+            StringBuilder_add_arr(code_sb, "COPY");
+            add_operand(code_sb, lw->ret_slot);
+            add_operand(code_sb, ir_slot(lw, Arraylist_get(inst->operands, 0)));
+            StringBuilder_add_arr(code_sb, "\n");
+        }
+        if (next != NULL) {
+            StringBuilder_add_arr(code_sb, "JMP ");
+            StringBuilder_add_arr(code_sb, lw->fn->name);
+            StringBuilder_add_arr(code_sb, "_END\n");
+        }
+        break;
+    }
+}
+
+int IrFunction_prepare_lowering(IrFunction* fn)
+{
+    ir_split_critical_edges(fn);
+    ir_eliminate_phis(fn);
+    return Arraylist_size(fn->blocks);
+}
+
+void IrFunction_lower_to_nni(IrFunction* fn, StringBuilder* code_sb, int label_base, GenOptions* options)
+{
+    IrLowering lw;
+    lw.fn = fn;
+    lw.code_sb = code_sb;
+    lw.options = options;
+
+    ir_collect_values(&lw);
+
+    StringBuilder_add_arr(code_sb, "FS ");
+    StringBuilder_add_arr(code_sb, fn->name);
+    StringBuilder_add_arr(code_sb, "\n");
+
+    ir_assign_slots(&lw);
+    lw.label_base = label_base;
+
+    for (int b = 0; b < Arraylist_size(fn->blocks); b++) {
+        IrBlock* block = Arraylist_get(fn->blocks, b);
+        IrBlock* next = Arraylist_get(fn->blocks, b+1);
+
+        if (Arraylist_size(block->preds) > 0)
+            ir_add_label(&lw, "ADDR", block);
+
+        for (int i = 0; i < Arraylist_size(block->insts); i++)
+            ir_lower_inst(&lw, Arraylist_get(block->insts, i), next);
+    }
+
+    StringBuilder_add_arr(code_sb, "ADDR ");
+    StringBuilder_add_arr(code_sb, fn->name);
+    StringBuilder_add_arr(code_sb, "_END\nFE ");
+    StringBuilder_add_arr(code_sb, fn->name);
+    if (lw.ret_slot >= 0) {
+        StringBuilder_add_arr(code_sb, " ");
+        StringBuilder_add_arr(code_sb, String_from_int(lw.ret_slot));
+    }
+    StringBuilder_add_arr(code_sb, "\n");
+
+    free(lw.types);
+    free(lw.slots);
+    free(lw.used);
+}
+
+void IrFunction_to_nni(IrFunction* fn, StringBuilder* code_sb, int* control_id, GenOptions* options)
+{
+    int labels = IrFunction_prepare_lowering(fn);
+    IrFunction_lower_to_nni(fn, code_sb, *control_id, options);
+    *control_id += labels;
+}
@@ -0,0 +1,17 @@
+#ifndef IRLOWER_H
+#define IRLOWER_H
+
+#include "ir.h"
+#include "nonamegenerator.h"
+#include "stringbuilder.h"
+
+// Takes the function out of SSA form and emits it as NNI, every value gets
+// its own slot and phis become copies at the end of their predecessors
+void IrFunction_to_nni(IrFunction* fn, StringBuilder* code_sb, int* control_id, GenOptions* options);
+// The two halves of IrFunction_to_nni. Preparing splits critical edges and
+// replaces the phis, it returns how many labels the function needs; the
+// labels are then numbered from label_base
+int IrFunction_prepare_lowering(IrFunction* fn);
+void IrFunction_lower_to_nni(IrFunction* fn, StringBuilder* code_sb, int label_base, GenOptions* options);
+
+#endif
@@ -0,0 +1,292 @@
+#include "licm.h"
+#include "ast.h"
+#include "tree.h"
+#include "hashmap.h"
+#include "arraylist.h"
+#include "stringbuilder.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define ALLOC_SUBSYSTEM PassesAlloc
+#include "alloc.h"
+
+struct licm_state
+{
+    int next_id;
+    int hoisted;
+};
+
+typedef struct licm_state LicmState;
+
+void licm_mark(Hashmap* set, char* name)
+{
+    if (Hashmap_get(set, name) == NULL)
+        Hashmap_insert(set, name, set);
+}
+
+// Calls may write through their arguments (e.g. LS_ADD), so they count as writes
+void licm_collect_call_writes(CallNode* cn, Hashmap* modified)
+{
+    for (int i = 0; i < Arraylist_size(cn->args); i++) {
+        GenericNode* gn = Arraylist_get(cn->args, i);
+        if (gn->type == VariableNode_t)
+            licm_mark(modified, ((VariableNode*)gn->node)->name);
+    }
+}
+
+void licm_collect_expression_writes(ExpressionNode* en, Hashmap* modified)
+{
+    for (int i = 0; i < Arraylist_size(en->nodes); i++) {
+        GenericNode* gn = Arraylist_get(en->nodes, i);
+        if (gn->type == CallNode_t)
+            licm_collect_call_writes((CallNode*)gn->node, modified);
+    }
+}
+
+void licm_collect_writes(Arraylist* statements, Hashmap* modified)
+{
+    for (int i = 0; i < Arraylist_size(statements); i++) {
+        GenericNode* gn = Arraylist_get(statements, i);
+
+        switch (gn->type) {
+        case AssignmentNode_t:
+            licm_mark(modified, ((AssignmentNode*)gn->node)->left);
+            licm_collect_expression_writes(((AssignmentNode*)gn->node)->right, modified);
+            break;
+        case DeclarationNode_t:
+            licm_mark(modified, ((DeclarationNode*)gn->node)->name);
+            break;
+        case CallNode_t:
+            licm_collect_call_writes((CallNode*)gn->node, modified);
+            break;
+        case IfNode_t:
+            licm_collect_expression_writes(((IfNode*)gn->node)->condition, modified);
+            licm_collect_writes(((IfNode*)gn->node)->statements, modified);
+            break;
+        case ElseNode_t:
+            licm_collect_writes(((ElseNode*)gn->node)->statements, modified);
+            break;
+        case WhileNode_t:
+            licm_collect_expression_writes(((WhileNode*)gn->node)->condition, modified);
+            licm_collect_writes(((WhileNode*)gn->node)->statements, modified);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+char* licm_new_name(LicmState* state)
+{
+    StringBuilder* sb = StringBuilder_new();
+    StringBuilder_add_arr(sb, "LICM ");
+    StringBuilder_add_arr(sb, String_from_int(state->next_id++));
+    char* name = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+
+    return name;
+}
+
+// Adds `var name : type = (value)` to the preheader
+void licm_add_preheader(Arraylist* preheader, char* name, Type type, ExpressionNode* value)
+{
+    Arraylist_add(preheader, GenericNode_new(DeclarationNode_t, DeclarationNode_new(String_from(name), type)));
+    Arraylist_add(preheader, GenericNode_new(AssignmentNode_t, AssignmentNode_new(String_from(name), value)));
+}
+
+bool licm_is_nonzero_literal(GenericNode* gn)
+{
+    if (gn->type != LiteralNode_t || ((LiteralNode*)gn->node)->type == Char_t)
+        return false;
+
+    NumberValue value = ((LiteralNode*)gn->node)->value;
+    return value.is_float ? value.as.f != 0 : value.as.i != 0;
+}
+
+// Returns the variable holding the hoisted literal, creating it on first use
+GenericNode* licm_hoist_literal(LicmState* state, LiteralNode* ln, Hashmap* literals, Arraylist* preheader)
+{
+    StringBuilder* sb = StringBuilder_new();
+    StringBuilder_add_arr(sb, ln->type == Char_t ? "S" : "N");
+    LiteralNode_append(sb, ln);
+    char* key = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+
+    char* name = Hashmap_get(literals, key);
+    if (name == NULL) {
+        name = licm_new_name(state);
+        ExpressionNode* value = ExpressionNode_new();
+        ExpressionNode_add(value, GenericNode_new(LiteralNode_t, LiteralNode_copy(ln)));
+        licm_add_preheader(preheader, name, ln->type, value);
+        Hashmap_insert(literals, key, name);
+        state->hoisted++;
+    }
+    free(key);
+
+    return GenericNode_new(VariableNode_t, VariableNode_new(String_from(name), NULL, ln->type));
+}
+
+void licm_hoist_expression(LicmState* state, ExpressionNode* en, Hashmap* modified, Hashmap* literals, Arraylist* preheader)
+{
+    int size = Arraylist_size(en->nodes);
+
+    // A lone literal, variable or call is already a single instruction.
+    // Literal call arguments stay where they are, a call may write through
+    // its arguments and a shared slot would carry that into the next call
+    if (size < 2)
+        return;
+
+    int* starts = ExpressionNode_subtree_starts(en);
+    bool* invariant = malloc(sizeof(bool) * size);
+
+    for (int i = 0; i < size; i++) {
+        GenericNode* gn = Arraylist_get(en->nodes, i);
+        OpType op;
+        int right;
+
+        switch (gn->type) {
+        case LiteralNode_t:
+            invariant[i] = true;
+            break;
+        case VariableNode_t:
+            invariant[i] = Hashmap_get(modified, ((VariableNode*)gn->node)->name) == NULL;
+            break;
+        case OperatorNode_t:
+            op = ((OperatorNode*)gn->node)->op_t;
+            right = i-1;
+            invariant[i] = invariant[right];
+            if (op != Not_t)
+                invariant[i] = invariant[i] && invariant[starts[right]-1];
+            // The preheader runs even if the loop does not, so never hoist a possible division by zero
+            if ((op == Div_t || op == Mod_t) && !(starts[right] == right && licm_is_nonzero_literal(Arraylist_get(en->nodes, right))))
+                invariant[i] = false;
+            break;
+        default:
+            invariant[i] = false;
+            break;
+        }
+    }
+
+    // Walk back from the end so replacing a range keeps earlier indices valid
+    for (int i = size-1; i >= 0;) {
+        GenericNode* gn = Arraylist_get(en->nodes, i);
+
+        if (gn->type == OperatorNode_t && invariant[i]) {
+            char* name = licm_new_name(state);
+            licm_add_preheader(preheader, name, I64_t, ExpressionNode_copy_range(en, starts[i], i));
+            ExpressionNode_replace_range(en, starts[i], i, GenericNode_new(VariableNode_t, VariableNode_new(name, NULL, I64_t)));
+            state->hoisted++;
+            i = starts[i]-1;
+        }
+        else {
+            i--;
+        }
+    }
+
+    free(starts);
+    free(invariant);
+
+    if (Arraylist_size(en->nodes) < 2)
+        return;
+
+    for (int i = 0; i < Arraylist_size(en->nodes); i++) {
+        GenericNode* gn = Arraylist_get(en->nodes, i);
+        if (gn->type != LiteralNode_t)
+            continue;
+
+        Arraylist_set(en->nodes, licm_hoist_literal(state, (LiteralNode*)gn->node, literals, preheader), i);
+        GenericNode_free(gn);
+    }
+}
+
+void licm_hoist_block(LicmState* state, Arraylist* statements, Hashmap* modified, Hashmap* literals, Arraylist* preheader)
+{
+    for (int i = 0; i < Arraylist_size(statements); i++) {
+        GenericNode* gn = Arraylist_get(statements, i);
+
+        switch (gn->type) {
+        case AssignmentNode_t:
+            licm_hoist_expression(state, ((AssignmentNode*)gn->node)->right, modified, literals, preheader);
+            break;
+        case IfNode_t:
+            licm_hoist_expression(state, ((IfNode*)gn->node)->condition, modified, literals, preheader);
+            licm_hoist_block(state, ((IfNode*)gn->node)->statements, modified, literals, preheader);
+            break;
+        case ElseNode_t:
+            licm_hoist_block(state, ((ElseNode*)gn->node)->statements, modified, literals, preheader);
+            break;
+        case WhileNode_t:
+            licm_hoist_expression(state, ((WhileNode*)gn->node)->condition, modified, literals, preheader);
+            licm_hoist_block(state, ((WhileNode*)gn->node)->statements, modified, literals, preheader);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Builds the preheader of the loop at index and inserts it in front of the loop,
+// returns the number of inserted statements
+int licm_loop(LicmState* state, Arraylist* statements, int index, WhileNode* wn)
+{
+    Hashmap* modified = Hashmap_new(Arraylist_no_free);
+    Hashmap* literals = Hashmap_new(free);
+    Arraylist* preheader = Arraylist_new(Arraylist_no_free);
+
+    licm_collect_writes(wn->statements, modified);
+    licm_collect_expression_writes(wn->condition, modified);
+
+    licm_hoist_expression(state, wn->condition, modified, literals, preheader);
+    licm_hoist_block(state, wn->statements, modified, literals, preheader);
+
+    int inserted = Arraylist_size(preheader);
+    for (int i = 0; i < inserted; i++)
+        Arraylist_insert(statements, Arraylist_get(preheader, i), index+i);
+
+    Arraylist_free(preheader);
+    Hashmap_free(literals);
+    Hashmap_free(modified);
+
+    return inserted;
+}
+
+// Outer loops go first, anything invariant there is invariant in the inner loops too
+void licm_block(LicmState* state, Arraylist* statements)
+{
+    for (int i = 0; i < Arraylist_size(statements); i++) {
+        GenericNode* gn = Arraylist_get(statements, i);
+
+        switch (gn->type) {
+        case WhileNode_t:
+            i += licm_loop(state, statements, i, (WhileNode*)gn->node);
+            licm_block(state, ((WhileNode*)gn->node)->statements);
+            break;
+        case IfNode_t:
+            licm_block(state, ((IfNode*)gn->node)->statements);
+            break;
+        case ElseNode_t:
+            licm_block(state, ((ElseNode*)gn->node)->statements);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+int licm_run(AST* ast)
+{
+    LicmState state;
+    state.hoisted = 0;
+
+    for (Hashmap_Node* iter = Hashmap_get_iter(ast->functions); iter != NULL; iter = Hashmap_iter_next(iter)) {
+        GenericNode* gn = iter->val;
+        if (gn->type != FunctionNode_t)
+            continue;
+
+        state.next_id = 0;
+        licm_block(&state, ((FunctionNode*)gn->node)->statements);
+    }
+
+    return state.hoisted;
+}
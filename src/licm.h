@@ -0,0 +1,10 @@
+#ifndef LICM_H
+#define LICM_H
+
+#include "ast.h"
+
+// Hoists loop invariant expressions and literals in front of while loops,
+// returns the number of hoisted values
+int licm_run(AST* ast);
+
+#endif
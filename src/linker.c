@@ -0,0 +1,142 @@
+#include "linker.h"
+#include "object.h"
+#include "nonamegenerator.h"
+#include "stringbuilder.h"
+#include "panic.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ALLOC_SUBSYSTEM CodegenAlloc
+#include "alloc.h"
+
+// A function the link can resolve a call to
+struct link_symbol
+{
+    char* name;
+    // Object or module that defines it
+    char* origin;
+    // NULL for functions of modules
+    ObjectFunction* function;
+};
+
+typedef struct link_symbol LinkSymbol;
+
+int link_symbol_compare(const void* a, const void* b)
+{
+    return strcmp(((const LinkSymbol*)a)->name, ((const LinkSymbol*)b)->name);
+}
+
+LinkSymbol* link_find(LinkSymbol* symbols, int count, char* name)
+{
+    LinkSymbol key;
+    key.name = name;
+    return bsearch(&key, symbols, count, sizeof(LinkSymbol), link_symbol_compare);
+}
+
+void link_free_names(void* ptr)
+{
+    Arraylist_free(ptr);
+}
+
+void link_objects(Arraylist* objects, ModuleRegistry* modules, Sink* out)
+{
+    // char*, every module once, in the order they are first imported
+    Arraylist* imports = Arraylist_new(free);
+    int count = 0;
+
+    for (int i = 0; i < Arraylist_size(objects); i++) {
+        ObjectFile* object = Arraylist_get(objects, i);
+        count += Arraylist_size(object->functions);
+
+        for (int j = 0; j < Arraylist_size(object->imports); j++) {
+            char* name = Arraylist_get(object->imports, j);
+            bool repeated = false;
+            for (int k = 0; k < Arraylist_size(imports) && !repeated; k++)
+                repeated = strcmp(name, Arraylist_get(imports, k)) == 0;
+            if (!repeated)
+                Arraylist_add(imports, String_from(name));
+        }
+    }
+
+    // Names the module functions come from, they live as long as the link
+    Arraylist* module_functions = Arraylist_new(link_free_names);
+    for (int i = 0; i < Arraylist_size(imports); i++) {
+        Module* module = ModuleRegistry_get(modules, Arraylist_get(imports, i));
+        Arraylist* names = code_operands(module->content, module->size, "FS ");
+        Arraylist_add(module_functions, names);
+        count += Arraylist_size(names);
+    }
+
+    LinkSymbol* symbols = malloc(sizeof(LinkSymbol) * (count > 0 ? count : 1));
+    int n = 0;
+    for (int i = 0; i < Arraylist_size(imports); i++) {
+        Arraylist* names = Arraylist_get(module_functions, i);
+        for (int j = 0; j < Arraylist_size(names); j++) {
+            symbols[n].name = Arraylist_get(names, j);
+            symbols[n].origin = Arraylist_get(imports, i);
+            symbols[n++].function = NULL;
+        }
+    }
+    for (int i = 0; i < Arraylist_size(objects); i++) {
+        ObjectFile* object = Arraylist_get(objects, i);
+        for (int j = 0; j < Arraylist_size(object->functions); j++) {
+            ObjectFunction* function = Arraylist_get(object->functions, j);
+            function->linked = false;
+            symbols[n].name = function->name;
+            symbols[n].origin = object->path;
+            symbols[n++].function = function;
+        }
+    }
+
+    qsort(symbols, count, sizeof(LinkSymbol), link_symbol_compare);
+    for (int i = 1; i < count; i++)
+        if (strcmp(symbols[i - 1].name, symbols[i].name) == 0)
+            panic("%s is defined in both %s and %s", symbols[i].name, symbols[i - 1].origin, symbols[i].origin);
+
+    // Marks what main reaches, depth first
+    LinkSymbol* main_symbol = link_find(symbols, count, "main");
+    if (main_symbol == NULL || main_symbol->function == NULL)
+        panic("No object defines main");
+
+    ObjectFunction** stack = malloc(sizeof(ObjectFunction*) * (count > 0 ? count : 1));
+    int depth = 0;
+    main_symbol->function->linked = true;
+    stack[depth++] = main_symbol->function;
+
+    while (depth > 0) {
+        ObjectFunction* function = stack[--depth];
+        for (int i = 0; i < Arraylist_size(function->calls); i++) {
+            LinkSymbol* callee = link_find(symbols, count, Arraylist_get(function->calls, i));
+            if (callee == NULL)
+                panic("Undefined function %s, called from %s", (char*)Arraylist_get(function->calls, i), function->name);
+            if (callee->function != NULL && !callee->function->linked) {
+                callee->function->linked = true;
+                stack[depth++] = callee->function;
+            }
+        }
+    }
+
+    for (int i = 0; i < Arraylist_size(imports); i++) {
+        Module* module = ModuleRegistry_get(modules, Arraylist_get(imports, i));
+        Sink_write(out, module->content, module->size);
+    }
+
+    int label_base = 0;
+    for (int i = 0; i < Arraylist_size(objects); i++) {
+        ObjectFile* object = Arraylist_get(objects, i);
+        for (int j = 0; j < Arraylist_size(object->functions); j++) {
+            ObjectFunction* function = Arraylist_get(object->functions, j);
+            if (!function->linked)
+                continue;
+            relocate_labels(function->code, function->size, label_base, out);
+            label_base += function->labels;
+        }
+    }
+    Sink_write_str(out, NNI_PROGRAM_END);
+
+    free(stack);
+    free(symbols);
+    Arraylist_free(module_functions);
+    Arraylist_free(imports);
+}
@@ -0,0 +1,16 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include "arraylist.h"
+#include "modules.h"
+#include "sink.h"
+
+// Links object files into one NNI program (comp --link). Every call is
+// resolved against the functions of the objects and of the modules they
+// import, a call nothing defines or a function defined twice is an error.
+// Only the object functions main can reach are written, after the modules
+// and with their labels numbered on from each other, then CALL main.
+// Modules are included whole, once each
+void link_objects(Arraylist* objects, ModuleRegistry* modules, Sink* out);
+
+#endif
@@ -1,15 +1,120 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include "arraylist.h"
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "tests.h"
 
 #include "tokenizer.h"
 #include "ast.h"
 #include "nonamegenerator.h"
+#include "passmanager.h"
+#include "typecheck.h"
+#include "timereport.h"
+#include "irbuilder.h"
+#include "stream.h"
+#include "sink.h"
+#include "batch.h"
+#include "server.h"
+#include "diskcache.h"
+#include "version.h"
+#include "object.h"
+#include "linker.h"
+#include "watch.h"
 
 #include "stringbuilder.h"
+#include "panic.h"
+
+#define ALLOC_SUBSYSTEM OtherAlloc
+#include "alloc.h"
+
+void print_alloc_stats()
+{
+    MemStats_print(stderr);
+}
+
+// Arguments that change the generated code, the others only change how it
+// is made
+bool changes_output(char* arg)
+{
+    return (strncmp(arg, "-O", 2) == 0 && arg[2] >= '0' && arg[2] <= '9')
+        || strncmp(arg, "--disable-pass=", 15) == 0
+        || strcmp(arg, "--three-address") == 0
+        || strcmp(arg, "--typed") == 0
+        || strcmp(arg, "--ssa") == 0
+        || strcmp(arg, "--emit-ir") == 0
+        || strcmp(arg, "-c") == 0;
+}
+
+// Reads the object files and links them into one program
+void link_files(Arraylist* paths, ModuleRegistry* modules, Sink* out)
+{
+    Arraylist* objects = Arraylist_new(ObjectFile_free);
+    for (int i = 0; i < Arraylist_size(paths); i++)
+        Arraylist_add(objects, ObjectFile_read(Arraylist_get(paths, i)));
+
+    link_objects(objects, modules, out);
+    Arraylist_free(objects);
+}
+
+// -o is written under a temporary name next to it and renamed over it once
+// complete. Until then a panic exits through remove_output_temp, so a
+// compile that fails leaves the previous output as it was
+char* output_temp = NULL;
+
+void remove_output_temp()
+{
+    if (output_temp != NULL)
+        remove(output_temp);
+}
+
+// Sink for the output named by -o, stdout without one
+Sink* output_open(char* output)
+{
+    if (output == NULL)
+        return Sink_fd(STDOUT_FILENO);
+
+    StringBuilder* sb = StringBuilder_new();
+    StringBuilder_add_arr(sb, output);
+    StringBuilder_add_arr(sb, ".tmp");
+    output_temp = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+
+    atexit(remove_output_temp);
+    return Sink_file(output_temp);
+}
+
+// Moves the finished output in place, after its sink was freed
+void output_replace(char* output)
+{
+    if (output_temp == NULL)
+        return;
+    if (rename(output_temp, output) != 0)
+        panic("Could not rename %s to %s: %s", output_temp, output, strerror(errno));
+
+    free(output_temp);
+    output_temp = NULL;
+}
+
+// Prints and writes the report as asked for, then frees it
+void output_time_report(TimeReport* report, bool print, char* json_path)
+{
+    if (print)
+        TimeReport_print(report, stderr);
+    if (json_path != NULL) {
+        FILE* json = fopen(json_path, "w");
+        if (json == NULL)
+            panic("Could not open %s", json_path);
+        TimeReport_write_json(report, json);
+        fclose(json);
+    }
+    TimeReport_free(report);
+}
 
 int main(int argc, char** argv) 
 {
@@ -19,18 +124,289 @@ int main(int argc, char** argv)
     else
         printf("fail\n");
     #else
-    if (argv[1] == NULL)
+    // Both take the socket path first, the client passes the rest on
+    if (argc >= 3 && strcmp(argv[1], "--server") == 0)
+        return server_run(argv[2]);
+    if (argc >= 3 && strcmp(argv[1], "--client") == 0)
+        return client_run(argv[2], argc - 3, argv + 3);
+
+    char* filename = NULL;
+    char* output = NULL;
+    Arraylist* inputs = Arraylist_new(free);
+    int jobs = 0;
+    int lex_threads = 0;
+    GenOptions options;
+    bool emit_ir = false;
+    bool object = false;
+    bool link = false;
+    char* watch_dir = NULL;
+    bool pass_stats = false;
+    bool stream = false;
+    bool pipeline = false;
+    bool time_report = false;
+    char* time_report_json = NULL;
+    char* cache_dir = NULL;
+    long cache_size = DISK_CACHE_DEFAULT_SIZE;
+    bool cache_stats = false;
+    StringBuilder* flags = StringBuilder_new();
+    int opt_level = DEFAULT_OPT_LEVEL;
+    Arraylist* disabled = Arraylist_new(free);
+    GenOptions_init(&options);
+    options.modules = ModuleRegistry_new();
+
+    for (int i = 1; i < argc; i++) {
+        if (changes_output(argv[i])) {
+            StringBuilder_add_arr(flags, argv[i]);
+            StringBuilder_add(flags, '\n');
+        }
+
+        if (strncmp(argv[i], "-O", 2) == 0 && argv[i][2] >= '0' && argv[i][2] <= '9')
+            opt_level = atoi(argv[i] + 2);
+        else if (strncmp(argv[i], "--disable-pass=", 15) == 0)
+            Arraylist_add(disabled, String_from(argv[i] + 15));
+        else if (strcmp(argv[i], "--pass-stats") == 0)
+            pass_stats = true;
+        else if (strcmp(argv[i], "--alloc-stats") == 0)
+            atexit(print_alloc_stats);
+        else if (strcmp(argv[i], "--time-report") == 0)
+            time_report = true;
+        else if (strncmp(argv[i], "--time-report-json=", 19) == 0)
+            time_report_json = argv[i] + 19;
+        else if (strcmp(argv[i], "--three-address") == 0)
+            options.three_address = true;
+        else if (strcmp(argv[i], "--typed") == 0)
+            options.typed = true;
+        else if (strcmp(argv[i], "--ssa") == 0)
+            options.ssa = true;
+        else if (strcmp(argv[i], "--emit-ir") == 0)
+            emit_ir = true;
+        else if (strcmp(argv[i], "-c") == 0)
+            object = true;
+        else if (strcmp(argv[i], "--link") == 0)
+            link = true;
+        else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+            watch_dir = argv[++i];
+        else if (strncmp(argv[i], "--codegen-threads=", 18) == 0)
+            options.threads = atoi(argv[i] + 18);
+        else if (strncmp(argv[i], "--lex-threads=", 14) == 0)
+            lex_threads = atoi(argv[i] + 14);
+        else if (strcmp(argv[i], "--stream") == 0)
+            stream = true;
+        else if (strcmp(argv[i], "--pipeline") == 0)
+            pipeline = true;
+        else if (strncmp(argv[i], "--cache-dir=", 12) == 0)
+            cache_dir = argv[i] + 12;
+        // --cache-size is in megabytes
+        else if (strncmp(argv[i], "--cache-size=", 13) == 0)
+            cache_size = atol(argv[i] + 13) << 20;
+        else if (strcmp(argv[i], "--cache-stats") == 0)
+            cache_stats = true;
+        else if (strcmp(argv[i], "--version") == 0) {
+            printf("%s\n", COMPILER_VERSION);
+            return 0;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (strcmp(argv[i], "-I") == 0 && i + 1 < argc)
+            ModuleRegistry_add_path(options.modules, argv[++i]);
+        else if (strncmp(argv[i], "-I", 2) == 0 && argv[i][2] != '\0')
+            ModuleRegistry_add_path(options.modules, argv[i] + 2);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            jobs = atoi(argv[++i]);
+        else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] >= '0' && argv[i][2] <= '9')
+            jobs = atoi(argv[i] + 2);
+        // Taking an unknown flag as a file would compile the wrong thing or
+        // fail on a file that was never meant to exist
+        else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-I") == 0
+            || strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--watch") == 0)
+            panic("%s needs a value", argv[i]);
+        else if (argv[i][0] == '-')
+            panic("Unknown option: %s", argv[i]);
+        else
+            Arraylist_add(inputs, String_from(argv[i]));
+    }
+
+    if (Arraylist_size(inputs) == 0 && watch_dir == NULL)
         exit(1);
-    char* filename = argv[1];
 
+    // Unknown passes are reported once here instead of by every compile, a
+    // known pass the level does not run is already off
+    for (int i = 0; i < Arraylist_size(disabled); i++)
+        if (!PassManager_known(Arraylist_get(disabled, i)))
+            panic("Unknown pass: %s", (char*)Arraylist_get(disabled, i));
+
+    // Linking compiles nothing, there is nothing to look up or store
+    if (link && (cache_dir != NULL || cache_stats || cache_size != DISK_CACHE_DEFAULT_SIZE))
+        panic("--link does not use the cache, drop the --cache options");
+
+    TimeReport* report = TimeReport_new();
+    char* cache_flags = StringBuilder_get(flags);
+    DiskCache* cache = cache_dir != NULL ? DiskCache_new(cache_dir, cache_size, cache_flags, options.modules) : NULL;
+    StringBuilder_free(flags);
+    free(cache_flags);
+
+    // --link takes object files and writes one program
+    if (link) {
+        Sink* out = output_open(output);
+        TimeReport_start(report, "link");
+        link_files(inputs, options.modules, out);
+        Sink_write_str(out, "\n");
+        report->output_bytes = out->written;
+        Sink_free(out);
+        TimeReport_stop(report);
+        output_replace(output);
+
+        ModuleRegistry_free(options.modules);
+        Arraylist_free(disabled);
+        Arraylist_free(inputs);
+
+        output_time_report(report, time_report, time_report_json);
+        return 0;
+    }
+
+    // --watch keeps the outputs of a directory up to date, they go next to
+    // the sources unless -o names another directory
+    if (watch_dir != NULL) {
+        Watch* watch = Watch_new(watch_dir, output != NULL ? output : watch_dir, &options, emit_ir, object, opt_level, disabled);
+        watch->cache = cache;
+        int status = Watch_run(watch, jobs > 0 ? jobs : 1);
+        Watch_free(watch);
+        if (cache != NULL)
+            DiskCache_free(cache);
+        ModuleRegistry_free(options.modules);
+        Arraylist_free(disabled);
+        Arraylist_free(inputs);
+        TimeReport_free(report);
+        return status;
+    }
+
+    // With -j or several inputs every file is compiled on its own and -o
+    // names the directory the outputs go to
+    if (jobs > 0 || Arraylist_size(inputs) > 1) {
+        Batch* batch = Batch_new(inputs, output != NULL ? output : ".", &options, emit_ir, object, opt_level, disabled);
+        batch->cache = cache;
+        int failed = Batch_run(batch, jobs > 0 ? jobs : 1, report);
+        Batch_free(batch);
+        if (cache != NULL) {
+            if (cache_stats)
+                DiskCache_print_stats(cache, stderr);
+            DiskCache_free(cache);
+        }
+        ModuleRegistry_free(options.modules);
+        Arraylist_free(disabled);
+        Arraylist_free(inputs);
+
+        output_time_report(report, time_report, time_report_json);
+        return failed > 0;
+    }
+    filename = Arraylist_get(inputs, 0);
+
+    PassManager* pm = PassManager_standard(opt_level);
+    pm->stats = pass_stats;
+    for (int i = 0; i < Arraylist_size(disabled); i++)
+        PassManager_disable(pm, Arraylist_get(disabled, i));
+    Arraylist_free(disabled);
+
+    Sink* out = output_open(output);
+
+    TimeReport_start(report, "read");
     char* code = read_file(filename);
     //printf("code: %s \n", code);
 
-    Arraylist* tokens = tokenize(code);
-    AST* ast = AST_from(tokens);
-    char* gen = ast_to_nni(ast);
-    //Arraylist_free(tokens);
-    //AST_free(ast);
-    printf("%s\n", gen);
+    char key[DISK_CACHE_KEY_SIZE];
+    char* cached = NULL;
+    long cached_size;
+    bool hit = false;
+    Sink* target = NULL;
+    if (cache != NULL) {
+        TimeReport_start(report, "cache");
+        DiskCache_key(cache, code, key);
+        cached = DiskCache_get(cache, key, &cached_size);
+        // A miss is compiled into memory so that it can be stored
+        if (cached == NULL) {
+            target = out;
+            out = Sink_memory();
+        }
+    }
+
+    if (cached != NULL) {
+        hit = true;
+        Sink_write(out, cached, cached_size);
+        free(cached);
+    }
+    // Objects are built from the whole program
+    else if (pipeline && !object) {
+        compile_pipeline(code, pm, &options, emit_ir, report, out);
+    }
+    else if (stream && !object) {
+        compile_stream(code, pm, &options, emit_ir, report, out);
+    }
+    else {
+        TimeReport_start(report, "lex");
+        Arraylist* tokens = tokenize_parallel(code, lex_threads);
+        report->tokens = Arraylist_size(tokens);
+
+        TimeReport_start(report, "parse");
+        AST* ast = AST_from(tokens);
+
+        TimeReport_start(report, "passes");
+        PassManager_run(pm, ast, &options);
+
+        TimeReport_start(report, "typecheck");
+        typecheck_run(ast);
+
+        // Output is written while it is generated
+        TimeReport_start(report, "codegen");
+        if (emit_ir) {
+            char* dump = AST_dump_ir(ast);
+            Sink_write_str(out, dump);
+            free(dump);
+        }
+        else if (object) {
+            ObjectFile* obj = ObjectFile_from_ast(ast, &options);
+            ObjectFile_write(obj, out);
+            ObjectFile_free(obj);
+        }
+        else {
+            ast_to_nni_sink(ast, out, &options);
+        }
+
+        TimeReport_start(report, "free");
+        AST_free(ast);
+        Arraylist_free(tokens);
+    }
+
+    TimeReport_start(report, "output");
+    if (!emit_ir && !object && !hit)
+        Sink_write_str(out, "\n");
+    if (target != NULL) {
+        char* result = Sink_memory_get(out);
+        Arraylist* imports = tokenize_imports(code);
+        DiskCache_put(cache, key, imports, result, out->written);
+        Sink_write(target, result, out->written);
+
+        Arraylist_free(imports);
+        free(result);
+        Sink_free(out);
+        out = target;
+    }
+    report->output_bytes = out->written;
+    Sink_free(out);
+    TimeReport_stop(report);
+    output_replace(output);
+
+    free(code);
+    Arraylist_free(inputs);
+    if (pass_stats)
+        PassManager_print_stats(pm, stderr);
+    PassManager_free(pm);
+    if (cache != NULL) {
+        if (cache_stats)
+            DiskCache_print_stats(cache, stderr);
+        DiskCache_free(cache);
+    }
+    ModuleRegistry_free(options.modules);
+
+    output_time_report(report, time_report, time_report_json);
     #endif
 }
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "memstat.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+// Every block carries its size and subsystem in front of it, so a free
+// can be charged back to whoever made the allocation. 16 bytes keep the
+// alignment malloc guarantees
+#define ALLOC_HEADER_SIZE 16
+
+struct alloc_header
+{
+    size_t size;
+    Subsystem subsystem;
+};
+
+typedef struct alloc_header AllocHeader;
+
+char* subsystem_names[SubsystemCount] = {
+    "other", "lexer", "parser", "tree", "passes", "codegen", "containers"
+};
+
+__thread Subsystem alloc_subsystem = OtherAlloc;
+
+// Counted per thread so the wrapped malloc takes no lock, finished threads
+// add theirs to the merged counters
+__thread MemStats mem_stats = {0, 0, 0, 0, 0};
+__thread MemStats subsystem_stats[SubsystemCount];
+
+MemStats merged_stats = {0, 0, 0, 0, 0};
+MemStats merged_subsystem_stats[SubsystemCount];
+pthread_mutex_t merged_lock = PTHREAD_MUTEX_INITIALIZER;
+
+char* Subsystem_name(Subsystem subsystem)
+{
+    return subsystem_names[subsystem];
+}
+
+void mem_stats_count(MemStats* stats, long size)
+{
+    stats->allocations++;
+    stats->bytes += size;
+    stats->live_bytes += size;
+    if (stats->live_bytes > stats->peak_bytes)
+        stats->peak_bytes = stats->live_bytes;
+}
+
+void mem_stats_uncount(MemStats* stats, long size)
+{
+    stats->frees++;
+    stats->live_bytes -= size;
+}
+
+// Fills in the header of a fresh block and returns the pointer handed out
+void* mem_stats_add(void* block, size_t size)
+{
+    if (block == NULL)
+        return NULL;
+
+    AllocHeader* header = (AllocHeader*)block;
+    header->size = size;
+    header->subsystem = alloc_subsystem;
+    alloc_subsystem = OtherAlloc;
+
+    mem_stats_count(&mem_stats, size);
+    mem_stats_count(&subsystem_stats[header->subsystem], size);
+    return (char*)block + ALLOC_HEADER_SIZE;
+}
+
+// Returns the block behind a pointer handed out by mem_stats_add
+void* mem_stats_remove(void* ptr)
+{
+    if (ptr == NULL)
+        return NULL;
+
+    AllocHeader* header = (AllocHeader*)((char*)ptr - ALLOC_HEADER_SIZE);
+    mem_stats_uncount(&mem_stats, header->size);
+    mem_stats_uncount(&subsystem_stats[header->subsystem], header->size);
+    return header;
+}
+
+void* __wrap_malloc(size_t size)
+{
+    if (size > SIZE_MAX - ALLOC_HEADER_SIZE)
+        return NULL;
+
+    return mem_stats_add(__real_malloc(size + ALLOC_HEADER_SIZE), size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    if (size != 0 && count > (SIZE_MAX - ALLOC_HEADER_SIZE) / size)
+        return NULL;
+
+    return mem_stats_add(__real_calloc(1, count * size + ALLOC_HEADER_SIZE), count * size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    if (size > SIZE_MAX - ALLOC_HEADER_SIZE)
+        return NULL;
+    if (ptr == NULL)
+        return __wrap_malloc(size);
+
+    // Counted again as a new allocation of the caller, the old block is
+    // only gone once realloc succeeded
+    AllocHeader* header = (AllocHeader*)((char*)ptr - ALLOC_HEADER_SIZE);
+    size_t old_size = header->size;
+    Subsystem old_subsystem = header->subsystem;
+
+    void* block = __real_realloc(header, size + ALLOC_HEADER_SIZE);
+    if (block == NULL)
+        return NULL;
+
+    mem_stats_uncount(&mem_stats, old_size);
+    mem_stats_uncount(&subsystem_stats[old_subsystem], old_size);
+    return mem_stats_add(block, size);
+}
+
+void __wrap_free(void* ptr)
+{
+    __real_free(mem_stats_remove(ptr));
+}
+
+// Adds the counters of one thread to another. Threads peak at different
+// times, so the peaks add up to an upper bound
+void mem_stats_merge(MemStats* into, MemStats* stats)
+{
+    into->allocations += stats->allocations;
+    into->frees += stats->frees;
+    into->bytes += stats->bytes;
+    into->live_bytes += stats->live_bytes;
+    into->peak_bytes += stats->peak_bytes;
+}
+
+void MemStats_thread_done()
+{
+    pthread_mutex_lock(&merged_lock);
+    mem_stats_merge(&merged_stats, &mem_stats);
+    for (int i = 0; i < SubsystemCount; i++)
+        mem_stats_merge(&merged_subsystem_stats[i], &subsystem_stats[i]);
+    pthread_mutex_unlock(&merged_lock);
+
+    memset(&mem_stats, 0, sizeof(MemStats));
+    memset(subsystem_stats, 0, sizeof(subsystem_stats));
+}
+
+void MemStats_get(MemStats* stats)
+{
+    pthread_mutex_lock(&merged_lock);
+    *stats = merged_stats;
+    pthread_mutex_unlock(&merged_lock);
+    mem_stats_merge(stats, &mem_stats);
+}
+
+void MemStats_get_subsystem(Subsystem subsystem, MemStats* stats)
+{
+    pthread_mutex_lock(&merged_lock);
+    *stats = merged_subsystem_stats[subsystem];
+    pthread_mutex_unlock(&merged_lock);
+    mem_stats_merge(stats, &subsystem_stats[subsystem]);
+}
+
+void mem_stats_print_row(FILE* out, char* name, MemStats* stats)
+{
+    fprintf(out, "%-11s %10li %10li %12li %12li %12li %12li\n", name, stats->allocations,
+        stats->frees, stats->bytes, stats->peak_bytes, stats->allocations - stats->frees,
+        stats->live_bytes);
+}
+
+void MemStats_print(FILE* out)
+{
+    fprintf(out, "%-11s %10s %10s %12s %12s %12s %12s\n", "subsystem", "allocs", "frees",
+        "bytes", "peak live", "leaked", "leaked bytes");
+
+    MemStats stats;
+    for (int i = 0; i < SubsystemCount; i++) {
+        MemStats_get_subsystem(i, &stats);
+        mem_stats_print_row(out, subsystem_names[i], &stats);
+    }
+    MemStats_get(&stats);
+    mem_stats_print_row(out, "total", &stats);
+}
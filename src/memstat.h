@@ -0,0 +1,53 @@
+#ifndef MEMSTAT_H
+#define MEMSTAT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Part of the compiler an allocation is charged to, set per file through
+// alloc.h
+enum subsystem
+{
+    OtherAlloc,
+    LexerAlloc,
+    ParserAlloc,
+    TreeAlloc,
+    PassesAlloc,
+    CodegenAlloc,
+    ContainersAlloc,
+    SubsystemCount
+};
+
+typedef enum subsystem Subsystem;
+
+// Counts every malloc/calloc/realloc/free made by the compiler. The linker
+// routes the calls through the __wrap_ functions (see LDFLAGS), so nothing
+// has to change at the call sites
+struct mem_stats
+{
+    long allocations;
+    long frees;
+    // Total bytes handed out, and currently held by live blocks
+    long bytes;
+    long live_bytes;
+    long peak_bytes;
+};
+
+typedef struct mem_stats MemStats;
+
+// Subsystem the next allocation of this thread is charged to, the wrapped
+// malloc resets it to OtherAlloc once it has been used
+extern __thread Subsystem alloc_subsystem;
+
+char* Subsystem_name(Subsystem subsystem);
+// Counters are kept per thread, a thread calls this before it exits so its
+// allocations still show up in the totals
+void MemStats_thread_done();
+// Totals of the finished threads and the calling one
+void MemStats_get(MemStats* stats);
+void MemStats_get_subsystem(Subsystem subsystem, MemStats* stats);
+// Table of the counters of every subsystem, live bytes are reported as
+// leaked since this runs when the compiler is done
+void MemStats_print(FILE* out);
+
+#endif
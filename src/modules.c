@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "modules.h"
+#include "hashtable.h"
+#include "stringbuilder.h"
+#include "panic.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ALLOC_SUBSYSTEM OtherAlloc
+#include "alloc.h"
+
+#define MODULE_EXTENSION ".nnivm"
+
+void Module_free(void* ptr)
+{
+    Module* module = ptr;
+    if (module->size > 0)
+        munmap(module->content, module->size);
+    free(module->path);
+    free(module);
+}
+
+ModuleRegistry* ModuleRegistry_new()
+{
+    ModuleRegistry* registry = malloc(sizeof(ModuleRegistry));
+    registry->search_paths = Arraylist_new(free);
+    registry->modules = Hashmap_new(Module_free);
+    pthread_mutex_init(&registry->lock, NULL);
+    return registry;
+}
+
+void ModuleRegistry_add_path(ModuleRegistry* registry, char* dir)
+{
+    Arraylist_add(registry->search_paths, String_from(dir));
+}
+
+// <dir>/<name>.nnivm, or <name>.nnivm without a directory. Allocated
+char* module_path(char* dir, char* name)
+{
+    StringBuilder* sb = StringBuilder_new();
+    if (dir != NULL) {
+        StringBuilder_add_arr(sb, dir);
+        if (sb->size > 0 && sb->str[sb->size - 1] != '/')
+            StringBuilder_add(sb, '/');
+    }
+    StringBuilder_add_arr(sb, name);
+    StringBuilder_add_arr(sb, MODULE_EXTENSION);
+
+    char* path = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+    return path;
+}
+
+// Maps the file, NULL when it can not be opened. Sets mapped to false when
+// it opened but could not be mapped, the caller panics once it holds no lock
+Module* module_load(char* path, bool* mapped)
+{
+    *mapped = true;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    Module* module = malloc(sizeof(Module));
+    module->path = path;
+    module->size = st.st_size;
+    // An empty file can not be mapped and needs no memory
+    module->content = "";
+    if (st.st_size > 0) {
+        module->content = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (module->content == MAP_FAILED) {
+            close(fd);
+            free(module);
+            *mapped = false;
+            return NULL;
+        }
+    }
+    close(fd);
+
+    module->hash = fnv1a_hash(module->content, module->size);
+    return module;
+}
+
+Module* ModuleRegistry_find(ModuleRegistry* registry, char* name)
+{
+    pthread_mutex_lock(&registry->lock);
+    Module* module = Hashmap_get(registry->modules, name);
+    char* unmapped = NULL;
+
+    for (int i = -1; module == NULL && unmapped == NULL && i < Arraylist_size(registry->search_paths); i++) {
+        char* path = module_path(i < 0 ? NULL : Arraylist_get(registry->search_paths, i), name);
+        bool mapped;
+        module = module_load(path, &mapped);
+        if (module != NULL)
+            Hashmap_insert(registry->modules, name, module);
+        else if (!mapped)
+            unmapped = path;
+        else
+            free(path);
+    }
+
+    pthread_mutex_unlock(&registry->lock);
+
+    // A panic handler may go on using the registry, so no panic holds the lock
+    if (unmapped != NULL) {
+        char message[PANIC_MESSAGE_SIZE];
+        snprintf(message, sizeof(message), "Could not map %s", unmapped);
+        free(unmapped);
+        panic("%s", message);
+    }
+    return module;
+}
+
+Module* ModuleRegistry_get(ModuleRegistry* registry, char* name)
+{
+    Module* module = ModuleRegistry_find(registry, name);
+    if (module == NULL)
+        panic("Could not open %s" MODULE_EXTENSION, name);
+    return module;
+}
+
+void ModuleRegistry_clear(ModuleRegistry* registry)
+{
+    pthread_mutex_lock(&registry->lock);
+    Hashmap_free(registry->modules);
+    registry->modules = Hashmap_new(Module_free);
+    pthread_mutex_unlock(&registry->lock);
+}
+
+void ModuleRegistry_free(ModuleRegistry* registry)
+{
+    Hashmap_free(registry->modules);
+    Arraylist_free(registry->search_paths);
+    pthread_mutex_destroy(&registry->lock);
+    free(registry);
+}
@@ -0,0 +1,48 @@
+#ifndef MODULES_H
+#define MODULES_H
+
+#include "arraylist.h"
+#include "hashmap.h"
+
+#include <stdint.h>
+#include <pthread.h>
+
+// An imported .nnivm file, mapped into memory
+struct module
+{
+    char* path;
+    // Not terminated, size bytes long
+    char* content;
+    long size;
+    uint64_t hash;
+};
+
+typedef struct module Module;
+
+// Modules by name, each found and mapped once per process and then shared
+// by every compile in it. A module is looked for in the working directory
+// first and then in the search paths, in the order they were added
+struct module_registry
+{
+    // char*, directories given with -I
+    Arraylist* search_paths;
+    // Module*, by name
+    Hashmap* modules;
+    // Batch compiles share the registry
+    pthread_mutex_t lock;
+};
+
+typedef struct module_registry ModuleRegistry;
+
+ModuleRegistry* ModuleRegistry_new();
+void ModuleRegistry_add_path(ModuleRegistry* registry, char* dir);
+// The module, loaded on first use. NULL when no directory has it
+Module* ModuleRegistry_find(ModuleRegistry* registry, char* name);
+// Same as ModuleRegistry_find, but panics when the module is not found
+Module* ModuleRegistry_get(ModuleRegistry* registry, char* name);
+// Unmaps every module so that the next use reads it again. Only while no
+// compile uses the registry
+void ModuleRegistry_clear(ModuleRegistry* registry);
+void ModuleRegistry_free(ModuleRegistry* registry);
+
+#endif
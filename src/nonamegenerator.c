@@ -6,11 +6,19 @@
 #include "panic.h"
 #include "nonamegenerator.h"
 #include "type.h"
+#include "ir.h"
+#include "irbuilder.h"
+#include "irlower.h"
+#include "parallelgen.h"
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <uuid/uuid.h>
 
+#define ALLOC_SUBSYSTEM CodegenAlloc
+#include "alloc.h"
+
 #ifndef UUID_STR_LEN
 #define UUID_STR_LEN 37
 #endif
@@ -34,6 +42,8 @@ VariableObj* Variable_new(int position, Type type)
     VariableObj* variable = malloc(sizeof(VariableObj));
     variable->position = position;
     variable->type = type;
+
+    return variable;
 }
 
 void assign_literal(StringBuilder* code_sb, LiteralNode* ln, int position)
@@ -50,24 +60,24 @@ void assign_literal(StringBuilder* code_sb, LiteralNode* ln, int position)
         break;
         default:
             StringBuilder_add_arr(code_sb, " NUM ");
-            StringBuilder_add_arr(code_sb, String_from(ln->name));
+            LiteralNode_append(code_sb, ln);
         break;
     }
     
     StringBuilder_add_arr(code_sb, "\n");
 }
 
-int make_literal_variable(StringBuilder* code_sb, Hashmap* variable_map, int* variable_tos, LiteralNode* literal)
+int make_literal_variable(StringBuilder* code_sb, Hashmap* variable_map, int* variable_tos, LiteralNode* literal, GenOptions* options)
 {
     int index = *variable_tos;
     (*variable_tos)++;
     Hashmap_insert(variable_map, String_from_int(index), Variable_new(index, literal->type));
-    parse_declaration(DeclarationNode_new(String_from_int(index), literal->type), code_sb);
+    parse_declaration(DeclarationNode_new(String_from_int(index), literal->type), code_sb, options);
     assign_literal(code_sb, literal, index);
     return index;
 }
 
-void parse_call(StringBuilder* code_sb, Hashmap* variable_map, int* variable_tos, CallNode* cn)
+void parse_call(StringBuilder* code_sb, Hashmap* variable_map, int* variable_tos, CallNode* cn, GenOptions* options)
 {
     StringBuilder* call_sb = StringBuilder_new();
     StringBuilder_add_arr(call_sb, String_from("CALL "));
@@ -81,7 +91,7 @@ void parse_call(StringBuilder* code_sb, Hashmap* variable_map, int* variable_tos
         switch (gn->type) {
             case LiteralNode_t:
                 call_ln = (LiteralNode*)gn->node;
-                StringBuilder_add_arr(call_sb, String_from_int(make_literal_variable(code_sb, variable_map, variable_tos, call_ln)));      
+                StringBuilder_add_arr(call_sb, String_from_int(make_literal_variable(code_sb, variable_map, variable_tos, call_ln, options)));      
             break;
             case VariableNode_t:
                 call_vn = (VariableNode*)gn->node;
@@ -95,7 +105,95 @@ void parse_call(StringBuilder* code_sb, Hashmap* variable_map, int* variable_tos
     StringBuilder_free(call_sb);
 }
 
-void parse_expression(Hashmap* variable_map, int* variable_tos, StringBuilder* code_sb, ExpressionNode* en)
+char* type_instruction_name(Type type)
+{
+    switch(type) {
+        case I64_t:
+            return "I64";
+        case I32_t:
+            return "I32";
+        case I16_t:
+            return "I16";
+        case I8_t:
+            return "I8";
+        case U64_t:
+            return "U64";
+        case U32_t:
+            return "U32";
+        case U16_t:
+            return "U16";
+        case U8_t:
+            return "U8";
+        case F64_t:
+            return "F64";
+        case F32_t:
+            return "F32";
+        case Char_t:
+            return "STR";
+        default:
+            break;
+    }
+
+    panic("Invalid type: %i, report bug: https://github.com/alexburroughs/BC-2/issues", (int)type);
+    return NULL;
+}
+
+char* operator_instruction(OpType op)
+{
+    switch(op) {
+        case Add_t:
+            return "ADD";
+        case Sub_t:
+            return "SUB";
+        case Mul_t:
+            return "MUL";
+        case Div_t:
+            return "DIV";
+        case Mod_t:
+            return "MOD";
+        case And_t:
+            return "AND";
+        case Or_t:
+            return "OR";
+        case Greater_t:
+            return "CPMG";
+        case Less_t:
+            return "CMPL";
+        case GreaterEqual_t:
+            return "CMPG";
+        case LessEqual_t:
+            return "CMPL";
+        // Followed by a NOT
+        case NotEqual_t:
+            return "CMP";
+        case Not_t:
+            return "NOT";
+        case Equal_t:
+            return "CMP";
+        case Shl_t:
+            return "SHL";
+        case Shr_t:
+            return "SHR";
+        case BitAnd_t:
+            return "BAND";
+    }
+
+    panic("Invalid operator: %i, report bug: https://github.com/alexburroughs/BC-2/issues", (int)op);
+    return NULL;
+}
+
+// Emits the mnemonic of an operator, suffixed with the operand type (ADD_I32)
+// in typed mode when the type checker proved both operands have it
+void add_operator(StringBuilder* code_sb, OpType op, Type type, GenOptions* options)
+{
+    StringBuilder_add_arr(code_sb, operator_instruction(op));
+    if (options->typed && op != Not_t && type != Void_t && type != Char_t) {
+        StringBuilder_add_arr(code_sb, "_");
+        StringBuilder_add_arr(code_sb, type_instruction_name(type));
+    }
+}
+
+void parse_expression(Hashmap* variable_map, int* variable_tos, StringBuilder* code_sb, ExpressionNode* en, GenOptions* options)
 {
     for (int i = 0; i < Arraylist_size(en->nodes); i++) {
         GenericNode* gn = Arraylist_get(en->nodes, i);
@@ -103,54 +201,13 @@ void parse_expression(Hashmap* variable_map, int* variable_tos, StringBuilder* c
         switch (gn->type)
         {
         case OperatorNode_t:
-            switch(((OperatorNode*)gn->node)->op_t) {
-                case Add_t:
-                    StringBuilder_add_arr(code_sb, "ADD\n");
-                break;
-                case Sub_t:
-                    StringBuilder_add_arr(code_sb, "SUB\n");
-                break;
-                case Mul_t:
-                    StringBuilder_add_arr(code_sb, "MUL\n");
-                break;
-                case Div_t:
-                    StringBuilder_add_arr(code_sb, "DIV\n");
-                break;
-                case Mod_t:
-                    StringBuilder_add_arr(code_sb, "MOD\n");
-                break;
-                case And_t:
-                    StringBuilder_add_arr(code_sb, "AND\n");
-                break;
-                case Or_t:
-                    StringBuilder_add_arr(code_sb, "OR\n");
-                break;
-                case Greater_t:
-                    StringBuilder_add_arr(code_sb, "CPMG\n");
-                break;
-                case Less_t:
-                    StringBuilder_add_arr(code_sb, "CMPL\n");
-                break;
-                case GreaterEqual_t:
-                    StringBuilder_add_arr(code_sb, "CMPG\n");
-                break;
-                case LessEqual_t:
-                    StringBuilder_add_arr(code_sb, "CMPL\n");
-                break;
-                case NotEqual_t:
-                    StringBuilder_add_arr(code_sb, "CMP\n");
-                    StringBuilder_add_arr(code_sb, "NOT\n");
-                break;
-                case Not_t:
-                    StringBuilder_add_arr(code_sb, "NOT\n");
-                break;
-                case Equal_t:
-                    StringBuilder_add_arr(code_sb, "CMP\n");
-                break;
-            }
+            add_operator(code_sb, ((OperatorNode*)gn->node)->op_t, ((OperatorNode*)gn->node)->type, options);
+            StringBuilder_add_arr(code_sb, "\n");
+            if (((OperatorNode*)gn->node)->op_t == NotEqual_t)
+                StringBuilder_add_arr(code_sb, "NOT\n");
             break;
         case LiteralNode_t:
-            id = make_literal_variable(code_sb, variable_map, variable_tos, (LiteralNode*)gn->node);
+            id = make_literal_variable(code_sb, variable_map, variable_tos, (LiteralNode*)gn->node, options);
             StringBuilder_add_arr(code_sb, "PUSH ");
             StringBuilder_add_arr(code_sb, String_from_int(id));
             StringBuilder_add_arr(code_sb, "\n");
@@ -169,10 +226,124 @@ void parse_expression(Hashmap* variable_map, int* variable_tos, StringBuilder* c
     }
 }
 
-void parse_declaration(DeclarationNode* dn, StringBuilder* code_sb)
+// Slot of a leaf operand, literals are materialized first
+int operand_slot(Hashmap* variable_map, int* variable_tos, StringBuilder* code_sb, GenericNode* gn, GenOptions* options)
+{
+    if (gn->type == LiteralNode_t)
+        return make_literal_variable(code_sb, variable_map, variable_tos, (LiteralNode*)gn->node, options);
+
+    return ((VariableObj*)Hashmap_get(variable_map, ((VariableNode*)gn->node)->name))->position;
+}
+
+void add_operand(StringBuilder* code_sb, int slot)
 {
+    StringBuilder_add_arr(code_sb, " ");
+    if (slot == STACK_OPERAND)
+        StringBuilder_add_arr(code_sb, "S");
+    else
+        StringBuilder_add_arr(code_sb, String_from_int(slot));
+}
+
+// Emits the subtree of the postfix list ending at end as three address code
+// writing to dst. Operands that are not leaves are computed first and passed
+// on the stack as S, left before right, so only nested values touch the stack
+void tile_subtree(Hashmap* variable_map, int* variable_tos, StringBuilder* code_sb, ExpressionNode* en, int* starts, int end, int dst, GenOptions* options)
+{
+    GenericNode* gn = Arraylist_get(en->nodes, end);
+
+    if (gn->type != OperatorNode_t) {
+        int slot = operand_slot(variable_map, variable_tos, code_sb, gn, options);
+        StringBuilder_add_arr(code_sb, dst == STACK_OPERAND ? "PUSH" : "COPY");
+        if (dst != STACK_OPERAND)
+            add_operand(code_sb, dst);
+        add_operand(code_sb, slot);
+        StringBuilder_add_arr(code_sb, "\n");
+        return;
+    }
+
+    OpType op = ((OperatorNode*)gn->node)->op_t;
+    int operands[2];
+    int children[2];
+    int count = 0;
+
+    if (op != Not_t)
+        children[count++] = starts[end-1]-1;
+    children[count++] = end-1;
+
+    for (int i = 0; i < count; i++) {
+        GenericNode* child = Arraylist_get(en->nodes, children[i]);
+        if (child->type == OperatorNode_t) {
+            tile_subtree(variable_map, variable_tos, code_sb, en, starts, children[i], STACK_OPERAND, options);
+            operands[i] = STACK_OPERAND;
+        }
+        else {
+            operands[i] = operand_slot(variable_map, variable_tos, code_sb, child, options);
+        }
+    }
+
+    // NOT only exists in stack form, so != goes through the stack
+    int result = op == NotEqual_t ? STACK_OPERAND : dst;
+
+    add_operator(code_sb, op, ((OperatorNode*)gn->node)->type, options);
+    add_operand(code_sb, result);
+    for (int i = 0; i < count; i++)
+        add_operand(code_sb, operands[i]);
+    StringBuilder_add_arr(code_sb, "\n");
+
+    if (op == NotEqual_t) {
+        StringBuilder_add_arr(code_sb, "NOT\n");
+        if (dst != STACK_OPERAND) {
+            StringBuilder_add_arr(code_sb, "POP ");
+            StringBuilder_add_arr(code_sb, String_from_int(dst));
+            StringBuilder_add_arr(code_sb, "\n");
+        }
+    }
+}
+
+void tile_expression(Hashmap* variable_map, int* variable_tos, StringBuilder* code_sb, ExpressionNode* en, int dst, GenOptions* options)
+{
+    for (int i = 0; i < Arraylist_size(en->nodes); i++) {
+        if (((GenericNode*)Arraylist_get(en->nodes, i))->type == CallNode_t) {
+            parse_expression(variable_map, variable_tos, code_sb, en, options);
+            if (dst != STACK_OPERAND) {
+                StringBuilder_add_arr(code_sb, "POP ");
+                StringBuilder_add_arr(code_sb, String_from_int(dst));
+                StringBuilder_add_arr(code_sb, "\n");
+            }
+            return;
+        }
+    }
+
+    int* starts = ExpressionNode_subtree_starts(en);
+    tile_subtree(variable_map, variable_tos, code_sb, en, starts, Arraylist_size(en->nodes)-1, dst, options);
+    free(starts);
+}
+
+// Pushes the value of a condition
+void parse_condition(Hashmap* variable_map, int* variable_tos, StringBuilder* code_sb, ExpressionNode* en, GenOptions* options)
+{
+    if (options->three_address)
+        tile_expression(variable_map, variable_tos, code_sb, en, STACK_OPERAND, options);
+    else
+        parse_expression(variable_map, variable_tos, code_sb, en, options);
+}
+
+// Slot kind a variable of this type is allocated as, the typed output keeps
+// every width apart while the untyped one only tells numbers from strings
+Type declaration_group(Type type, GenOptions* options)
+{
+    if (options->typed || type == Char_t)
+        return type;
+    return I64_t;
+}
+
+void parse_declaration_batch(Type type, int count, StringBuilder* code_sb, GenOptions* options)
+{
+    if (count <= 0)
+        return;
+
     StringBuilder_add_arr(code_sb, String_from("NEW "));
-    switch(dn->type) {
+    switch(type) {
     case I64_t:
     case I32_t:
     case I16_t:
@@ -183,16 +354,68 @@ void parse_declaration(DeclarationNode* dn, StringBuilder* code_sb)
     case U8_t:
     case F64_t:
     case F32_t:
-        StringBuilder_add_arr(code_sb, String_from("NUM\n"));
+        StringBuilder_add_arr(code_sb, options->typed ? type_instruction_name(type) : "NUM");
     break;
     case Char_t:
-        StringBuilder_add_arr(code_sb, String_from("STR\n"));
+        StringBuilder_add_arr(code_sb, String_from("STR"));
     break;
     }
+
+    if (count > 1) {
+        StringBuilder_add_arr(code_sb, " ");
+        StringBuilder_add_arr(code_sb, String_from_int(count));
+    }
+    StringBuilder_add_arr(code_sb, "\n");
+}
+
+void parse_declaration(DeclarationNode* dn, StringBuilder* code_sb, GenOptions* options)
+{
+    parse_declaration_batch(dn->type, 1, code_sb, options);
 }
 
+// Allocates every variable declared directly in a block up front, grouped by
+// slot kind (numbers first and strings last), so the block prologue is one
+// NEW per kind
+void parse_block_declarations(Arraylist* statements, StringBuilder* code_sb, Hashmap* variable_map, int* variable_tos, GenOptions* options)
+{
+    for (Type group = I64_t; group <= Char_t; group++) {
+        int count = 0;
+
+        for (int i = 0; i < Arraylist_size(statements); i++) {
+            GenericNode* gn = Arraylist_get(statements, i);
+            if (gn->type != DeclarationNode_t)
+                continue;
+
+            DeclarationNode* dn = (DeclarationNode*)gn->node;
+            if (declaration_group(dn->type, options) != group)
+                continue;
+
+            Hashmap_insert(variable_map, String_from(dn->name), Variable_new((*variable_tos)++, dn->type));
+            count++;
+        }
 
-void parse_assignment(AssignmentNode* an, StringBuilder* code_sb, Hashmap* variable_map, int* variable_tos)
+        parse_declaration_batch(group, count, code_sb, options);
+    }
+}
+
+// Frees every slot above start with a single counted RM
+void parse_cleanup(StringBuilder* code_sb, int start, int* variable_tos)
+{
+    int count = *variable_tos - start;
+    *variable_tos = start;
+
+    if (count <= 0)
+        return;
+
+    StringBuilder_add_arr(code_sb, "RM");
+    if (count > 1) {
+        StringBuilder_add_arr(code_sb, " ");
+        StringBuilder_add_arr(code_sb, String_from_int(count));
+    }
+    StringBuilder_add_arr(code_sb, "\n");
+}
+
+void parse_assignment(AssignmentNode* an, StringBuilder* code_sb, Hashmap* variable_map, int* variable_tos, GenOptions* options)
 {
     Arraylist* nodes = an->right->nodes;
     GenericNode* gn = (GenericNode*)Arraylist_get(nodes, 0);
@@ -212,52 +435,60 @@ void parse_assignment(AssignmentNode* an, StringBuilder* code_sb, Hashmap* varia
             break;
             default:
                 StringBuilder_add_arr(code_sb, " NUM ");
-                StringBuilder_add_arr(code_sb, ln->name);
+                LiteralNode_append(code_sb, ln);
             break;
             }
             
             StringBuilder_add_arr(code_sb, "\n"); 
             break;
         case CallNode_t:
-            parse_call(code_sb, variable_map, variable_tos, (CallNode*)gn->node);
+            parse_call(code_sb, variable_map, variable_tos, (CallNode*)gn->node, options);
             StringBuilder_add_arr(code_sb, "SET ");
             StringBuilder_add_arr(code_sb, String_from_int(((VariableObj*)Hashmap_get(variable_map, an->left))->position));
             StringBuilder_add_arr(code_sb, " RET\n");
             break;
+        case VariableNode_t:
+            StringBuilder_add_arr(code_sb, "COPY ");
+            StringBuilder_add_arr(code_sb, String_from_int(((VariableObj*)Hashmap_get(variable_map, an->left))->position));
+            StringBuilder_add_arr(code_sb, " ");
+            StringBuilder_add_arr(code_sb, String_from_int(((VariableObj*)Hashmap_get(variable_map, ((VariableNode*)gn->node)->name))->position));
+            StringBuilder_add_arr(code_sb, "\n");
+            break;
         default:
             break;
         }
     }
+    else if (options->three_address) {
+        tile_expression(variable_map, variable_tos, code_sb, an->right, ((VariableObj*)Hashmap_get(variable_map, an->left))->position, options);
+    }
     else {
-        parse_expression(variable_map, variable_tos, code_sb, (ExpressionNode*)an->right);
+        parse_expression(variable_map, variable_tos, code_sb, (ExpressionNode*)an->right, options);
         StringBuilder_add_arr(code_sb, "POP ");
         StringBuilder_add_arr(code_sb, String_from_int(((VariableObj*)Hashmap_get(variable_map, an->left))->position));
         StringBuilder_add_arr(code_sb, "\n");
     }
 }
 
-parse_statements(Arraylist* statements, StringBuilder* code_sb, Hashmap* variable_map, int* variable_tos, int* control_id, char* fn_name)
+parse_statements(Arraylist* statements, StringBuilder* code_sb, Hashmap* variable_map, int* variable_tos, int* control_id, char* fn_name, GenOptions* options)
 {
+    parse_block_declarations(statements, code_sb, variable_map, variable_tos, options);
+
     for (int i = 0; i < Arraylist_size(statements); i++) {
         GenericNode* current_statement = Arraylist_get(statements, i);
         StringBuilder* call_sb;
         StringBuilder* while_sb;
         int start;
-        int loop;
 
         switch(current_statement->type) {
         case IfNode_t:
-            parse_expression(variable_map, variable_tos, code_sb, ((IfNode*)current_statement->node)->condition);
+            parse_condition(variable_map, variable_tos, code_sb, ((IfNode*)current_statement->node)->condition, options);
             StringBuilder_add_arr(code_sb, "NOT\n");
             StringBuilder_add_arr(code_sb, "IFEQ CTR_L");
             StringBuilder_add_arr(code_sb, String_from_int(*control_id));
             StringBuilder_add_arr(code_sb, "\n");
             start = *variable_tos;
-            parse_statements(((IfNode*)current_statement->node)->statements, code_sb, variable_map, variable_tos, control_id, fn_name);
-            
-            for (loop = start; loop < *variable_tos; loop++)
-                StringBuilder_add_arr(code_sb, "RM\n");
-            *variable_tos = start;
+            parse_statements(((IfNode*)current_statement->node)->statements, code_sb, variable_map, variable_tos, control_id, fn_name, options);
+            parse_cleanup(code_sb, start, variable_tos);
             
             if (i+1 < Arraylist_size(statements) && ((GenericNode*)Arraylist_get(statements, i+1))->type == ElseNode_t) {
 
@@ -274,19 +505,17 @@ parse_statements(Arraylist* statements, StringBuilder* code_sb, Hashmap* variabl
             break;
         case ElseNode_t:
             start = *variable_tos;
-            parse_statements(((ElseNode*)current_statement->node)->statements, code_sb, variable_map, variable_tos, control_id, fn_name);
+            parse_statements(((ElseNode*)current_statement->node)->statements, code_sb, variable_map, variable_tos, control_id, fn_name, options);
+            parse_cleanup(code_sb, start, variable_tos);
             StringBuilder_add_arr(code_sb, "ADDR CTR_L");
             StringBuilder_add_arr(code_sb, String_from_int(*control_id));
             StringBuilder_add_arr(code_sb, "\n");
-            for (loop = start; loop < *variable_tos; loop++)
-                StringBuilder_add_arr(code_sb, "RM\n");
-            *variable_tos = start;
             (*control_id)++;
             break;
         case WhileNode_t:
             while_sb = StringBuilder_new();
             start = *variable_tos;
-            parse_expression(variable_map, variable_tos, while_sb, ((WhileNode*)current_statement->node)->condition);
+            parse_condition(variable_map, variable_tos, while_sb, ((WhileNode*)current_statement->node)->condition, options);
             StringBuilder_add_arr(while_sb, "IFEQ CTR_L");
             StringBuilder_add_arr(while_sb, String_from_int(*control_id));
             StringBuilder_add_arr(while_sb, "\n");
@@ -298,10 +527,8 @@ parse_statements(Arraylist* statements, StringBuilder* code_sb, Hashmap* variabl
             StringBuilder_add_arr(code_sb, String_from_int(*control_id));
             StringBuilder_add_arr(code_sb, "\n");
             
-            parse_statements(((WhileNode*)current_statement->node)->statements, code_sb, variable_map, variable_tos, control_id, fn_name);
-            for (loop = start; loop < *variable_tos; loop++)
-                StringBuilder_add_arr(code_sb, "RM\n");
-            *variable_tos = start;
+            parse_statements(((WhileNode*)current_statement->node)->statements, code_sb, variable_map, variable_tos, control_id, fn_name, options);
+            parse_cleanup(code_sb, start, variable_tos);
             StringBuilder_add_arr(code_sb, "ADDR CTR_L");
             StringBuilder_add_arr(code_sb, String_from_int((*control_id)+1));
             StringBuilder_add_arr(code_sb, "\n");
@@ -315,16 +542,14 @@ parse_statements(Arraylist* statements, StringBuilder* code_sb, Hashmap* variabl
 
             break;
         case DeclarationNode_t:
-            parse_declaration(current_statement->node, code_sb);
-            Hashmap_insert(variable_map, String_from(((DeclarationNode*)current_statement->node)->name), 
-                Variable_new((*variable_tos)++, ((DeclarationNode*)current_statement->node)->type));
+            // Allocated in the block prologue by parse_block_declarations
             break;
         case AssignmentNode_t:
-            parse_assignment(((AssignmentNode*)current_statement->node), code_sb, variable_map, variable_tos);
+            parse_assignment(((AssignmentNode*)current_statement->node), code_sb, variable_map, variable_tos, options);
             
             break;
         case CallNode_t:
-            parse_call(code_sb, variable_map, variable_tos, (CallNode*)current_statement->node);
+            parse_call(code_sb, variable_map, variable_tos, (CallNode*)current_statement->node, options);
 
             break;
         case ReturnNode_t:
@@ -345,21 +570,95 @@ parse_statements(Arraylist* statements, StringBuilder* code_sb, Hashmap* variabl
     }
 }
 
-void parse_imports(Arraylist* imports, StringBuilder* code_sb)
+int statements_label_count(Arraylist* statements)
+{
+    int count = 0;
+
+    for (int i = 0; i < Arraylist_size(statements); i++) {
+        GenericNode* current_statement = Arraylist_get(statements, i);
+
+        switch(current_statement->type) {
+        case IfNode_t:
+            count += 1 + statements_label_count(((IfNode*)current_statement->node)->statements);
+            break;
+        case ElseNode_t:
+            count += 1 + statements_label_count(((ElseNode*)current_statement->node)->statements);
+            break;
+        case WhileNode_t:
+            count += 2 + statements_label_count(((WhileNode*)current_statement->node)->statements);
+            break;
+        default:
+            break;
+        }
+    }
+
+    return count;
+}
+
+void parse_imports(Arraylist* imports, StringBuilder* code_sb, GenOptions* options)
 {
     for (int i = 0; i < Arraylist_size(imports); i++) {
         char* file = Arraylist_get(imports, i);
+
+        // A module imported again is already in the output
+        bool repeated = false;
+        for (int j = 0; j < i && !repeated; j++)
+            repeated = strcmp(file, Arraylist_get(imports, j)) == 0;
+        if (repeated)
+            continue;
+
+        if (options->files == NULL && options->modules != NULL) {
+            Module* module = ModuleRegistry_get(options->modules, file);
+            StringBuilder_add_n(code_sb, module->content, module->size);
+            continue;
+        }
+
         StringBuilder* imp = StringBuilder_new();
         StringBuilder_add_arr(imp, file);
         StringBuilder_add_arr(imp, ".nnivm");
-        StringBuilder_add_arr(code_sb, read_file(StringBuilder_get(imp)));
+        char* path = StringBuilder_get(imp);
+
+        if (options->files != NULL) {
+            StringBuilder_add_arr(code_sb, FileCache_get(options->files, path)->content);
+        }
+        else {
+            char* module = read_file(path);
+            StringBuilder_add_arr(code_sb, module);
+            free(module);
+        }
+
+        free(path);
         StringBuilder_free(imp);
     }
 
 }
 
-void parse_function(FunctionNode* fn, StringBuilder* code_sb, int* control_id)
+IrFunction* parse_function_ir(FunctionNode* fn)
+{
+    IrFunction* ir = IrFunction_from(fn);
+    StringBuilder* errors = StringBuilder_new();
+
+    if (IrFunction_verify(ir, errors) != 0)
+        panic("Invalid IR for %s, report bug: https://github.com/alexburroughs/BC-2/issues\n%s", fn->name, StringBuilder_get(errors));
+
+    StringBuilder_free(errors);
+    return ir;
+}
+
+// Builds, checks and lowers the SSA form of a function
+void parse_function_ssa(FunctionNode* fn, StringBuilder* code_sb, int* control_id, GenOptions* options)
+{
+    IrFunction* ir = parse_function_ir(fn);
+    IrFunction_to_nni(ir, code_sb, control_id, options);
+    IrFunction_free(ir);
+}
+
+void parse_function(FunctionNode* fn, StringBuilder* code_sb, int* control_id, GenOptions* options)
 {
+    if (options->ssa) {
+        parse_function_ssa(fn, code_sb, control_id, options);
+        return;
+    }
 
     StringBuilder_add_arr(code_sb, String_from("FS "));
     StringBuilder_add_arr(code_sb, String_from(fn->name));
@@ -375,10 +674,10 @@ void parse_function(FunctionNode* fn, StringBuilder* code_sb, int* control_id)
     if (fn->return_type != Void_t) {
        Hashmap_insert(variable_map, String_from("RET LABEL"), 
             Variable_new(variable_tos++, fn->return_type));
-        parse_declaration(DeclarationNode_new(String_from("RET LABEL"), fn->return_type), code_sb);
+        parse_declaration(DeclarationNode_new(String_from("RET LABEL"), fn->return_type), code_sb, options);
     }
 
-    parse_statements(fn->statements, code_sb, variable_map, &variable_tos, control_id, fn->name);
+    parse_statements(fn->statements, code_sb, variable_map, &variable_tos, control_id, fn->name, options);
     StringBuilder_add_arr(code_sb, String_from("ADDR "));
     StringBuilder_add_arr(code_sb, String_from(fn->name));
     StringBuilder_add_arr(code_sb, String_from("_END\n"));
@@ -396,27 +695,103 @@ void parse_function(FunctionNode* fn, StringBuilder* code_sb, int* control_id)
     Hashmap_free(variable_map);
 }
 
-char* ast_to_nni(AST* ast) 
+// Number of instructions the functions compile to, imports and the final
+// CALL main left out
+int ast_instruction_count(AST* ast, GenOptions* options)
 {
-
-    Hashmap_Node* iter = Hashmap_get_iter(ast->functions);
     StringBuilder* code = StringBuilder_new();
-
     int control_id = 0;
+    int count = 0;
 
-    parse_imports(ast->imports, code);
+    for (Hashmap_Node* iter = Hashmap_get_iter(ast->functions); iter != NULL; iter = Hashmap_iter_next(iter))
+        parse_function((FunctionNode*)((GenericNode*)iter->val)->node, code, &control_id, options);
+
+    for (char* c = code->str; c < code->str + code->size; c++)
+        if (*c == '\n')
+            count++;
+
+    StringBuilder_free(code);
+    return count;
+}
+
+void GenOptions_init(GenOptions* options)
+{
+    options->three_address = false;
+    options->ssa = false;
+    options->typed = false;
+    options->threads = 0;
+    options->files = NULL;
+    options->modules = NULL;
+}
+
+char* ast_to_nni(AST* ast)
+{
+    GenOptions options;
+    GenOptions_init(&options);
+
+    return ast_to_nni_with_options(ast, &options);
+}
+
+void ast_imports_to_nni(AST* ast, StringBuilder* code_sb, GenOptions* options)
+{
+    parse_imports(ast->imports, code_sb, options);
+}
+
+void ast_functions_to_nni(AST* ast, StringBuilder* code_sb, int* control_id, GenOptions* options, Sink* sink)
+{
+    Hashmap_Node* iter = Hashmap_get_iter(ast->functions);
+    bool parallel = options->threads > 1 && ast->functions->size > 1;
+    FunctionNode** functions = parallel ? malloc(sizeof(FunctionNode*) * ast->functions->size) : NULL;
+    int count = 0;
 
     while(iter != NULL) {
         
         GenericNode* current_node = iter->val;
         if (current_node->type != FunctionNode_t) 
             panic("Invalid node: %i expected FunctionNode_t, report bug: https://github.com/alexburroughs/BC-2/issues", (int)current_node->type);
-        parse_function((FunctionNode*)current_node->node, code, &control_id);
+        if (parallel) {
+            functions[count++] = (FunctionNode*)current_node->node;
+        }
+        else {
+            parse_function((FunctionNode*)current_node->node, code_sb, control_id, options);
+            if (sink != NULL)
+                Sink_write_sb(sink, code_sb);
+        }
         
         iter = Hashmap_iter_next(iter);
     }
 
-    StringBuilder_add_arr(code, "CALL main");
+    if (parallel) {
+        functions_to_nni_parallel(functions, count, code_sb, control_id, options, sink);
+        free(functions);
+    }
+}
+
+void ast_to_nni_sink(AST* ast, Sink* sink, GenOptions* options)
+{
+    StringBuilder* code = StringBuilder_new();
+
+    int control_id = 0;
+
+    ast_imports_to_nni(ast, code, options);
+    Sink_write_sb(sink, code);
+    ast_functions_to_nni(ast, code, &control_id, options, sink);
+    Sink_write_str(sink, NNI_PROGRAM_END);
+
+    StringBuilder_free(code);
+}
+
+char* ast_to_nni_with_options(AST* ast, GenOptions* options)
+{
+    StringBuilder* code = StringBuilder_new();
+
+    int control_id = 0;
+
+    ast_imports_to_nni(ast, code, options);
+    ast_functions_to_nni(ast, code, &control_id, options, NULL);
+
+    StringBuilder_add_arr(code, NNI_PROGRAM_END);
     char* code_str = StringBuilder_get(code);
+    StringBuilder_free(code);
     return code_str;
 }
\ No newline at end of file
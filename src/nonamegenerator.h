@@ -1,13 +1,72 @@
 #ifndef NNIGENERATOR_H
 #define NNIGENERATOR_H
 #include "ast.h"
+#include "ir.h"
+#include "stringbuilder.h"
+#include "sink.h"
+#include "filecache.h"
+#include "modules.h"
+
+#include <stdbool.h>
+
+// Last instruction of every program
+#define NNI_PROGRAM_END "CALL main"
+
+// Operand of a three address instruction that is popped from, or pushed to, the stack
+#define STACK_OPERAND -1
 
 typedef struct variable {
     int position;
     Type type;
 } VariableObj;
 
+typedef struct gen_options {
+    // Emit slot addressed OP dst lhs rhs instructions instead of PUSH/OP/POP
+    bool three_address;
+    // Generate code through the SSA IR instead of straight from the AST
+    bool ssa;
+    // Declare slots with their exact type and emit type suffixed arithmetic
+    // (ADD_I32) where the type checker proved the operand types
+    bool typed;
+    // Functions generated at once by ast_functions_to_nni, 0 or 1 generates
+    // them one after another. The output is the same either way
+    int threads;
+    // Imported modules are read through this cache when set, then through
+    // the registry, and from disk every time when neither is
+    FileCache* files;
+    ModuleRegistry* modules;
+} GenOptions;
+
+// The options of a plain comp run, stack output without modules
+void GenOptions_init(GenOptions* options);
+
 VariableObj* Variable_new(int position, Type type);
+char* type_instruction_name(Type type);
+char* operator_instruction(OpType op);
+void add_operator(StringBuilder* code_sb, OpType op, Type type, GenOptions* options);
+void add_operand(StringBuilder* code_sb, int slot);
+Type declaration_group(Type type, GenOptions* options);
+void parse_declaration_batch(Type type, int count, StringBuilder* code_sb, GenOptions* options);
+void parse_function(FunctionNode* fn, StringBuilder* code_sb, int* control_id, GenOptions* options);
+// Builds and verifies the SSA form of a function, panics when it is invalid
+IrFunction* parse_function_ir(FunctionNode* fn);
+// Labels parse_statements numbers for the statements: one per if and else,
+// two per while. The function labels are numbered in a single sequence, so
+// this gives the first label of a function without generating the ones
+// before it
+int statements_label_count(Arraylist* statements);
 
 char* ast_to_nni(AST* ast);
+char* ast_to_nni_with_options(AST* ast, GenOptions* options);
+// Same output as ast_to_nni_with_options, written to the sink one function
+// at a time instead of being built up as one string
+void ast_to_nni_sink(AST* ast, Sink* sink, GenOptions* options);
+// The parts of ast_to_nni_with_options, for callers that generate a program
+// a piece at a time. control_id carries the label numbering across calls,
+// with a sink every function is moved from code_sb to it once generated
+void ast_imports_to_nni(AST* ast, StringBuilder* code_sb, GenOptions* options);
+// Text of the modules named in imports
+void parse_imports(Arraylist* imports, StringBuilder* code_sb, GenOptions* options);
+void ast_functions_to_nni(AST* ast, StringBuilder* code_sb, int* control_id, GenOptions* options, Sink* sink);
+int ast_instruction_count(AST* ast, GenOptions* options);
 #endif
\ No newline at end of file
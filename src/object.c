@@ -0,0 +1,282 @@
+#include "object.h"
+#include "tree.h"
+#include "stringbuilder.h"
+#include "panic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALLOC_SUBSYSTEM CodegenAlloc
+#include "alloc.h"
+
+#define OBJECT_MAGIC "NNIO 1"
+// Prefix of every label in generated code. Identifiers can not contain an
+// underscore, so outside of string literals it only ever shows up in front
+// of a label number
+#define LABEL_PREFIX "CTR_L"
+
+void relocate_labels(char* code, long size, int label_base, Sink* out)
+{
+    if (label_base == 0) {
+        Sink_write(out, code, size);
+        return;
+    }
+
+    char* end = code + size;
+    char number[16];
+    bool in_string = false;
+
+    for (char* c = code; c < end; c++) {
+        // Strings have no escapes, every quote starts or ends one
+        if (*c == '"') {
+            in_string = !in_string;
+            continue;
+        }
+        if (in_string || *c != LABEL_PREFIX[0] || end - c < (long)sizeof(LABEL_PREFIX)
+            || strncmp(c, LABEL_PREFIX, sizeof(LABEL_PREFIX) - 1) != 0)
+            continue;
+
+        char* label = c + sizeof(LABEL_PREFIX) - 1;
+        Sink_write(out, code, label - code);
+
+        long id = 0;
+        char* digits_end = label;
+        for (; digits_end < end && *digits_end >= '0' && *digits_end <= '9'; digits_end++)
+            id = id * 10 + (*digits_end - '0');
+        Sink_write(out, number, sprintf(number, "%li", id + label_base));
+        code = digits_end;
+        c = digits_end - 1;
+    }
+
+    Sink_write(out, code, end - code);
+}
+
+Arraylist* code_operands(char* code, long size, char* instruction)
+{
+    Arraylist* operands = Arraylist_new_with_size(free, 4);
+    char* end = code + size;
+    int length = strlen(instruction);
+    bool line_start = true;
+    bool in_string = false;
+
+    for (char* c = code; c < end; c++) {
+        if (line_start && !in_string && end - c > length && strncmp(c, instruction, length) == 0) {
+            char* operand = c + length;
+            char* operand_end = operand;
+            while (operand_end < end && *operand_end != ' ' && *operand_end != '\n')
+                operand_end++;
+
+            StringBuilder* sb = StringBuilder_new();
+            StringBuilder_add_n(sb, operand, operand_end - operand);
+            Arraylist_add(operands, StringBuilder_get(sb));
+            StringBuilder_free(sb);
+        }
+
+        line_start = false;
+        if (*c == '"')
+            in_string = !in_string;
+        else if (*c == '\n' && !in_string)
+            line_start = true;
+    }
+
+    return operands;
+}
+
+int object_compare_names(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Sorts the names and frees the repeated ones
+void object_sort_unique(Arraylist* names)
+{
+    qsort(names->arr, names->size, sizeof(char*), object_compare_names);
+
+    int kept = 0;
+    for (int i = 0; i < names->size; i++) {
+        if (kept > 0 && strcmp(names->arr[kept - 1], names->arr[i]) == 0)
+            free(names->arr[i]);
+        else
+            names->arr[kept++] = names->arr[i];
+    }
+    names->size = kept;
+}
+
+void ObjectFunction_free(void* ptr)
+{
+    ObjectFunction* function = ptr;
+    free(function->name);
+    free(function->code);
+    Arraylist_free(function->calls);
+    free(function);
+}
+
+ObjectFile* object_new(char* path)
+{
+    ObjectFile* object = malloc(sizeof(ObjectFile));
+    object->path = String_from(path);
+    object->imports = Arraylist_new(free);
+    object->functions = Arraylist_new(ObjectFunction_free);
+    return object;
+}
+
+ObjectFile* ObjectFile_from_ast(AST* ast, GenOptions* options)
+{
+    ObjectFile* object = object_new("");
+    StringBuilder* code = StringBuilder_new();
+
+    for (int i = 0; i < Arraylist_size(ast->imports); i++)
+        Arraylist_add(object->imports, String_from(Arraylist_get(ast->imports, i)));
+
+    for (Hashmap_Node* iter = Hashmap_get_iter(ast->functions); iter != NULL; iter = Hashmap_iter_next(iter)) {
+        FunctionNode* fn = ((GenericNode*)iter->val)->node;
+        ObjectFunction* function = malloc(sizeof(ObjectFunction));
+        function->name = String_from(fn->name);
+        function->labels = 0;
+        function->linked = false;
+
+        parse_function(fn, code, &function->labels, options);
+        function->size = code->size;
+        function->code = StringBuilder_get(code);
+        StringBuilder_clear(code);
+
+        function->calls = code_operands(function->code, function->size, "CALL ");
+        object_sort_unique(function->calls);
+        Arraylist_add(object->functions, function);
+    }
+
+    StringBuilder_free(code);
+    return object;
+}
+
+void ObjectFile_write(ObjectFile* object, Sink* out)
+{
+    char number[48];
+
+    Sink_write_str(out, OBJECT_MAGIC "\n");
+    for (int i = 0; i < Arraylist_size(object->imports); i++) {
+        Sink_write_str(out, "IMPORT ");
+        Sink_write_str(out, Arraylist_get(object->imports, i));
+        Sink_write_str(out, "\n");
+    }
+
+    for (int i = 0; i < Arraylist_size(object->functions); i++) {
+        ObjectFunction* function = Arraylist_get(object->functions, i);
+        Sink_write_str(out, "FUNCTION ");
+        Sink_write_str(out, function->name);
+        Sink_write(out, number, sprintf(number, " %i %li", function->labels, function->size));
+        for (int j = 0; j < Arraylist_size(function->calls); j++) {
+            Sink_write_str(out, " ");
+            Sink_write_str(out, Arraylist_get(function->calls, j));
+        }
+        Sink_write_str(out, "\n");
+    }
+
+    Sink_write_str(out, "CODE\n");
+    for (int i = 0; i < Arraylist_size(object->functions); i++) {
+        ObjectFunction* function = Arraylist_get(object->functions, i);
+        Sink_write(out, function->code, function->size);
+    }
+}
+
+// Next space separated word of the line, NULL at its end. Terminates it
+char* object_word(char** pos)
+{
+    while (**pos == ' ')
+        (*pos)++;
+    if (**pos == '\0')
+        return NULL;
+
+    char* word = *pos;
+    while (**pos != ' ' && **pos != '\0')
+        (*pos)++;
+    if (**pos == ' ')
+        *(*pos)++ = '\0';
+    return word;
+}
+
+ObjectFile* ObjectFile_read(char* path)
+{
+    char* data = read_file(path);
+    long size = strlen(data);
+    char* end = data + size;
+    char* pos = data;
+    ObjectFile* object = object_new(path);
+    bool header = true;
+    bool code = false;
+
+    for (int line_number = 1; pos < end && !code; line_number++) {
+        char* line_end = memchr(pos, '\n', end - pos);
+        if (line_end == NULL)
+            panic("%s: not an object file, line %i is cut off", path, line_number);
+        *line_end = '\0';
+        char* line = pos;
+        pos = line_end + 1;
+
+        if (header) {
+            if (strcmp(line, OBJECT_MAGIC) != 0)
+                panic("%s is not an object file", path);
+            header = false;
+            continue;
+        }
+
+        char* kind = object_word(&line);
+        if (kind != NULL && strcmp(kind, "CODE") == 0) {
+            code = true;
+        }
+        else if (kind != NULL && strcmp(kind, "IMPORT") == 0) {
+            char* name = object_word(&line);
+            if (name == NULL)
+                panic("%s:%i: IMPORT without a module", path, line_number);
+            Arraylist_add(object->imports, String_from(name));
+        }
+        else if (kind != NULL && strcmp(kind, "FUNCTION") == 0) {
+            char* name = object_word(&line);
+            char* labels = object_word(&line);
+            char* code_size = object_word(&line);
+            if (code_size == NULL)
+                panic("%s:%i: FUNCTION needs a name, a label count and a size", path, line_number);
+
+            ObjectFunction* function = malloc(sizeof(ObjectFunction));
+            function->name = String_from(name);
+            function->labels = atoi(labels);
+            function->size = atol(code_size);
+            function->code = NULL;
+            function->calls = Arraylist_new_with_size(free, 4);
+            function->linked = false;
+            for (char* call = object_word(&line); call != NULL; call = object_word(&line))
+                Arraylist_add(function->calls, String_from(call));
+            Arraylist_add(object->functions, function);
+        }
+        else {
+            panic("%s:%i: unknown entry %s", path, line_number, kind != NULL ? kind : "");
+        }
+    }
+
+    if (!code)
+        panic("%s: not an object file, CODE is missing", path);
+
+    for (int i = 0; i < Arraylist_size(object->functions); i++) {
+        ObjectFunction* function = Arraylist_get(object->functions, i);
+        if (function->size < 0 || function->size > end - pos)
+            panic("%s: code of %s is cut off", path, function->name);
+
+        function->code = malloc(function->size + 1);
+        memcpy(function->code, pos, function->size);
+        function->code[function->size] = '\0';
+        pos += function->size;
+    }
+
+    free(data);
+    return object;
+}
+
+void ObjectFile_free(void* ptr)
+{
+    ObjectFile* object = ptr;
+    Arraylist_free(object->imports);
+    Arraylist_free(object->functions);
+    free(object->path);
+    free(object);
+}
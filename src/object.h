@@ -0,0 +1,59 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include "arraylist.h"
+#include "ast.h"
+#include "nonamegenerator.h"
+#include "sink.h"
+
+#include <stdbool.h>
+
+// Generated code of one function in an object file, from its FS line to
+// its FE line. Its labels are numbered from 0 and moved when it is linked
+struct object_function
+{
+    char* name;
+    char* code;
+    long size;
+    int labels;
+    // char*, every function it calls, sorted. Calls to functions of other
+    // objects and modules stay unresolved until the link
+    Arraylist* calls;
+    // Set by the linker for functions main can reach
+    bool linked;
+};
+
+typedef struct object_function ObjectFunction;
+
+// A BC source compiled on its own (comp -c). The file is a symbol table
+// followed by the code of the functions in the same order:
+//
+//   NNIO 1
+//   IMPORT <module>
+//   FUNCTION <name> <labels> <code size> <called function>...
+//   CODE
+//   <code>
+struct object_file
+{
+    char* path;
+    // char*, modules the source imports, included by the link
+    Arraylist* imports;
+    // ObjectFunction*, in source order
+    Arraylist* functions;
+};
+
+typedef struct object_file ObjectFile;
+
+ObjectFile* ObjectFile_from_ast(AST* ast, GenOptions* options);
+void ObjectFile_write(ObjectFile* object, Sink* out);
+// Panics when the file is not an object file
+ObjectFile* ObjectFile_read(char* path);
+void ObjectFile_free(void* ptr);
+
+// Writes code numbered from label 0 with its labels numbered from label_base
+void relocate_labels(char* code, long size, int label_base, Sink* out);
+// char*, the first operand of every line of the code that starts with the
+// instruction, "CALL " gives the called functions
+Arraylist* code_operands(char* code, long size, char* instruction);
+
+#endif
@@ -3,9 +3,32 @@
 #include <stdarg.h>
 #include <stdlib.h>
 
+__thread PanicHandler* panic_handler = NULL;
+
+void panic_push_handler(PanicHandler* handler)
+{
+    handler->previous = panic_handler;
+    panic_handler = handler;
+}
+
+void panic_pop_handler()
+{
+    panic_handler = panic_handler->previous;
+}
+
 void panic (const char* msg, ...)
 {
     va_list args;
+
+    if (panic_handler != NULL) {
+        PanicHandler* handler = panic_handler;
+        panic_pop_handler();
+        va_start( args, msg);
+        vsnprintf( handler->message, PANIC_MESSAGE_SIZE, msg, args );
+        va_end( args );
+        longjmp(handler->env, 1);
+    }
+
     fprintf( stderr, "Error: " );
     va_start( args, msg);
     vfprintf( stderr, msg, args );
@@ -1,6 +1,8 @@
 #ifndef PANIC_H
 #define PANIC_H
 
+#include <setjmp.h>
+
 #define DEBUG_COMPILER
 
 #ifdef DEBUG_COMPILER
@@ -9,7 +11,24 @@
 #define DEBUG(x, ...) 
 #endif
 
+#define PANIC_MESSAGE_SIZE 512
+
+// Recovery point for panic. While one is pushed on a thread, a panic on that
+// thread stores its message here and longjmps to env instead of exiting
+struct panic_handler
+{
+    jmp_buf env;
+    char message[PANIC_MESSAGE_SIZE];
+    struct panic_handler* previous;
+};
+
+typedef struct panic_handler PanicHandler;
+
 void panic(const char* msg, ...);
 void debug(const char* msg, ...);
+// Handlers nest, the innermost one catches. panic pops it before jumping,
+// otherwise the code that pushed it pops it once done
+void panic_push_handler(PanicHandler* handler);
+void panic_pop_handler();
 
-#endif
\ No newline at end of file
+#endif
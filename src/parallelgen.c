@@ -0,0 +1,131 @@
+#include "parallelgen.h"
+#include "ir.h"
+#include "irlower.h"
+#include "workpool.h"
+#include "panic.h"
+
+#include <stdlib.h>
+
+#define ALLOC_SUBSYSTEM CodegenAlloc
+#include "alloc.h"
+
+// Functions handed to each thread per window. The SSA form of a window is
+// held from counting to generating, so programs are done a window at a time
+// to keep memory flat
+#define GEN_WINDOW_PER_THREAD 32
+
+struct gen_job
+{
+    FunctionNode* fn;
+    // SSA form built while counting, lowered in the second round
+    IrFunction* ir;
+    int labels;
+    int label_base;
+    StringBuilder* code;
+    // Message of a panic while working on the function
+    char* error;
+};
+
+typedef struct gen_job GenJob;
+
+struct gen_pool
+{
+    GenJob* jobs;
+    int count;
+    GenOptions* options;
+    // Round run by the workers, counting or generating
+    void (*round)(GenJob* job, GenOptions* options);
+};
+
+typedef struct gen_pool GenPool;
+
+void gen_count_labels(GenJob* job, GenOptions* options)
+{
+    if (options->ssa) {
+        job->ir = parse_function_ir(job->fn);
+        job->labels = IrFunction_prepare_lowering(job->ir);
+    }
+    else {
+        job->labels = statements_label_count(job->fn->statements);
+    }
+}
+
+void gen_function(GenJob* job, GenOptions* options)
+{
+    job->code = StringBuilder_new();
+
+    if (options->ssa) {
+        IrFunction_lower_to_nni(job->ir, job->code, job->label_base, options);
+        IrFunction_free(job->ir);
+        job->ir = NULL;
+        return;
+    }
+
+    int control_id = job->label_base;
+    parse_function(job->fn, job->code, &control_id, options);
+    if (control_id != job->label_base + job->labels)
+        panic("Label count of %s is off, report bug: https://github.com/alexburroughs/BC-2/issues", job->fn->name);
+}
+
+void gen_run_job(void* arg, int index)
+{
+    GenPool* pool = arg;
+    GenJob* job = &pool->jobs[index];
+    PanicHandler handler;
+
+    if (setjmp(handler.env) == 0) {
+        panic_push_handler(&handler);
+        pool->round(job, pool->options);
+        panic_pop_handler();
+    }
+    else {
+        job->error = String_from(handler.message);
+    }
+}
+
+void gen_run_round(GenPool* pool, void (*round)(GenJob* job, GenOptions* options), int threads)
+{
+    pool->round = round;
+    WorkPool_run(threads, pool->count, gen_run_job, pool);
+
+    for (int i = 0; i < pool->count; i++)
+        if (pool->jobs[i].error != NULL)
+            panic("%s", pool->jobs[i].error);
+}
+
+void functions_to_nni_parallel(FunctionNode** functions, int count, StringBuilder* code_sb, int* control_id, GenOptions* options, Sink* sink)
+{
+    int window = options->threads * GEN_WINDOW_PER_THREAD;
+    GenPool pool;
+    pool.jobs = malloc(sizeof(GenJob) * (count < window ? count : window));
+    pool.options = options;
+
+    for (int start = 0; start < count; start += window) {
+        pool.count = count - start < window ? count - start : window;
+
+        for (int i = 0; i < pool.count; i++) {
+            pool.jobs[i].fn = functions[start + i];
+            pool.jobs[i].ir = NULL;
+            pool.jobs[i].code = NULL;
+            pool.jobs[i].error = NULL;
+        }
+
+        gen_run_round(&pool, gen_count_labels, options->threads);
+        for (int i = 0; i < pool.count; i++) {
+            pool.jobs[i].label_base = *control_id;
+            *control_id += pool.jobs[i].labels;
+        }
+        gen_run_round(&pool, gen_function, options->threads);
+
+        for (int i = 0; i < pool.count; i++) {
+            StringBuilder* code = pool.jobs[i].code;
+            if (sink != NULL)
+                Sink_write_sb(sink, code);
+            else
+                StringBuilder_add_n(code_sb, code->str, code->size);
+            StringBuilder_free(code);
+        }
+    }
+
+    free(pool.jobs);
+}
@@ -0,0 +1,16 @@
+#ifndef PARALLELGEN_H
+#define PARALLELGEN_H
+
+#include "nonamegenerator.h"
+#include "stringbuilder.h"
+#include "sink.h"
+
+// Generates the functions on options->threads threads, each into a buffer of
+// its own. A first round counts the labels of every function so each one
+// knows where its numbering starts, then the buffers are written in order
+// and freed, a window of functions at a time,
+// so the output is byte for byte the serial one. A panic on a worker is
+// raised again on the calling thread, for the first failed function
+void functions_to_nni_parallel(FunctionNode** functions, int count, StringBuilder* code_sb, int* control_id, GenOptions* options, Sink* sink);
+
+#endif
@@ -0,0 +1,161 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "passmanager.h"
+#include "ast.h"
+#include "arraylist.h"
+#include "nonamegenerator.h"
+#include "memstat.h"
+#include "stringbuilder.h"
+#include "simplify.h"
+#include "licm.h"
+#include "cse.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define ALLOC_SUBSYSTEM PassesAlloc
+#include "alloc.h"
+
+void Pass_free(void* ptr)
+{
+    Pass* pass = (Pass*)ptr;
+    free(pass->name);
+    free(pass);
+}
+
+PassManager* PassManager_new()
+{
+    PassManager* pm = malloc(sizeof(PassManager));
+    pm->passes = Arraylist_new(Pass_free);
+    pm->stats = false;
+    return pm;
+}
+
+struct standard_pass
+{
+    char* name;
+    pass_run_t run;
+    // Lowest -O level that runs the pass
+    int level;
+};
+
+// Every pass there is, in the order they run
+struct standard_pass standard_passes[] = {
+    {"simplify", simplify_run, 1},
+    // Loop invariant code motion only pays off once expressions are in their
+    // final shape, and adds preheader statements for cse to clean up
+    {"licm", licm_run, 2},
+    {"cse", cse_run, 1},
+};
+
+#define STANDARD_PASS_COUNT (int)(sizeof(standard_passes) / sizeof(standard_passes[0]))
+
+PassManager* PassManager_standard(int level)
+{
+    PassManager* pm = PassManager_new();
+
+    for (int i = 0; i < STANDARD_PASS_COUNT; i++)
+        if (level >= standard_passes[i].level)
+            PassManager_add(pm, standard_passes[i].name, standard_passes[i].run);
+
+    return pm;
+}
+
+bool PassManager_known(char* name)
+{
+    for (int i = 0; i < STANDARD_PASS_COUNT; i++)
+        if (strcmp(standard_passes[i].name, name) == 0)
+            return true;
+    return false;
+}
+
+void PassManager_add(PassManager* pm, char* name, pass_run_t run)
+{
+    Pass* pass = malloc(sizeof(Pass));
+
+    pass->name = String_from(name);
+    pass->run = run;
+    pass->enabled = true;
+    pass->changes = 0;
+    pass->instructions_removed = 0;
+    pass->wall_ms = 0;
+    pass->allocations = 0;
+    pass->bytes = 0;
+
+    Arraylist_add(pm->passes, pass);
+}
+
+int PassManager_disable(PassManager* pm, char* name)
+{
+    for (int i = 0; i < Arraylist_size(pm->passes); i++) {
+        Pass* pass = Arraylist_get(pm->passes, i);
+        if (strcmp(pass->name, name) == 0)
+            pass->enabled = false;
+    }
+
+    return PassManager_known(name) ? 0 : -1;
+}
+
+double pass_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void PassManager_run(PassManager* pm, AST* ast, GenOptions* options)
+{
+    // Generating the code to count instructions is as slow as the passes
+    // themselves, so it only happens when the numbers are asked for
+    int instructions = pm->stats ? ast_instruction_count(ast, options) : 0;
+
+    for (int i = 0; i < Arraylist_size(pm->passes); i++) {
+        Pass* pass = Arraylist_get(pm->passes, i);
+        MemStats before;
+        MemStats after;
+
+        if (!pass->enabled)
+            continue;
+
+        MemStats_get(&before);
+        double start = pass_now_ms();
+        pass->changes += pass->run(ast);
+        pass->wall_ms += pass_now_ms() - start;
+        MemStats_get(&after);
+
+        pass->allocations += after.allocations - before.allocations;
+        pass->bytes += after.bytes - before.bytes;
+
+        if (pm->stats) {
+            int remaining = ast_instruction_count(ast, options);
+            pass->instructions_removed += instructions - remaining;
+            instructions = remaining;
+        }
+    }
+}
+
+void PassManager_print_stats(PassManager* pm, FILE* out)
+{
+    fprintf(out, "%-10s %10s %10s %10s %8s %8s\n", "pass", "wall ms", "allocs", "bytes", "changes", "removed");
+
+    for (int i = 0; i < Arraylist_size(pm->passes); i++) {
+        Pass* pass = Arraylist_get(pm->passes, i);
+
+        if (!pass->enabled) {
+            fprintf(out, "%-10s %10s\n", pass->name, "disabled");
+            continue;
+        }
+
+        fprintf(out, "%-10s %10.3f %10ld %10ld %8d %8d\n", pass->name, pass->wall_ms,
+            pass->allocations, pass->bytes, pass->changes, pass->instructions_removed);
+    }
+}
+
+void PassManager_free(PassManager* pm)
+{
+    Arraylist_free(pm->passes);
+    free(pm);
+}
@@ -0,0 +1,53 @@
+#ifndef PASSMANAGER_H
+#define PASSMANAGER_H
+
+#include "ast.h"
+#include "arraylist.h"
+#include "nonamegenerator.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define DEFAULT_OPT_LEVEL 2
+
+// A transformation of the AST, returns how many rewrites it made
+typedef int (*pass_run_t)(AST* ast);
+
+struct pass
+{
+    char* name;
+    pass_run_t run;
+    bool enabled;
+    // Filled in by PassManager_run, summed over every run
+    int changes;
+    int instructions_removed;
+    double wall_ms;
+    long allocations;
+    long bytes;
+};
+
+typedef struct pass Pass;
+
+struct pass_manager
+{
+    // Pass*, run in order
+    Arraylist* passes;
+    bool stats;
+};
+
+typedef struct pass_manager PassManager;
+
+PassManager* PassManager_new();
+// The -O<level> pipeline: 0 runs nothing, 1 the cheap local passes, 2 everything
+PassManager* PassManager_standard(int level);
+void PassManager_add(PassManager* pm, char* name, pass_run_t run);
+// Whether a pass of that name exists at any level
+bool PassManager_known(char* name);
+// Passes the level does not run are already off. Returns -1 when no pass
+// has that name
+int PassManager_disable(PassManager* pm, char* name);
+void PassManager_run(PassManager* pm, AST* ast, GenOptions* options);
+void PassManager_print_stats(PassManager* pm, FILE* out);
+void PassManager_free(PassManager* pm);
+
+#endif
@@ -0,0 +1,486 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "server.h"
+#include "tokenizer.h"
+#include "ast.h"
+#include "nonamegenerator.h"
+#include "passmanager.h"
+#include "typecheck.h"
+#include "irbuilder.h"
+#include "filecache.h"
+#include "fragcache.h"
+#include "stream.h"
+#include "sink.h"
+#include "arraylist.h"
+#include "hashmap.h"
+#include "stringbuilder.h"
+#include "panic.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define ALLOC_SUBSYSTEM OtherAlloc
+#include "alloc.h"
+
+#define SERVER_BACKLOG 16
+#define SERVER_STOP "--stop"
+// A request is a directory and arguments, each fits in a path. Limits what
+// a client can make the server allocate
+#define SERVER_MAX_ARGUMENT PATH_MAX
+#define SERVER_MAX_ARGUMENTS 4096
+// An answer holds a whole program, its size only has to leave room for the
+// terminator
+#define SERVER_MAX_ANSWER (UINT32_MAX - 1)
+// Seconds a client may stall a read or write before it is dropped, the
+// server answers one client at a time
+#define SERVER_TIMEOUT 10
+
+// Messages are made of frames, a uint32 length in native byte order and
+// that many bytes. A request is a uint32 frame count, then the working
+// directory and the arguments. An answer is a uint32 exit status, the
+// output and the error messages
+
+bool write_all(int fd, char* data, long size)
+{
+    while (size > 0) {
+        ssize_t done = write(fd, data, size);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return false;
+        data += done;
+        size -= done;
+    }
+
+    return true;
+}
+
+bool read_all(int fd, char* data, long size)
+{
+    while (size > 0) {
+        ssize_t done = read(fd, data, size);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return false;
+        data += done;
+        size -= done;
+    }
+
+    return true;
+}
+
+bool send_uint(int fd, uint32_t value)
+{
+    return write_all(fd, (char*)&value, sizeof(value));
+}
+
+bool receive_uint(int fd, uint32_t* value)
+{
+    return read_all(fd, (char*)value, sizeof(*value));
+}
+
+bool send_frame(int fd, char* data, uint32_t size)
+{
+    return send_uint(fd, size) && write_all(fd, data, size);
+}
+
+// Terminated, so frames can be used as strings. NULL when the peer is gone
+// or the frame is longer than max_size
+char* receive_frame(int fd, uint32_t* size, uint32_t max_size)
+{
+    if (!receive_uint(fd, size) || *size > max_size)
+        return NULL;
+
+    char* data = malloc((size_t)*size + 1);
+    if (data == NULL)
+        return NULL;
+    if (!read_all(fd, data, *size)) {
+        free(data);
+        return NULL;
+    }
+
+    data[*size] = '\0';
+    return data;
+}
+
+struct dependency
+{
+    char* path;
+    uint64_t hash;
+};
+
+typedef struct dependency Dependency;
+
+// Output of one file under one set of options, valid while the source and
+// every imported module still hash the same
+struct cached_result
+{
+    uint64_t source_hash;
+    // Dependency*
+    Arraylist* dependencies;
+    char* output;
+};
+
+typedef struct cached_result CachedResult;
+
+struct server
+{
+    FileCache* files;
+    // CachedResult*, by options and absolute path of the source
+    Hashmap* results;
+    // Code of single functions, for files that did change
+    FragmentCache* fragments;
+    bool stopping;
+};
+
+typedef struct server Server;
+
+struct server_request
+{
+    char* filename;
+    GenOptions options;
+    bool emit_ir;
+    int opt_level;
+    // char*, passes turned off
+    Arraylist* disabled;
+    // Every argument that changes the output, then the source path
+    StringBuilder* key;
+    // Hash of the arguments part of key
+    uint64_t options_hash;
+};
+
+typedef struct server_request ServerRequest;
+
+void Dependency_free(void* ptr)
+{
+    Dependency* dependency = ptr;
+    free(dependency->path);
+    free(dependency);
+}
+
+void CachedResult_free(void* ptr)
+{
+    CachedResult* result = ptr;
+    Arraylist_free(result->dependencies);
+    free(result->output);
+    free(result);
+}
+
+// The options a request may carry, anything that only makes sense for a
+// local compile is refused
+ServerRequest* server_parse_request(int argc, char** argv)
+{
+    ServerRequest* request = malloc(sizeof(ServerRequest));
+    request->filename = NULL;
+    GenOptions_init(&request->options);
+    request->emit_ir = false;
+    request->opt_level = DEFAULT_OPT_LEVEL;
+    request->disabled = Arraylist_new(free);
+    request->key = StringBuilder_new();
+
+    for (int i = 0; i < argc; i++) {
+        if (strncmp(argv[i], "-O", 2) == 0 && argv[i][2] >= '0' && argv[i][2] <= '9')
+            request->opt_level = atoi(argv[i] + 2);
+        else if (strncmp(argv[i], "--disable-pass=", 15) == 0)
+            Arraylist_add(request->disabled, String_from(argv[i] + 15));
+        else if (strcmp(argv[i], "--three-address") == 0)
+            request->options.three_address = true;
+        else if (strcmp(argv[i], "--typed") == 0)
+            request->options.typed = true;
+        else if (strcmp(argv[i], "--ssa") == 0)
+            request->options.ssa = true;
+        else if (strcmp(argv[i], "--emit-ir") == 0)
+            request->emit_ir = true;
+        else if (argv[i][0] == '-')
+            panic("%s is not supported with --client", argv[i]);
+        else if (request->filename != NULL)
+            panic("--client compiles one file at a time");
+        else {
+            request->filename = argv[i];
+            continue;
+        }
+
+        StringBuilder_add_arr(request->key, argv[i]);
+        StringBuilder_add(request->key, '\n');
+    }
+
+    if (request->filename == NULL)
+        panic("No file to compile");
+
+    request->options_hash = fnv1a_hash(request->key->str, request->key->size);
+    char* path = FileCache_key(request->filename);
+    StringBuilder_add_arr(request->key, path);
+    free(path);
+    return request;
+}
+
+void ServerRequest_free(ServerRequest* request)
+{
+    Arraylist_free(request->disabled);
+    StringBuilder_free(request->key);
+    free(request);
+}
+
+bool server_result_valid(Server* server, CachedResult* result, CachedFile* source)
+{
+    if (result->source_hash != source->hash)
+        return false;
+
+    for (int i = 0; i < Arraylist_size(result->dependencies); i++) {
+        Dependency* dependency = Arraylist_get(result->dependencies, i);
+        if (FileCache_get(server->files, dependency->path)->hash != dependency->hash)
+            return false;
+    }
+
+    return true;
+}
+
+// The pipeline of main, with imports read through the cache. NNI output is
+// built a function at a time, from the fragment cache where it can
+CachedResult* server_compile(Server* server, ServerRequest* request, CachedFile* source)
+{
+    PassManager* pm = PassManager_standard(request->opt_level);
+    for (int i = 0; i < Arraylist_size(request->disabled); i++)
+        if (PassManager_disable(pm, Arraylist_get(request->disabled, i)) != 0)
+            panic("Unknown pass: %s", (char*)Arraylist_get(request->disabled, i));
+
+    request->options.files = server->files;
+    uint64_t source_hash = source->hash;
+    Arraylist* imports = Arraylist_new(free);
+    Sink* out = Sink_memory();
+
+    if (request->emit_ir) {
+        Arraylist* tokens = tokenize(source->content);
+        AST* ast = AST_from(tokens);
+        PassManager_run(pm, ast, &request->options);
+        typecheck_run(ast);
+
+        char* dump = AST_dump_ir(ast);
+        Sink_write_str(out, dump);
+        free(dump);
+
+        for (int i = 0; i < Arraylist_size(ast->imports); i++)
+            Arraylist_add(imports, String_from(Arraylist_get(ast->imports, i)));
+        AST_free(ast);
+        Arraylist_free(tokens);
+    }
+    else {
+        compile_incremental(source->content, pm, &request->options, request->options_hash, server->fragments, out, imports);
+        Sink_write_str(out, "\n");
+    }
+
+    CachedResult* result = malloc(sizeof(CachedResult));
+    result->source_hash = source_hash;
+    result->dependencies = Arraylist_new(Dependency_free);
+    result->output = Sink_memory_get(out);
+
+    for (int i = 0; i < Arraylist_size(imports); i++) {
+        StringBuilder* sb = StringBuilder_new();
+        StringBuilder_add_arr(sb, Arraylist_get(imports, i));
+        StringBuilder_add_arr(sb, ".nnivm");
+        char* path = StringBuilder_get(sb);
+
+        Dependency* dependency = malloc(sizeof(Dependency));
+        dependency->path = FileCache_key(path);
+        dependency->hash = FileCache_get(server->files, path)->hash;
+        Arraylist_add(result->dependencies, dependency);
+
+        free(path);
+        StringBuilder_free(sb);
+    }
+
+    Sink_free(out);
+    Arraylist_free(imports);
+    PassManager_free(pm);
+    return result;
+}
+
+// Sets the exit status and output of a request, the output stays owned by
+// the result cache. A panic becomes the error message of the answer
+void server_answer(Server* server, int argc, char** argv, uint32_t* status, char** output, StringBuilder* errors)
+{
+    PanicHandler handler;
+
+    if (setjmp(handler.env) != 0) {
+        *status = 1;
+        StringBuilder_add_arr(errors, "Error: ");
+        StringBuilder_add_arr(errors, handler.message);
+        StringBuilder_add(errors, '\n');
+        return;
+    }
+
+    panic_push_handler(&handler);
+
+    if (chdir(argv[0]) != 0)
+        panic("Could not change to %s: %s", argv[0], strerror(errno));
+
+    ServerRequest* request = server_parse_request(argc - 1, argv + 1);
+    CachedFile* source = FileCache_get(server->files, request->filename);
+    char* key = StringBuilder_get(request->key);
+    CachedResult* result = Hashmap_get(server->results, key);
+
+    if (result == NULL || !server_result_valid(server, result, source)) {
+        result = server_compile(server, request, source);
+        Hashmap_insert_or_set(server->results, key, result);
+    }
+
+    *status = 0;
+    *output = result->output;
+    free(key);
+    ServerRequest_free(request);
+    panic_pop_handler();
+}
+
+// Reads one request from the client and answers it
+void server_serve(Server* server, int client)
+{
+    uint32_t count;
+    if (!receive_uint(client, &count) || count == 0 || count > SERVER_MAX_ARGUMENTS)
+        return;
+
+    char** argv = calloc(count, sizeof(char*));
+    uint32_t size;
+    bool received = true;
+    for (uint32_t i = 0; i < count && received; i++)
+        received = (argv[i] = receive_frame(client, &size, SERVER_MAX_ARGUMENT)) != NULL;
+
+    if (received) {
+        uint32_t status = 0;
+        char* output = "";
+        StringBuilder* errors = StringBuilder_new();
+
+        if (count == 2 && strcmp(argv[1], SERVER_STOP) == 0)
+            server->stopping = true;
+        else
+            server_answer(server, count, argv, &status, &output, errors);
+
+        // A client that went away is not the server's problem
+        if (send_uint(client, status) && send_frame(client, output, strlen(output)))
+            send_frame(client, errors->str, errors->size);
+        StringBuilder_free(errors);
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+        free(argv[i]);
+    free(argv);
+}
+
+int server_socket(char* socket_path, struct sockaddr_un* addr)
+{
+    if (strlen(socket_path) >= sizeof(addr->sun_path))
+        panic("Socket path is too long: %s", socket_path);
+
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        panic("Could not create a socket: %s", strerror(errno));
+    return fd;
+}
+
+int server_run(char* socket_path)
+{
+    // Requests change the working directory, the socket is removed at the end
+    char* path = FileCache_key(socket_path);
+    struct sockaddr_un addr;
+    int fd = server_socket(path, &addr);
+
+    // Left behind by a server that was killed
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SERVER_BACKLOG) != 0)
+        panic("Could not listen on %s: %s", path, strerror(errno));
+    signal(SIGPIPE, SIG_IGN);
+
+    Server server;
+    server.files = FileCache_new();
+    server.results = Hashmap_new(CachedResult_free);
+    server.fragments = FragmentCache_new();
+    server.stopping = false;
+
+    while (!server.stopping) {
+        int client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            panic("Could not accept a connection: %s", strerror(errno));
+        }
+
+        struct timeval timeout = { SERVER_TIMEOUT, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        server_serve(&server, client);
+        close(client);
+    }
+
+    close(fd);
+    unlink(path);
+    free(path);
+    FileCache_free(server.files);
+    Hashmap_free(server.results);
+    FragmentCache_free(server.fragments);
+    return 0;
+}
+
+int client_run(char* socket_path, int argc, char** argv)
+{
+    struct sockaddr_un addr;
+    int fd = server_socket(socket_path, &addr);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+        panic("Could not connect to %s: %s", socket_path, strerror(errno));
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+        panic("Could not get the working directory: %s", strerror(errno));
+
+    // -o is written here, the server only sends the output back
+    char* output = NULL;
+    uint32_t count = 1;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else
+            count++;
+    }
+
+    bool sent = send_uint(fd, count) && send_frame(fd, cwd, strlen(cwd));
+    for (int i = 0; i < argc && sent; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            i++;
+        else
+            sent = send_frame(fd, argv[i], strlen(argv[i]));
+    }
+
+    uint32_t status, output_size, errors_size;
+    char* code = NULL;
+    char* errors = NULL;
+    if (!sent || !receive_uint(fd, &status)
+        || (code = receive_frame(fd, &output_size, SERVER_MAX_ANSWER)) == NULL
+        || (errors = receive_frame(fd, &errors_size, SERVER_MAX_ANSWER)) == NULL)
+        panic("Lost the connection to %s", socket_path);
+    close(fd);
+
+    fputs(errors, stderr);
+    if (status == 0 && !(argc == 1 && strcmp(argv[0], SERVER_STOP) == 0)) {
+        Sink* out = output != NULL ? Sink_file(output) : Sink_fd(STDOUT_FILENO);
+        Sink_write(out, code, output_size);
+        Sink_free(out);
+    }
+
+    free(code);
+    free(errors);
+    return status;
+}
@@ -0,0 +1,16 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// comp --server <socket> stays up and compiles for comp --client <socket>
+// <arguments>, one request at a time. Sources and imported modules are kept
+// in a FileCache and every output in a result cache; a request for a file
+// that did not change, with imports that did not change, under the same
+// options is answered without compiling. Otherwise only the functions whose
+// source changed are compiled again, see compile_incremental
+int server_run(char* socket_path);
+// Sends the working directory and the arguments, all but -o, to the server
+// and writes the answer the way a local compile would. --stop shuts the
+// server down. Returns the exit status
+int client_run(char* socket_path, int argc, char** argv);
+
+#endif
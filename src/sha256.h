@@ -0,0 +1,26 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+
+// 256 bit digest in hex and its terminator
+#define SHA256_HEX_SIZE 65
+
+// SHA-256 over data given in pieces, for keys no two inputs may share
+struct sha256
+{
+    uint32_t state[8];
+    // Bytes added so far
+    uint64_t length;
+    unsigned char block[64];
+    int used;
+};
+
+typedef struct sha256 Sha256;
+
+void Sha256_init(Sha256* sha);
+void Sha256_add(Sha256* sha, char* data, long size);
+// Digest of everything added, the state is used up
+void Sha256_hex(Sha256* sha, char hex[SHA256_HEX_SIZE]);
+
+#endif
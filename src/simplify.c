@@ -0,0 +1,466 @@
+#include "simplify.h"
+#include "ast.h"
+#include "tree.h"
+#include "type.h"
+#include "hashmap.h"
+#include "arraylist.h"
+#include "stringbuilder.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ALLOC_SUBSYSTEM PassesAlloc
+#include "alloc.h"
+
+// Void_t never describes a value, so it marks operands of unknown type
+#define UNKNOWN_TYPE Void_t
+
+#define IS_INTEGER_TYPE(type) \
+(type <= U8_t)
+
+#define IS_UNSIGNED_TYPE(type) \
+(type >= U64_t && type <= U8_t)
+
+struct simplify_tree
+{
+    GenericNode* node;
+    struct simplify_tree* left;
+    struct simplify_tree* right;
+    Type type;
+    bool pure;
+};
+
+typedef struct simplify_tree SimplifyTree;
+
+void simplify_declare(Hashmap* types, char* name, Type type)
+{
+    if (Hashmap_get(types, name) != NULL)
+        return;
+
+    Type* t = malloc(sizeof(Type));
+    *t = type;
+    Hashmap_insert(types, name, t);
+}
+
+void simplify_collect_types(Arraylist* statements, Hashmap* types)
+{
+    for (int i = 0; i < Arraylist_size(statements); i++) {
+        GenericNode* gn = Arraylist_get(statements, i);
+
+        switch (gn->type) {
+        case DeclarationNode_t:
+            simplify_declare(types, ((DeclarationNode*)gn->node)->name, ((DeclarationNode*)gn->node)->type);
+            break;
+        case IfNode_t:
+            simplify_collect_types(((IfNode*)gn->node)->statements, types);
+            break;
+        case ElseNode_t:
+            simplify_collect_types(((ElseNode*)gn->node)->statements, types);
+            break;
+        case WhileNode_t:
+            simplify_collect_types(((WhileNode*)gn->node)->statements, types);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Only integer literals fold, floats and strings are left alone
+bool simplify_literal_value(SimplifyTree* tree, int64_t* value)
+{
+    if (tree->node->type != LiteralNode_t)
+        return false;
+
+    LiteralNode* ln = (LiteralNode*)tree->node->node;
+    if (ln->type == Char_t || ln->value.is_float)
+        return false;
+
+    *value = ln->value.as.i;
+    return true;
+}
+
+bool simplify_is_literal(SimplifyTree* tree, int64_t value)
+{
+    int64_t v;
+    return simplify_literal_value(tree, &v) && v == value;
+}
+
+// Returns k if value is 2^k with k > 0, -1 otherwise
+int simplify_log2(SimplifyTree* tree)
+{
+    int64_t v;
+    if (!simplify_literal_value(tree, &v) || v < 2 || (v & (v-1)) != 0)
+        return -1;
+
+    int k = 0;
+    while (v > 1) {
+        v >>= 1;
+        k++;
+    }
+    return k;
+}
+
+GenericNode* simplify_new_literal(int64_t value)
+{
+    NumberValue number;
+    number.is_float = false;
+    number.as.i = value;
+    return GenericNode_new(LiteralNode_t, LiteralNode_new_number(number));
+}
+
+// Width in bits of an integer type
+int simplify_type_bits(Type type)
+{
+    switch (type) {
+    case I64_t: case U64_t: return 64;
+    case I32_t: case U32_t: return 32;
+    case I16_t: case U16_t: return 16;
+    default: return 8;
+    }
+}
+
+bool simplify_fits(int64_t value, Type type)
+{
+    int bits = simplify_type_bits(type);
+    if (IS_UNSIGNED_TYPE(type))
+        return value >= 0 && (bits == 64 || value < ((int64_t)1 << bits));
+    return bits == 64 || (value >= -((int64_t)1 << (bits-1)) && value < ((int64_t)1 << (bits-1)));
+}
+
+// Wraps value around to the width of type, the way the VM stores it
+int64_t simplify_wrap(int64_t value, Type type)
+{
+    int bits = simplify_type_bits(type);
+    if (bits == 64)
+        return value;
+
+    int64_t low = (int64_t)((uint64_t)value & (((uint64_t)1 << bits) - 1));
+    if (!IS_UNSIGNED_TYPE(type) && low >= ((int64_t)1 << (bits-1)))
+        low -= (int64_t)1 << bits;
+    return low;
+}
+
+// Folds a op b for integer literals of type into result. Does not fold
+// what the compiler itself can not compute: operands out of the range of
+// type, results out of the range of int64 and divisions that trap
+bool simplify_fold(OpType op, int64_t a, int64_t b, Type type, int64_t* result)
+{
+    if (!IS_INTEGER_TYPE(type) || !simplify_fits(a, type) || !simplify_fits(b, type))
+        return false;
+
+    switch (op) {
+    case Add_t:
+        if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b))
+            return false;
+        *result = a + b;
+        break;
+    case Sub_t:
+        if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b))
+            return false;
+        *result = a - b;
+        break;
+    case Mul_t:
+        if (a != 0 && b != 0 && (a > 0 ? (b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a)
+                                       : (b > 0 ? a < INT64_MIN / b : a < INT64_MAX / b)))
+            return false;
+        *result = a * b;
+        break;
+    case Div_t:
+        // The smallest value divided by -1 does not fit its type, the
+        // division traps
+        if (b == 0 || (b == -1 && (a == INT64_MIN || !simplify_fits(-a, type))))
+            return false;
+        *result = a / b;
+        break;
+    case Mod_t:
+        if (b == 0 || (b == -1 && (a == INT64_MIN || !simplify_fits(-a, type))))
+            return false;
+        *result = a % b;
+        break;
+    default:
+        return false;
+    }
+
+    // An unsigned 64 bit result below zero is above what int64 holds
+    if (simplify_type_bits(type) == 64 && !simplify_fits(*result, type))
+        return false;
+
+    *result = simplify_wrap(*result, type);
+    return true;
+}
+
+// Literal operands take the type of the other side, like in C
+Type simplify_result_type(SimplifyTree* left, SimplifyTree* right)
+{
+    bool left_literal = left->node->type == LiteralNode_t;
+    bool right_literal = right->node->type == LiteralNode_t;
+
+    if (left_literal && !right_literal)
+        return right->type;
+    if (right_literal && !left_literal)
+        return left->type;
+    if (left->type == UNKNOWN_TYPE || right->type == UNKNOWN_TYPE)
+        return UNKNOWN_TYPE;
+    if (!IS_INTEGER_TYPE(left->type) || !IS_INTEGER_TYPE(right->type))
+        return F64_t;
+    if (IS_UNSIGNED_TYPE(left->type))
+        return left->type;
+    return right->type;
+}
+
+SimplifyTree* simplify_tree_new(GenericNode* gn, Type type)
+{
+    SimplifyTree* tree = malloc(sizeof(SimplifyTree));
+    tree->node = gn;
+    tree->left = NULL;
+    tree->right = NULL;
+    tree->type = type;
+    tree->pure = gn->type != CallNode_t;
+    return tree;
+}
+
+void simplify_tree_free(SimplifyTree* tree)
+{
+    if (tree == NULL)
+        return;
+
+    simplify_tree_free(tree->left);
+    simplify_tree_free(tree->right);
+    if (tree->node)
+        GenericNode_free(tree->node);
+    free(tree);
+}
+
+// Replaces tree by one of its children, keeping the child's nodes
+SimplifyTree* simplify_take(SimplifyTree* tree, SimplifyTree* child)
+{
+    if (tree->left == child)
+        tree->left = NULL;
+    else
+        tree->right = NULL;
+
+    simplify_tree_free(tree);
+    return child;
+}
+
+SimplifyTree* simplify_replace(SimplifyTree* tree, GenericNode* gn, Type type)
+{
+    simplify_tree_free(tree);
+    return simplify_tree_new(gn, type);
+}
+
+void simplify_set_op(SimplifyTree* tree, OpType op, int64_t operand)
+{
+    ((OperatorNode*)tree->node->node)->op_t = op;
+    simplify_tree_free(tree->right);
+    tree->right = simplify_tree_new(simplify_new_literal(operand), I32_t);
+}
+
+SimplifyTree* simplify_tree(SimplifyTree* tree, int* rewrites)
+{
+    if (tree->node->type != OperatorNode_t || tree->left == NULL)
+        return tree;
+
+    SimplifyTree* left = tree->left = simplify_tree(tree->left, rewrites);
+    SimplifyTree* right = tree->right = simplify_tree(tree->right, rewrites);
+    OpType op = ((OperatorNode*)tree->node->node)->op_t;
+    int64_t a, b;
+    int k;
+
+    tree->pure = left->pure && right->pure;
+    tree->type = simplify_result_type(left, right);
+
+    if (simplify_literal_value(left, &a) && simplify_literal_value(right, &b)
+        && simplify_fold(op, a, b, tree->type, &a)) {
+        (*rewrites)++;
+        return simplify_replace(tree, simplify_new_literal(a), tree->type);
+    }
+
+    switch (op) {
+    case Add_t:
+        if (simplify_is_literal(right, 0)) {
+            (*rewrites)++;
+            return simplify_take(tree, left);
+        }
+        if (simplify_is_literal(left, 0)) {
+            (*rewrites)++;
+            return simplify_take(tree, right);
+        }
+        break;
+    case Sub_t:
+        if (simplify_is_literal(right, 0)) {
+            (*rewrites)++;
+            return simplify_take(tree, left);
+        }
+        break;
+    case Mul_t:
+        if (simplify_is_literal(right, 1)) {
+            (*rewrites)++;
+            return simplify_take(tree, left);
+        }
+        if (simplify_is_literal(left, 1)) {
+            (*rewrites)++;
+            return simplify_take(tree, right);
+        }
+        if (!IS_INTEGER_TYPE(tree->type))
+            break;
+        if ((simplify_is_literal(right, 0) || simplify_is_literal(left, 0)) && tree->pure) {
+            (*rewrites)++;
+            return simplify_replace(tree, simplify_new_literal(0), tree->type);
+        }
+        // Shifting left is a multiplication for signed and unsigned alike
+        if ((k = simplify_log2(right)) > 0) {
+            (*rewrites)++;
+            simplify_set_op(tree, Shl_t, k);
+        }
+        else if ((k = simplify_log2(left)) > 0) {
+            (*rewrites)++;
+            tree->left = tree->right;
+            tree->right = left;
+            simplify_set_op(tree, Shl_t, k);
+        }
+        break;
+    case Div_t:
+        if (simplify_is_literal(right, 1)) {
+            (*rewrites)++;
+            return simplify_take(tree, left);
+        }
+        // Signed division rounds towards zero, a shift would round down
+        if (IS_UNSIGNED_TYPE(tree->type) && (k = simplify_log2(right)) > 0) {
+            (*rewrites)++;
+            simplify_set_op(tree, Shr_t, k);
+        }
+        break;
+    case Mod_t:
+        if (!IS_INTEGER_TYPE(tree->type))
+            break;
+        if (simplify_is_literal(right, 1) && tree->pure) {
+            (*rewrites)++;
+            return simplify_replace(tree, simplify_new_literal(0), tree->type);
+        }
+        if (IS_UNSIGNED_TYPE(tree->type) && (k = simplify_log2(right)) > 0) {
+            (*rewrites)++;
+            simplify_set_op(tree, BitAnd_t, ((int64_t)1 << k) - 1);
+        }
+        break;
+    default:
+        break;
+    }
+
+    return tree;
+}
+
+void simplify_flatten(SimplifyTree* tree, Arraylist* nodes)
+{
+    if (tree->left)
+        simplify_flatten(tree->left, nodes);
+    if (tree->right)
+        simplify_flatten(tree->right, nodes);
+
+    Arraylist_add(nodes, tree->node);
+    tree->node = NULL;
+}
+
+Type simplify_leaf_type(GenericNode* gn, Hashmap* types)
+{
+    Type* type;
+    LiteralNode* ln;
+
+    switch (gn->type) {
+    case VariableNode_t:
+        type = Hashmap_get(types, ((VariableNode*)gn->node)->name);
+        return type ? *type : UNKNOWN_TYPE;
+    case LiteralNode_t:
+        ln = (LiteralNode*)gn->node;
+        return ln->type;
+    default:
+        return UNKNOWN_TYPE;
+    }
+}
+
+void simplify_expression(ExpressionNode* en, Hashmap* types, int* rewrites)
+{
+    int size = Arraylist_size(en->nodes);
+    if (size < 3)
+        return;
+
+    SimplifyTree** stack = malloc(sizeof(SimplifyTree*) * size);
+    int top = 0;
+
+    for (int i = 0; i < size; i++) {
+        GenericNode* gn = Arraylist_get(en->nodes, i);
+        SimplifyTree* tree = simplify_tree_new(gn, simplify_leaf_type(gn, types));
+
+        if (gn->type == OperatorNode_t) {
+            if (((OperatorNode*)gn->node)->op_t == Not_t) {
+                tree->right = stack[--top];
+            }
+            else {
+                tree->right = stack[--top];
+                tree->left = stack[--top];
+            }
+        }
+        stack[top++] = tree;
+    }
+
+    SimplifyTree* root = simplify_tree(stack[0], rewrites);
+    free(stack);
+
+    // The nodes now belong to the tree, empty the list without freeing them
+    en->nodes->size = 0;
+    simplify_flatten(root, en->nodes);
+    simplify_tree_free(root);
+}
+
+void simplify_block(Arraylist* statements, Hashmap* types, int* rewrites)
+{
+    for (int i = 0; i < Arraylist_size(statements); i++) {
+        GenericNode* gn = Arraylist_get(statements, i);
+
+        switch (gn->type) {
+        case AssignmentNode_t:
+            simplify_expression(((AssignmentNode*)gn->node)->right, types, rewrites);
+            break;
+        case IfNode_t:
+            simplify_expression(((IfNode*)gn->node)->condition, types, rewrites);
+            simplify_block(((IfNode*)gn->node)->statements, types, rewrites);
+            break;
+        case ElseNode_t:
+            simplify_block(((ElseNode*)gn->node)->statements, types, rewrites);
+            break;
+        case WhileNode_t:
+            simplify_expression(((WhileNode*)gn->node)->condition, types, rewrites);
+            simplify_block(((WhileNode*)gn->node)->statements, types, rewrites);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+int simplify_run(AST* ast)
+{
+    int rewrites = 0;
+
+    for (Hashmap_Node* iter = Hashmap_get_iter(ast->functions); iter != NULL; iter = Hashmap_iter_next(iter)) {
+        GenericNode* gn = iter->val;
+        if (gn->type != FunctionNode_t)
+            continue;
+
+        FunctionNode* fn = (FunctionNode*)gn->node;
+        Hashmap* types = Hashmap_new(free);
+
+        for (int i = 0; i < Arraylist_size(fn->args); i++) {
+            VariableNode* arg = Arraylist_get(fn->args, i);
+            simplify_declare(types, arg->name, arg->type);
+        }
+        simplify_collect_types(fn->statements, types);
+        simplify_block(fn->statements, types, &rewrites);
+
+        Hashmap_free(types);
+    }
+
+    return rewrites;
+}
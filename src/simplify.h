@@ -0,0 +1,17 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include "ast.h"
+#include "type.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Folds integer constants, removes identity operations and turns
+// multiplications, unsigned divisions and unsigned modulus by powers of two
+// into shifts and masks, returns the number of rewrites
+int simplify_run(AST* ast);
+// Whether the integer type holds value
+bool simplify_fits(int64_t value, Type type);
+
+#endif
@@ -0,0 +1,140 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "sink.h"
+#include "stringbuilder.h"
+#include "panic.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define ALLOC_SUBSYSTEM OtherAlloc
+#include "alloc.h"
+
+Sink* sink_new(SinkKind kind, int fd, bool owns_fd)
+{
+    Sink* sink = malloc(sizeof(Sink));
+    sink->kind = kind;
+    sink->fd = fd;
+    sink->owns_fd = owns_fd;
+    sink->buffer = kind == FdSink ? malloc(SINK_BUFFER_SIZE) : NULL;
+    sink->used = 0;
+    sink->memory = kind == MemorySink ? StringBuilder_new() : NULL;
+    sink->written = 0;
+    return sink;
+}
+
+Sink* Sink_fd(int fd)
+{
+    return sink_new(FdSink, fd, false);
+}
+
+Sink* Sink_file(char* path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        panic("Could not open %s: %s", path, strerror(errno));
+
+    return sink_new(FdSink, fd, true);
+}
+
+Sink* Sink_memory()
+{
+    return sink_new(MemorySink, -1, false);
+}
+
+// Writes every byte of the vectors, write may stop early or be interrupted
+void sink_writev_all(Sink* sink, struct iovec* iov, int count)
+{
+    while (count > 0) {
+        ssize_t done = writev(sink->fd, iov, count);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            panic("Could not write output: %s", strerror(errno));
+        }
+
+        while (count > 0 && (size_t)done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+}
+
+void Sink_write(Sink* sink, char* data, long size)
+{
+    sink->written += size;
+
+    if (sink->kind == MemorySink) {
+        StringBuilder_add_n(sink->memory, data, size);
+        return;
+    }
+
+    if (sink->used + size <= SINK_BUFFER_SIZE) {
+        memcpy(sink->buffer + sink->used, data, size);
+        sink->used += size;
+        return;
+    }
+
+    // Does not fit, the buffer and the data go out in one call instead of
+    // being copied together first
+    struct iovec iov[2];
+    iov[0].iov_base = sink->buffer;
+    iov[0].iov_len = sink->used;
+    iov[1].iov_base = data;
+    iov[1].iov_len = size;
+    sink_writev_all(sink, iov, 2);
+    sink->used = 0;
+}
+
+void Sink_write_str(Sink* sink, char* str)
+{
+    Sink_write(sink, str, strlen(str));
+}
+
+void Sink_write_sb(Sink* sink, StringBuilder* sb)
+{
+    Sink_write(sink, sb->str, sb->size);
+    StringBuilder_clear(sb);
+}
+
+void Sink_flush(Sink* sink)
+{
+    if (sink->kind != FdSink || sink->used == 0)
+        return;
+
+    struct iovec iov;
+    iov.iov_base = sink->buffer;
+    iov.iov_len = sink->used;
+    sink_writev_all(sink, &iov, 1);
+    sink->used = 0;
+}
+
+char* Sink_memory_get(Sink* sink)
+{
+    if (sink->kind != MemorySink)
+        panic("Sink_memory_get on a sink that is not in memory");
+
+    return StringBuilder_get(sink->memory);
+}
+
+void Sink_free(Sink* sink)
+{
+    Sink_flush(sink);
+
+    if (sink->owns_fd && close(sink->fd) != 0)
+        panic("Could not write output: %s", strerror(errno));
+    if (sink->memory != NULL)
+        StringBuilder_free(sink->memory);
+
+    free(sink->buffer);
+    free(sink);
+}
@@ -0,0 +1,52 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include "stringbuilder.h"
+
+#include <stdbool.h>
+
+// Output is collected in a buffer of this size and written out in blocks
+#define SINK_BUFFER_SIZE 65536
+
+enum sink_kind
+{
+    // Buffered writes to a file descriptor
+    FdSink,
+    // Everything kept in a StringBuilder
+    MemorySink
+};
+
+typedef enum sink_kind SinkKind;
+
+// Where generated code goes. The emitter writes to it as it goes, so the
+// output never has to exist as one string
+struct sink
+{
+    SinkKind kind;
+    int fd;
+    // Closed by Sink_free, for sinks opened on a path
+    bool owns_fd;
+    char* buffer;
+    int used;
+    StringBuilder* memory;
+    long written;
+};
+
+typedef struct sink Sink;
+
+Sink* Sink_fd(int fd);
+// Creates or truncates the file, panics when it can not be opened
+Sink* Sink_file(char* path);
+Sink* Sink_memory();
+
+void Sink_write(Sink* sink, char* data, long size);
+void Sink_write_str(Sink* sink, char* str);
+// Writes the contents of the StringBuilder and clears it
+void Sink_write_sb(Sink* sink, StringBuilder* sb);
+void Sink_flush(Sink* sink);
+// Copy of everything written to a memory sink
+char* Sink_memory_get(Sink* sink);
+// Flushes, closes the file of Sink_file and frees the sink
+void Sink_free(Sink* sink);
+
+#endif
@@ -0,0 +1,73 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "spscqueue.h"
+
+#include <stdlib.h>
+#include <sched.h>
+
+#define ALLOC_SUBSYSTEM ContainersAlloc
+#include "alloc.h"
+
+// Failed tries before a waiting side gives up its core
+#define SPSC_SPINS 64
+
+SpscQueue* SpscQueue_new(size_t capacity)
+{
+    SpscQueue* queue = malloc(sizeof(SpscQueue));
+    queue->capacity = 1;
+    while (queue->capacity < capacity)
+        queue->capacity <<= 1;
+
+    queue->items = malloc(sizeof(void*) * queue->capacity);
+    queue->head = 0;
+    queue->tail = 0;
+    return queue;
+}
+
+bool SpscQueue_try_push(SpscQueue* queue, void* item)
+{
+    size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    if (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == queue->capacity)
+        return false;
+
+    queue->items[tail & (queue->capacity - 1)] = item;
+    // Publishes the item together with the index
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool SpscQueue_try_pop(SpscQueue* queue, void** item)
+{
+    size_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    *item = queue->items[head & (queue->capacity - 1)];
+    // The slot may be reused once the producer sees the new head
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void SpscQueue_push(SpscQueue* queue, void* item)
+{
+    for (int spins = 0; !SpscQueue_try_push(queue, item); spins++)
+        if (spins >= SPSC_SPINS)
+            sched_yield();
+}
+
+void* SpscQueue_pop(SpscQueue* queue)
+{
+    void* item;
+
+    for (int spins = 0; !SpscQueue_try_pop(queue, &item); spins++)
+        if (spins >= SPSC_SPINS)
+            sched_yield();
+
+    return item;
+}
+
+void SpscQueue_free(SpscQueue* queue)
+{
+    free(queue->items);
+    free(queue);
+}
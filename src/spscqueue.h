@@ -0,0 +1,36 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bounded ring buffer between exactly one producer thread and one consumer
+// thread. Each side only writes its own index, so no lock is needed; a side
+// that has to wait spins a little and then yields its core
+struct spsc_queue
+{
+    void** items;
+    // Power of two, indices are masked instead of wrapped
+    size_t capacity;
+    // Written by the consumer only. The padding keeps the two indices on
+    // separate cache lines
+    size_t head;
+    char head_pad[64 - sizeof(size_t)];
+    // Written by the producer only
+    size_t tail;
+    char tail_pad[64 - sizeof(size_t)];
+};
+
+typedef struct spsc_queue SpscQueue;
+
+// capacity is rounded up to a power of two
+SpscQueue* SpscQueue_new(size_t capacity);
+bool SpscQueue_try_push(SpscQueue* queue, void* item);
+bool SpscQueue_try_pop(SpscQueue* queue, void** item);
+// Wait until there is room or an item
+void SpscQueue_push(SpscQueue* queue, void* item);
+void* SpscQueue_pop(SpscQueue* queue);
+// Items still in the queue are not freed
+void SpscQueue_free(SpscQueue* queue);
+
+#endif
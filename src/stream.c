@@ -0,0 +1,314 @@
+#include "stream.h"
+#include "tokenizer.h"
+#include "ast.h"
+#include "arraylist.h"
+#include "stringbuilder.h"
+#include "typecheck.h"
+#include "irbuilder.h"
+#include "spscqueue.h"
+#include "memstat.h"
+#include "panic.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#define ALLOC_SUBSYSTEM OtherAlloc
+#include "alloc.h"
+
+// Generates one chunk of the program into out
+void stream_generate(AST* ast, StringBuilder* code_sb, int* control_id, GenOptions* options, bool emit_ir, Sink* out)
+{
+    if (emit_ir) {
+        char* dump = AST_dump_ir(ast);
+        Sink_write_str(out, dump);
+        free(dump);
+        return;
+    }
+
+    ast_imports_to_nni(ast, code_sb, options);
+    Sink_write_sb(out, code_sb);
+    ast_functions_to_nni(ast, code_sb, control_id, options, out);
+}
+
+void compile_stream(char* source, PassManager* pm, GenOptions* options, bool emit_ir, TimeReport* report, Sink* out)
+{
+    Lexer* lexer = Lexer_new(source);
+    StringBuilder* code = StringBuilder_new();
+    int control_id = 0;
+    bool first = true;
+
+    while (true) {
+        TimeReport_start(report, "lex");
+        Arraylist* tokens = Lexer_next_function(lexer);
+        if (tokens == NULL)
+            break;
+        report->tokens += Arraylist_size(tokens);
+
+        TimeReport_start(report, "parse");
+        AST* ast = AST_from(tokens);
+        if (!first && Arraylist_size(ast->imports) > 0)
+            panic("Imports must come before the first function");
+        first = false;
+
+        TimeReport_start(report, "passes");
+        PassManager_run(pm, ast, options);
+
+        TimeReport_start(report, "typecheck");
+        typecheck_run(ast);
+
+        TimeReport_start(report, "codegen");
+        stream_generate(ast, code, &control_id, options, emit_ir, out);
+
+        TimeReport_start(report, "free");
+        AST_free(ast);
+        Arraylist_free(tokens);
+    }
+
+    if (!emit_ir)
+        Sink_write_str(out, NNI_PROGRAM_END);
+    TimeReport_stop(report);
+
+    StringBuilder_free(code);
+    Lexer_free(lexer);
+}
+
+// Functions in flight between two stages
+#define PIPELINE_QUEUE_SIZE 16
+
+// One function on its way down the pipeline. A stage that fails passes its
+// message on instead, so errors come out in source order like in the
+// serial modes
+struct pipeline_item
+{
+    Arraylist* tokens;
+    AST* ast;
+    char* error;
+};
+
+typedef struct pipeline_item PipelineItem;
+
+struct pipeline
+{
+    Lexer* lexer;
+    PassManager* pm;
+    GenOptions* options;
+    bool emit_ir;
+    bool first;
+    // Lexer to parser, and parser to code generator. NULL ends the stream
+    SpscQueue* tokens;
+    SpscQueue* trees;
+    long token_count;
+    StringBuilder* code;
+    int control_id;
+    Sink* out;
+    // Set once any stage failed, the lexer stops early
+    bool cancelled;
+};
+
+typedef struct pipeline Pipeline;
+
+void pipeline_lex(Pipeline* pipeline, PipelineItem* item)
+{
+    item->tokens = Lexer_next_function(pipeline->lexer);
+}
+
+void pipeline_front(Pipeline* pipeline, PipelineItem* item)
+{
+    item->ast = AST_from(item->tokens);
+    if (!pipeline->first && Arraylist_size(item->ast->imports) > 0)
+        panic("Imports must come before the first function");
+    pipeline->first = false;
+
+    PassManager_run(pipeline->pm, item->ast, pipeline->options);
+    typecheck_run(item->ast);
+}
+
+void pipeline_generate(Pipeline* pipeline, PipelineItem* item)
+{
+    stream_generate(item->ast, pipeline->code, &pipeline->control_id, pipeline->options, pipeline->emit_ir, pipeline->out);
+}
+
+// Runs a stage on the item, a panic is stored in the item and cancels the
+// pipeline. Whatever the stage held then is leaked, the compile is over
+bool pipeline_run_stage(Pipeline* pipeline, PipelineItem* item, void (*stage)(Pipeline*, PipelineItem*))
+{
+    PanicHandler handler;
+
+    if (setjmp(handler.env) == 0) {
+        panic_push_handler(&handler);
+        stage(pipeline, item);
+        panic_pop_handler();
+        return true;
+    }
+
+    item->error = String_from(handler.message);
+    __atomic_store_n(&pipeline->cancelled, true, __ATOMIC_RELEASE);
+    return false;
+}
+
+bool pipeline_cancelled(Pipeline* pipeline)
+{
+    return __atomic_load_n(&pipeline->cancelled, __ATOMIC_ACQUIRE);
+}
+
+void* pipeline_lex_thread(void* arg)
+{
+    Pipeline* pipeline = arg;
+
+    while (!pipeline_cancelled(pipeline)) {
+        PipelineItem* item = calloc(1, sizeof(PipelineItem));
+        bool lexed = pipeline_run_stage(pipeline, item, pipeline_lex);
+        if (lexed && item->tokens == NULL) {
+            free(item);
+            break;
+        }
+        if (lexed)
+            pipeline->token_count += Arraylist_size(item->tokens);
+        SpscQueue_push(pipeline->tokens, item);
+    }
+
+    SpscQueue_push(pipeline->tokens, NULL);
+    MemStats_thread_done();
+    return NULL;
+}
+
+void* pipeline_front_thread(void* arg)
+{
+    Pipeline* pipeline = arg;
+    PipelineItem* item;
+    bool failed = false;
+
+    // Reads on to the end even after a failure, the lexer may be waiting
+    // for room in the queue. Items after a failure are passed on untouched,
+    // the code generator stops at the first error anyway
+    while ((item = SpscQueue_pop(pipeline->tokens)) != NULL) {
+        if (!failed && item->error == NULL)
+            pipeline_run_stage(pipeline, item, pipeline_front);
+        failed = failed || item->error != NULL;
+        SpscQueue_push(pipeline->trees, item);
+    }
+
+    SpscQueue_push(pipeline->trees, NULL);
+    MemStats_thread_done();
+    return NULL;
+}
+
+void compile_pipeline(char* source, PassManager* pm, GenOptions* options, bool emit_ir, TimeReport* report, Sink* out)
+{
+    Pipeline pipeline;
+    pipeline.lexer = Lexer_new(source);
+    pipeline.pm = pm;
+    pipeline.options = options;
+    pipeline.emit_ir = emit_ir;
+    pipeline.first = true;
+    pipeline.tokens = SpscQueue_new(PIPELINE_QUEUE_SIZE);
+    pipeline.trees = SpscQueue_new(PIPELINE_QUEUE_SIZE);
+    pipeline.token_count = 0;
+    pipeline.code = StringBuilder_new();
+    pipeline.control_id = 0;
+    pipeline.out = out;
+    pipeline.cancelled = false;
+
+    TimeReport_start(report, "pipeline");
+    pthread_t lex_thread, front_thread;
+    if (pthread_create(&lex_thread, NULL, pipeline_lex_thread, &pipeline) != 0
+        || pthread_create(&front_thread, NULL, pipeline_front_thread, &pipeline) != 0)
+        panic("Could not start a pipeline thread");
+
+    char* error = NULL;
+    PipelineItem* item;
+    while ((item = SpscQueue_pop(pipeline.trees)) != NULL) {
+        if (error == NULL && item->error == NULL)
+            pipeline_run_stage(&pipeline, item, pipeline_generate);
+
+        if (item->error != NULL) {
+            // Only the first error is reported, the items after it were
+            // never finished
+            if (error == NULL)
+                error = item->error;
+        }
+        else if (error == NULL) {
+            AST_free(item->ast);
+            Arraylist_free(item->tokens);
+        }
+        free(item);
+    }
+
+    pthread_join(lex_thread, NULL);
+    pthread_join(front_thread, NULL);
+    report->tokens += pipeline.token_count;
+
+    if (error != NULL)
+        panic("%s", error);
+
+    if (!emit_ir)
+        Sink_write_str(out, NNI_PROGRAM_END);
+    TimeReport_stop(report);
+
+    SpscQueue_free(pipeline.tokens);
+    SpscQueue_free(pipeline.trees);
+    StringBuilder_free(pipeline.code);
+    Lexer_free(pipeline.lexer);
+}
+
+void compile_incremental(char* source, PassManager* pm, GenOptions* options, uint64_t options_hash, FragmentCache* cache, Sink* out, Arraylist* imports)
+{
+    Lexer* lexer = Lexer_new(source);
+    StringBuilder* code = StringBuilder_new();
+    int control_id = 0;
+    bool first = true;
+
+    FragmentCache_next_generation(cache);
+
+    while (true) {
+        // Blank lines in front of a function do not change its code
+        int start = lexer->pos;
+        while (start < lexer->size && (source[start] == ' ' || source[start] == '\n' || source[start] == '\r' || source[start] == '\t'))
+            start++;
+
+        Arraylist* tokens = Lexer_next_function(lexer);
+        if (tokens == NULL)
+            break;
+
+        uint64_t key = fnv1a_hash_continue(options_hash, source + start, lexer->pos - start);
+        Fragment* fragment = FragmentCache_get(cache, key);
+
+        if (fragment == NULL) {
+            AST* ast = AST_from(tokens);
+            if (!first && Arraylist_size(ast->imports) > 0)
+                panic("Imports must come before the first function");
+
+            PassManager_run(pm, ast, options);
+            typecheck_run(ast);
+
+            int labels = 0;
+            ast_functions_to_nni(ast, code, &labels, options, NULL);
+
+            Arraylist* names = Arraylist_new(free);
+            for (int i = 0; i < Arraylist_size(ast->imports); i++)
+                Arraylist_add(names, String_from(Arraylist_get(ast->imports, i)));
+            fragment = FragmentCache_add(cache, key, StringBuilder_get(code), code->size, labels, names);
+
+            StringBuilder_clear(code);
+            AST_free(ast);
+        }
+        else if (!first && Arraylist_size(fragment->imports) > 0) {
+            panic("Imports must come before the first function");
+        }
+        Arraylist_free(tokens);
+        first = false;
+
+        parse_imports(fragment->imports, code, options);
+        Sink_write_sb(out, code);
+        for (int i = 0; imports != NULL && i < Arraylist_size(fragment->imports); i++)
+            Arraylist_add(imports, String_from(Arraylist_get(fragment->imports, i)));
+
+        Fragment_write(fragment, control_id, out);
+        control_id += fragment->labels;
+    }
+
+    Sink_write_str(out, NNI_PROGRAM_END);
+
+    StringBuilder_free(code);
+    Lexer_free(lexer);
+}
@@ -0,0 +1,30 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "passmanager.h"
+#include "nonamegenerator.h"
+#include "timereport.h"
+#include "sink.h"
+#include "fragcache.h"
+
+#include <stdbool.h>
+
+// Compiles the source one top level function at a time. Each function is
+// lexed, parsed, run through the passes, checked, generated, written to out
+// and freed before the next one is read, so peak memory follows the largest
+// function rather than the whole program. Writes the same output as the
+// whole program pipeline
+void compile_stream(char* source, PassManager* pm, GenOptions* options, bool emit_ir, TimeReport* report, Sink* out);
+// compile_stream with its steps spread over three threads: one lexes, one
+// parses, runs the passes and checks, and the calling thread generates.
+// Functions move between them over bounded queues, so the lexer runs ahead
+// of the code generator instead of waiting for it. The report only has a
+// single pipeline phase, the others overlap
+void compile_pipeline(char* source, PassManager* pm, GenOptions* options, bool emit_ir, TimeReport* report, Sink* out);
+// compile_stream for NNI output that keeps the code of every function in the
+// cache, by a hash of its source and options_hash. Functions found there are
+// only lexed, to find where they end, and written with their labels moved.
+// The names of the imported modules are added to imports when it is not NULL
+void compile_incremental(char* source, PassManager* pm, GenOptions* options, uint64_t options_hash, FragmentCache* cache, Sink* out, Arraylist* imports);
+
+#endif
@@ -4,6 +4,15 @@
 #include <string.h>
 #include <math.h>
 #include <stdio.h>
+#include <limits.h>
+#include "panic.h"
+
+#define ALLOC_SUBSYSTEM ContainersAlloc
+#include "alloc.h"
+
+// The string copies are tagged by their caller, see String_from_tagged
+#undef String_from
+#undef String_from_int
 
 void expand(StringBuilder* sb)
 {
@@ -34,15 +43,17 @@ int StringBuilder_add(StringBuilder* sb, char val)
 
 int StringBuilder_add_arr(StringBuilder* sb, char* arr)
 {
-    int size = strlen(arr);
+    return StringBuilder_add_n(sb, arr, strlen(arr));
+}
+
+int StringBuilder_add_n(StringBuilder* sb, char* arr, int size)
+{
     sb->size += size;
 
     while (sb->size >= sb->current_size)
         expand(sb);
 
-    for (int i = 0; i < size; ++i) {
-        sb->str[i+sb->size-size] = arr[i];
-    }
+    memcpy(sb->str + sb->size - size, arr, size);
 
     return 0;
 }
@@ -70,37 +81,65 @@ void StringBuilder_free(StringBuilder* sb)
 
 char* String_from(char* str)
 {
-    char* c = malloc(strlen(str)+1 * (sizeof(char)));
+    return String_from_tagged(str, OtherAlloc);
+}
+
+char* String_from_int(int num)
+{
+    return String_from_int_tagged(num, OtherAlloc);
+}
+
+// (malloc) skips the alloc.h macro, which would charge the copy to the
+// containers instead of the subsystem passed in
+char* String_from_tagged(char* str, Subsystem subsystem)
+{
+    alloc_subsystem = subsystem;
+    char* c = (malloc)(strlen(str)+1 * (sizeof(char)));
     memcpy(c, str, strlen(str)+1 * (sizeof(char)));
 
     return c;
 }
 
-char* String_from_int(int num) 
+char* String_from_int_tagged(int num, Subsystem subsystem)
 {
     int size =  11 * sizeof(char);
-    char* c = malloc(size);
+    alloc_subsystem = subsystem;
+    char* c = (malloc)(size);
     sprintf(c, "%i\0", num);
     return c;
 }
 
+// Reads the whole file into one buffer of its size, large sources would
+// otherwise be copied several times while a StringBuilder grows
 char* read_file(char* filename)
 {
-    char buf[255];
     FILE* ptr;
-    char ch;
     ptr = fopen(filename, "r");
  
-    if (NULL == ptr) {
-        printf("file can't be opened \n");
+    if (NULL == ptr)
+        panic("Could not open %s", filename);
+    // A directory opens, but its size is not one a buffer can have
+    long size = -1;
+    if (fseek(ptr, 0, SEEK_END) == 0)
+        size = ftell(ptr);
+    if (size < 0 || size == LONG_MAX || fseek(ptr, 0, SEEK_SET) != 0) {
+        fclose(ptr);
+        panic("Could not read %s", filename);
+    }
+
+    char* ret = malloc(size + 1);
+    if (NULL == ret) {
+        fclose(ptr);
+        panic("Could not allocate %li bytes to read %s", size + 1, filename);
     }
-    StringBuilder* sb = StringBuilder_new();
-    while (fgets(buf, 255, ptr) != NULL) { 
-        StringBuilder_add_arr(sb, buf);
+    size = fread(ret, 1, size, ptr);
+    if (ferror(ptr)) {
+        free(ret);
+        fclose(ptr);
+        panic("Could not read %s", filename);
     }
+    ret[size] = '\0';
     fclose(ptr);
 
-    char* ret = StringBuilder_get(sb);
-    StringBuilder_free(sb);
     return ret;
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef STRINGBUILDER_H
 #define STRINGBUILDER_H
 
+#include "memstat.h"
+
 #define INITIAL_STRING_SIZE 40
 #define EXPAND_SCALAR 2
 
@@ -16,12 +18,17 @@ typedef struct stringbuilder StringBuilder;
 StringBuilder* StringBuilder_new();
 int StringBuilder_add(StringBuilder* sb, char val);
 int StringBuilder_add_arr(StringBuilder* sb, char* arr);
+// Adds size bytes of arr, which does not have to be NUL terminated
+int StringBuilder_add_n(StringBuilder* sb, char* arr, int size);
 char* StringBuilder_get(StringBuilder* sb);
 void StringBuilder_clear(StringBuilder* sb);
 void StringBuilder_free(StringBuilder* sb);
 
 char* String_from(char* str);
 char* String_from_int(int num);
+// Same as above, the copy is charged to subsystem in --alloc-stats
+char* String_from_tagged(char* str, Subsystem subsystem);
+char* String_from_int_tagged(int num, Subsystem subsystem);
 char* read_file(char* filename);
 
 #endif
\ No newline at end of file
@@ -5,13 +5,33 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "arraylist.h"
 #include "hashmap.h"
+#include "hashtable.h"
+#include "sha256.h"
 #include "tokenizer.h"
 #include "token.h"
 #include "ast.h"
 #include "stringbuilder.h"
 #include "nonamegenerator.h"
+#include "typecheck.h"
+#include "passmanager.h"
+#include "sink.h"
+#include "panic.h"
+#include "batch.h"
+#include "server.h"
+#include "diskcache.h"
+#include "watch.h"
+#include "stream.h"
+#include "object.h"
+#include "linker.h"
 
 #define assert_begin() bool c = false
 #define assert(check, msg) if(!check) {printf("Assertion Error: %s\n", msg);}
@@ -104,6 +124,90 @@ bool Hashmap_tests()
     return pass;
 }
 
+// Item of the HashTable tests, the hash is kept small so items collide
+struct test_item
+{
+    uint64_t hash;
+    int value;
+};
+
+struct test_item* test_item_new(uint64_t hash, int value)
+{
+    struct test_item* item = malloc(sizeof(struct test_item));
+    item->hash = hash;
+    item->value = value;
+    return item;
+}
+
+bool test_item_even(void* item, void* arg)
+{
+    (void)arg;
+    return ((struct test_item*)item)->value % 2 == 0;
+}
+
+bool HashTable_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    // Grows past its starting capacity, with three items on every hash
+    HashTable* table = HashTable_new(free, 4);
+    for (int i = 0; i < 60; i++)
+        HashTable_add(table, test_item_new(i % 20, i));
+    assert_pass(HashTable_size(table) == 60, "HashTable, size is not the number of items added", &pass);
+
+    int position;
+    int sum = 0;
+    int found = 0;
+    for (struct test_item* item = HashTable_first(table, 7, &position); item != NULL;
+         item = HashTable_next(table, 7, &position)) {
+        sum += item->value;
+        found++;
+    }
+    assert_pass(found == 3 && sum == 7 + 27 + 47, "HashTable, items with a hash not found", &pass);
+    assert_pass(HashTable_first(table, 20, &position) == NULL, "HashTable, found a hash that was not added", &pass);
+
+    HashTable_retain(table, test_item_even, NULL);
+    assert_pass(HashTable_size(table) == 30, "HashTable, retain kept the wrong items", &pass);
+    struct test_item* item = HashTable_first(table, 8, &position);
+    assert_pass(item != NULL && item->value % 2 == 0, "HashTable, an item was lost by retain", &pass);
+
+    HashTable_free(table);
+    return pass;
+}
+
+bool Sha256_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    // Known digests, 56 bytes needs a second block for the length
+    char* inputs[] = {"", "abc", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"};
+    char* digests[] = {
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+    };
+    char hex[SHA256_HEX_SIZE];
+    Sha256 sha;
+    for (int i = 0; i < 3; i++) {
+        Sha256_init(&sha);
+        Sha256_add(&sha, inputs[i], strlen(inputs[i]));
+        Sha256_hex(&sha, hex);
+        assert_pass(strcmp(hex, digests[i]) == 0, "Sha256, wrong digest", &pass);
+    }
+
+    // 7000 bytes added in pieces that do not line up with the blocks
+    Sha256_init(&sha);
+    for (int i = 0; i < 1000; i++)
+        Sha256_add(&sha, "aaaaaaa", 7);
+    Sha256_hex(&sha, hex);
+    assert_pass(strcmp(hex, "e528b009df23f86db9826219d5b03d91dbc4b28a166442773bc23db37014cf2e") == 0,
+        "Sha256, wrong digest of data added in pieces", &pass);
+
+    return pass;
+}
+
 bool Tokenizer_tests()
 {
     bool pass = true;
@@ -136,6 +240,903 @@ bool Tokenizer_tests()
     return pass;
 }
 
+bool Token_equal(Token* a, Token* b)
+{
+    if (a->type != b->type || a->line != b->line || a->column != b->column)
+        return false;
+    if (a->type == Number)
+        return a->number.is_float == b->number.is_float && a->number.as.i == b->number.as.i;
+    return (a->name == NULL && b->name == NULL)
+        || (a->name != NULL && b->name != NULL && strcmp(a->name, b->name) == 0);
+}
+
+bool Tokenizer_parallel_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    // Large enough to be split, with strings over several lines so some of
+    // them run over the end of a chunk
+    StringBuilder* sb = StringBuilder_new();
+    for (int i = 0; i < 20000; i++) {
+        StringBuilder_add_arr(sb, "var x : i32 = (1 + 0x1f * 2.5e3) != y;\n");
+        if (i % 3 == 0)
+            StringBuilder_add_arr(sb, "\"a string\nover\nthree lines\" ;\n");
+    }
+    char* source = StringBuilder_get(sb);
+
+    Arraylist* serial = tokenize(source);
+    Arraylist* parallel = tokenize_parallel(source, 4);
+
+    assert_pass(Arraylist_size(serial) == Arraylist_size(parallel), "Parallel lexer, token count differs", &pass);
+    bool same = Arraylist_size(serial) == Arraylist_size(parallel);
+    for (int i = 0; same && i < Arraylist_size(serial); i++)
+        same = Token_equal(Arraylist_get(serial, i), Arraylist_get(parallel, i));
+    assert_pass(same, "Parallel lexer, tokens differ", &pass);
+
+    Arraylist_free(serial);
+    Arraylist_free(parallel);
+    StringBuilder_free(sb);
+    free(source);
+
+    return pass;
+}
+
+// Output of compile_stream, to compare the incremental compile against
+char* stream_output(char* source, PassManager* pm, GenOptions* options)
+{
+    TimeReport* report = TimeReport_new();
+    Sink* out = Sink_memory();
+    compile_stream(source, pm, options, false, report, out);
+    char* output = Sink_memory_get(out);
+    Sink_free(out);
+    TimeReport_free(report);
+    return output;
+}
+
+bool Incremental_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    char* first = "function a(x : i32) : i32\n{\n\tif (x > 1) {\n\t\tx = (x - 1);\n\t}\n\tx\n}\n\n"
+        "function main() : void\n{\n\tvar y : i32 = (2)\n\twhile (y > 0) {\n\t\ty = (a(y));\n\t}\n}\n";
+    // A new function with a loop in front moves the labels of the others
+    char* second = "function b(x : i32) : i32\n{\n\twhile (x > 9) {\n\t\tx = (x - 9);\n\t}\n\tx\n}\n\n"
+        "function a(x : i32) : i32\n{\n\tif (x > 1) {\n\t\tx = (x - 1);\n\t}\n\tx\n}\n\n"
+        "function main() : void\n{\n\tvar y : i32 = (2)\n\twhile (y > 0) {\n\t\ty = (a(y));\n\t}\n}\n"
+        "function c(x : i32) : void\n{\n\tif (x > 1) {\n\t\tx = (x - 1);\n\t}\n\tvar s : char = \"CTR_L0\"\n}\n";
+
+    GenOptions options;
+    GenOptions_init(&options);
+    PassManager* pm = PassManager_standard(DEFAULT_OPT_LEVEL);
+    FragmentCache* cache = FragmentCache_new();
+
+    for (int i = 0; i < 2; i++) {
+        char* source = i == 0 ? first : second;
+        Sink* out = Sink_memory();
+        compile_incremental(source, pm, &options, 0, cache, out, NULL);
+        char* incremental = Sink_memory_get(out);
+        char* expected = stream_output(source, pm, &options);
+
+        assert_pass(strcmp(incremental, expected) == 0, "Incremental compile, output differs from the stream compile", &pass);
+
+        free(incremental);
+        free(expected);
+        Sink_free(out);
+    }
+    assert_pass(cache->hits == 2 && cache->misses == 4, "Incremental compile, unchanged functions were compiled again", &pass);
+
+    FragmentCache_free(cache);
+    PassManager_free(pm);
+
+    return pass;
+}
+
+// Object of the source, compiled the way comp -c does
+ObjectFile* object_from(char* source, GenOptions* options)
+{
+    Arraylist* tokens = tokenize(source);
+    AST* ast = AST_from(tokens);
+    typecheck_run(ast);
+    ObjectFile* object = ObjectFile_from_ast(ast, options);
+    AST_free(ast);
+    Arraylist_free(tokens);
+    return object;
+}
+
+bool Linker_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    char* first = "function main() : void\n{\n\tvar x : i32 = (1)\n\twhile (x < 9) {\n\t\tx = (twice(x));\n\t}\n}\n";
+    // main never calls unused, its label goes with it
+    char* second = "function unused(a : i32) : i32\n{\n\tif (a > 1) {\n\t\ta = (1);\n\t}\n\ta\n}\n\n"
+        "function twice(a : i32) : i32\n{\n\tif (a > 0) {\n\t\ta = (a * 2);\n\t}\n\ta\n}\n";
+    char* whole = "function main() : void\n{\n\tvar x : i32 = (1)\n\twhile (x < 9) {\n\t\tx = (twice(x));\n\t}\n}\n"
+        "function twice(a : i32) : i32\n{\n\tif (a > 0) {\n\t\ta = (a * 2);\n\t}\n\ta\n}\n";
+
+    GenOptions options;
+    GenOptions_init(&options);
+    ModuleRegistry* modules = ModuleRegistry_new();
+
+    Arraylist* objects = Arraylist_new(ObjectFile_free);
+    Arraylist_add(objects, object_from(first, &options));
+    Arraylist_add(objects, object_from(second, &options));
+    Sink* out = Sink_memory();
+    link_objects(objects, modules, out);
+    char* linked = Sink_memory_get(out);
+
+    Arraylist* tokens = tokenize(whole);
+    AST* ast = AST_from(tokens);
+    typecheck_run(ast);
+    char* expected = ast_to_nni(ast);
+
+    assert_pass(strcmp(linked, expected) == 0, "Linker, output differs from the whole program without unused", &pass);
+
+    free(linked);
+    free(expected);
+    Sink_free(out);
+    AST_free(ast);
+    Arraylist_free(tokens);
+    Arraylist_free(objects);
+    ModuleRegistry_free(modules);
+
+    return pass;
+}
+
+// Program generated from the source after the passes of the level
+char* compile_source(char* source, int opt_level, GenOptions* options)
+{
+    Arraylist* tokens = tokenize(source);
+    AST* ast = AST_from(tokens);
+    PassManager* pm = PassManager_standard(opt_level);
+    PassManager_run(pm, ast, options);
+    typecheck_run(ast);
+    char* output = ast_to_nni_with_options(ast, options);
+
+    PassManager_free(pm);
+    AST_free(ast);
+    Arraylist_free(tokens);
+    return output;
+}
+
+// Whether the code of the function in the program is exactly expected
+bool function_is(char* program, char* name, char* expected)
+{
+    char header[64];
+    sprintf(header, "FS %s\n", name);
+    char* start = strstr(program, header);
+    if (start == NULL)
+        return false;
+
+    sprintf(header, "FE %s", name);
+    char* end = strstr(start, header);
+    if (end == NULL)
+        return false;
+    end += strlen(header);
+
+    bool same = (long)strlen(expected) == end - start && strncmp(start, expected, end - start) == 0;
+    if (!same)
+        printf("%.*s\n", (int)(end - start), start);
+    return same;
+}
+
+bool Simplify_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    // Literals are i32, the folds wrap at 32 bits and leave what they can
+    // not compute to the VM
+    char* source = "function main() : void\n{\n\tvar x : i32 = (2147483647 + 1)\n\tvar y : i32 = (4000000000 + 1)\n"
+        "\tvar z : i32 = (((0 - 2147483647) - 1) / (0 - 1))\n\tvar w : i32 = (6 * 7)\n}\n";
+
+    GenOptions options;
+    GenOptions_init(&options);
+    char* output = compile_source(source, 2, &options);
+
+    assert_pass(function_is(output, "main",
+        "FS main\nNEW NUM 4\nSET 0 NUM -2147483648\nNEW NUM\nSET 4 NUM 4000000000\nPUSH 4\nNEW NUM\nSET 5 NUM 1\nPUSH 5\nADD\nPOP 1\n"
+        "NEW NUM\nSET 6 NUM -2147483648\nPUSH 6\nNEW NUM\nSET 7 NUM -1\nPUSH 7\nDIV\nPOP 2\nSET 3 NUM 42\nADDR main_END\nFE main"),
+        "Simplify, literal folds overflowed", &pass);
+
+    free(output);
+    return pass;
+}
+
+bool Licm_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    // bump writes through its argument, print has to get its own 5
+    char* source = "function bump(x : i32) : void\n{\n\tx = (x + 1);\n}\n\n"
+        "function main() : void\n{\n\tvar i : i32 = (0)\n\tvar k : i32 = (4)\n\twhile (i < 3) {\n"
+        "\t\tbump(5)\n\t\tprint(5)\n\t\ti = (i + k * 2);\n\t}\n}\n";
+
+    GenOptions options;
+    GenOptions_init(&options);
+    char* output = compile_source(source, 2, &options);
+
+    assert_pass(function_is(output, "main",
+        "FS main\nNEW NUM 4\nSET 0 NUM 0\nSET 1 NUM 4\nSET 2 NUM 3\nPUSH 1\nNEW NUM\nSET 4 NUM 1\nPUSH 4\nSHL\nPOP 3\n"
+        "JMP CTR_L1\nADDR CTR_L0\nNEW NUM\nSET 5 NUM 5\nCALL bump 5\nNEW NUM\nSET 6 NUM 5\nCALL print 6\n"
+        "PUSH 0\nPUSH 3\nADD\nPOP 0\nRM 2\nADDR CTR_L1\nPUSH 0\nPUSH 2\nCMPL\nIFEQ CTR_L0\nADDR main_END\nFE main"),
+        "LICM, literal call arguments were hoisted", &pass);
+
+    free(output);
+    return pass;
+}
+
+bool Cse_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    // (a * b + 7) is computed once for the first statement, after b = (5)
+    // it is a different value
+    char* source = "function main() : void\n{\n\tvar a : i32 = (3)\n\tvar b : i32 = (4)\n\tvar x : i32\n\tvar y : i32\n"
+        "\tx = ((a * b + 7) * (a * b + 7));\n\ty = (a * b + 7 - a);\n\tb = (5);\n\tx = (a * b + 7);\n}\n";
+
+    GenOptions options;
+    GenOptions_init(&options);
+    char* output = compile_source(source, 2, &options);
+
+    assert_pass(function_is(output, "main",
+        "FS main\nNEW NUM 5\nSET 0 NUM 3\nSET 1 NUM 4\nPUSH 0\nPUSH 1\nMUL\nNEW NUM\nSET 5 NUM 7\nPUSH 5\nADD\nPOP 4\n"
+        "PUSH 4\nPUSH 4\nMUL\nPOP 2\nPUSH 0\nPUSH 1\nMUL\nNEW NUM\nSET 6 NUM 7\nPUSH 6\nPUSH 0\nSUB\nADD\nPOP 3\n"
+        "SET 1 NUM 5\nPUSH 0\nPUSH 1\nMUL\nNEW NUM\nSET 7 NUM 7\nPUSH 7\nADD\nPOP 2\nADDR main_END\nFE main"),
+        "CSE, repeated subexpression not computed once", &pass);
+
+    free(output);
+    return pass;
+}
+
+bool Typed_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    // Temporaries of mixed operands take the widest type, F64 once a float
+    // is involved and I64 for u32 with i32
+    char* licm_source = "function main() : void\n{\n\tvar x : f64 = (1.5)\n\tvar y : f32 = (2.5)\n\tvar r : f64 = (0)\n"
+        "\tvar i : i32 = (0)\n\twhile (i < 3) {\n\t\tr = ((x + y) * 3 + x);\n\t\ti = (i + 1);\n\t}\n}\n";
+    char* cse_source = "function main() : void\n{\n\tvar a : u32 = (1)\n\tvar b : i32 = (2)\n\tvar x : f64 = (1.5)\n"
+        "\tvar y : f32 = (2.5)\n\tvar r : i64 = (0)\n\tvar f : f64 = (0)\n"
+        "\tr = ((a * b + 7) * (a * b + 7));\n\tf = ((x * y + 7) * (x * y + 7));\n}\n";
+    // Nothing holds both u64 and i64, the value goes back where it was used
+    char* unknown_source = "function main() : void\n{\n\tvar a : u64 = (1)\n\tvar b : i64 = (2)\n\tvar r : i64 = (0)\n"
+        "\tr = ((a * b + 7) * (a * b + 7));\n}\n";
+
+    GenOptions options;
+    GenOptions_init(&options);
+    options.typed = true;
+
+    char* output = compile_source(licm_source, 2, &options);
+    assert_pass(function_is(output, "main",
+        "FS main\nNEW I32 3\nNEW F64 3\nNEW F32\nSET 3 NUM 1.5\nSET 6 NUM 2.5\nSET 4 NUM 0\nSET 0 NUM 0\nSET 1 NUM 3\n"
+        "PUSH 3\nPUSH 6\nADD\nNEW I32\nSET 7 NUM 3\nPUSH 7\nMUL\nPUSH 3\nADD\nPOP 5\nSET 2 NUM 1\nJMP CTR_L1\nADDR CTR_L0\n"
+        "COPY 4 5\nPUSH 0\nPUSH 2\nADD_I32\nPOP 0\nADDR CTR_L1\nPUSH 0\nPUSH 1\nCMPL_I32\nIFEQ CTR_L0\nADDR main_END\nFE main"),
+        "Typed, a hoisted f64 and f32 value was not F64", &pass);
+    free(output);
+
+    output = compile_source(cse_source, 2, &options);
+    assert_pass(function_is(output, "main",
+        "FS main\nNEW I64 2\nNEW I32\nNEW U32\nNEW F64 3\nNEW F32\nSET 3 NUM 1\nSET 2 NUM 2\nSET 4 NUM 1.5\nSET 7 NUM 2.5\n"
+        "SET 0 NUM 0\nSET 5 NUM 0\nPUSH 3\nPUSH 2\nMUL\nNEW I32\nSET 8 NUM 7\nPUSH 8\nADD\nPOP 1\nPUSH 1\nPUSH 1\nMUL_I64\nPOP 0\n"
+        "PUSH 4\nPUSH 7\nMUL\nNEW I32\nSET 9 NUM 7\nPUSH 9\nADD\nPOP 6\nPUSH 6\nPUSH 6\nMUL_F64\nPOP 5\nADDR main_END\nFE main"),
+        "Typed, common subexpressions of mixed types were narrowed", &pass);
+    free(output);
+
+    output = compile_source(unknown_source, 2, &options);
+    assert_pass(function_is(output, "main",
+        "FS main\nNEW I64 2\nNEW U64\nSET 2 NUM 1\nSET 0 NUM 2\nSET 1 NUM 0\nPUSH 2\nPUSH 0\nMUL\nNEW I32\nSET 3 NUM 7\nPUSH 3\nADD\n"
+        "PUSH 2\nPUSH 0\nMUL\nNEW I32\nSET 4 NUM 7\nPUSH 4\nADD\nMUL\nPOP 1\nADDR main_END\nFE main"),
+        "Typed, a u64 and i64 value was kept in a temporary", &pass);
+    free(output);
+
+    // A literal u8 cannot hold leaves the operation to the VM, and is an
+    // error as the value of a u8
+    char* wide_source = "function main() : void\n{\n\tvar c : u8 = (5)\n\tc = (c + 300);\n}\n";
+    output = compile_source(wide_source, 0, &options);
+    assert_pass(function_is(output, "main",
+        "FS main\nNEW U8\nSET 0 NUM 5\nPUSH 0\nNEW I32\nSET 1 NUM 300\nPUSH 1\nADD\nPOP 0\nADDR main_END\nFE main"),
+        "Typed, an operation with a literal u8 cannot hold was typed u8", &pass);
+    free(output);
+
+    PanicHandler handler;
+    char* message = NULL;
+    if (setjmp(handler.env) == 0) {
+        panic_push_handler(&handler);
+        output = compile_source("function main() : void\n{\n\tvar b : u8 = (300)\n}\n", 0, &options);
+        panic_pop_handler();
+        free(output);
+    }
+    else {
+        message = String_from(handler.message);
+    }
+    assert_pass(message != NULL && strcmp(message, "Type error in main: 300 does not fit u8") == 0,
+        "Typed, a u8 was declared with a literal it cannot hold", &pass);
+    free(message);
+
+    return pass;
+}
+
+bool Output_mode_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    char* source = "function main() : void\n{\n\tvar a : i32 = (3)\n\tvar b : i32 = (4)\n"
+        "\twhile (a < 10) {\n\t\ta = (a + b * 2);\n\t}\n}\n";
+
+    GenOptions options;
+    GenOptions_init(&options);
+    options.three_address = true;
+    char* output = compile_source(source, 2, &options);
+    assert_pass(function_is(output, "main",
+        "FS main\nNEW NUM 4\nSET 0 NUM 3\nSET 1 NUM 4\nSET 2 NUM 10\nNEW NUM\nSET 4 NUM 1\nSHL 3 1 4\nJMP CTR_L1\nADDR CTR_L0\n"
+        "ADD 0 0 3\nADDR CTR_L1\nCMPL S 0 2\nIFEQ CTR_L0\nADDR main_END\nFE main"),
+        "Output modes, three-address output changed", &pass);
+    free(output);
+
+    options.typed = true;
+    output = compile_source(source, 2, &options);
+    assert_pass(function_is(output, "main",
+        "FS main\nNEW I32 4\nSET 0 NUM 3\nSET 1 NUM 4\nSET 2 NUM 10\nNEW I32\nSET 4 NUM 1\nSHL_I32 3 1 4\nJMP CTR_L1\nADDR CTR_L0\n"
+        "ADD_I32 0 0 3\nADDR CTR_L1\nCMPL_I32 S 0 2\nIFEQ CTR_L0\nADDR main_END\nFE main"),
+        "Output modes, typed three-address output changed", &pass);
+    free(output);
+
+    GenOptions_init(&options);
+    options.ssa = true;
+    output = compile_source(source, 2, &options);
+    assert_pass(function_is(output, "main",
+        "FS main\nNEW NUM 8\nSET 0 NUM 3\nSET 1 NUM 4\nSET 2 NUM 10\nSET 3 NUM 1\nPUSH 1\nPUSH 3\nSHL\nPOP 4\nCOPY 5 0\n"
+        "ADDR CTR_L1\nPUSH 5\nPUSH 2\nCMPL\nPOP 6\nPUSH 6\nNOT\nIFEQ CTR_L3\nADDR CTR_L2\nPUSH 5\nPUSH 4\nADD\nPOP 7\nCOPY 5 7\n"
+        "JMP CTR_L1\nADDR CTR_L3\nADDR main_END\nFE main"),
+        "Output modes, SSA output changed", &pass);
+    free(output);
+
+    // A call writes to the slots of its arguments: b needs a slot apart from
+    // a, and bump has to write x back to its parameter slot
+    char* calls = "function bump(x : i32) : void\n{\n\tx = (x + 1);\n}\n\n"
+        "function main() : void\n{\n\tvar a : i32 = (1)\n\tvar b : i32 = (a)\n\tbump(b)\n}\n";
+    output = compile_source(calls, 0, &options);
+    assert_pass(function_is(output, "bump",
+        "FS bump\nNEW NUM 2\nSET 1 NUM 1\nPUSH 0\nPUSH 1\nADD\nPOP 2\nCOPY 0 2\nADDR bump_END\nFE bump"),
+        "Output modes, SSA did not write the parameter back", &pass);
+    assert_pass(function_is(output, "main",
+        "FS main\nNEW NUM 3\nSET 0 NUM 1\nCOPY 1 0\nCALL bump 1\nADDR main_END\nFE main"),
+        "Output modes, SSA passed a variable copied from another in the same slot", &pass);
+    free(output);
+
+    return pass;
+}
+
+// Fresh directory under /tmp for a test, test_remove_dir removes it again
+char* test_temp_dir()
+{
+    char* dir = String_from("/tmp/comp-test-XXXXXX");
+    if (mkdtemp(dir) == NULL)
+        panic("Could not create a test directory");
+    return dir;
+}
+
+// Path of name in dir, the file is written when content is not NULL
+char* test_file(char* dir, char* name, char* content)
+{
+    StringBuilder* sb = StringBuilder_new();
+    StringBuilder_add_arr(sb, dir);
+    StringBuilder_add(sb, '/');
+    StringBuilder_add_arr(sb, name);
+    char* path = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+
+    if (content != NULL) {
+        FILE* file = fopen(path, "w");
+        fputs(content, file);
+        fclose(file);
+    }
+    return path;
+}
+
+void test_remove_dir(char* dir)
+{
+    DIR* d = opendir(dir);
+    struct dirent* entry;
+    struct stat st;
+
+    while (d != NULL && (entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        char* path = test_file(dir, entry->d_name, NULL);
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode))
+            test_remove_dir(path);
+        else
+            unlink(path);
+        free(path);
+    }
+
+    if (d != NULL)
+        closedir(d);
+    rmdir(dir);
+}
+
+bool Sink_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    Sink* memory = Sink_memory();
+    StringBuilder* sb = StringBuilder_new();
+    StringBuilder_add_arr(sb, "FE main\n");
+    Sink_write_str(memory, "FS main\n");
+    Sink_write_sb(memory, sb);
+    char* output = Sink_memory_get(memory);
+    assert_pass(strcmp(output, "FS main\nFE main\n") == 0 && memory->written == 16 && sb->size == 0,
+        "Sink, memory sink lost a write", &pass);
+    free(output);
+    StringBuilder_free(sb);
+    Sink_free(memory);
+
+    // More than two buffers, written across a buffer boundary
+    long size = SINK_BUFFER_SIZE * 2 + 123;
+    char* data = malloc(size + 1);
+    for (long i = 0; i < size; i++)
+        data[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+    data[size] = '\0';
+
+    char* dir = test_temp_dir();
+    char* path = test_file(dir, "out.nni", NULL);
+    Sink* file = Sink_file(path);
+    Sink_write(file, data, 100);
+    Sink_write(file, data + 100, size - 100);
+    long written = file->written;
+    Sink_free(file);
+
+    char* back = read_file(path);
+    assert_pass(written == size && strcmp(back, data) == 0, "Sink, file sink did not write back what it was given", &pass);
+
+    free(back);
+    free(path);
+    test_remove_dir(dir);
+    free(dir);
+    free(data);
+    return pass;
+}
+
+bool Batch_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    char* first = "function main() : void\n{\n\tvar a : i32 = (3)\n\ta = (a * 4 + 2);\n}\n";
+    char* second = "function twice(x : i32) : i32\n{\n\tx = (x * 2);\n\tx\n}\n";
+    char* dir = test_temp_dir();
+    Arraylist* paths = Arraylist_new(free);
+    Arraylist_add(paths, test_file(dir, "first.bc", first));
+    Arraylist_add(paths, test_file(dir, "broken.bc", "function main() : void\n{\n\tvar a : i32 = (\n}\n"));
+    Arraylist_add(paths, test_file(dir, "second.bc", second));
+
+    GenOptions options;
+    GenOptions_init(&options);
+    Arraylist* disabled = Arraylist_new(free);
+    TimeReport* report = TimeReport_new();
+
+    // A failed file does not stop the others, which match a compile of
+    // their own
+    Batch* batch = Batch_new(paths, dir, &options, false, false, DEFAULT_OPT_LEVEL, disabled);
+    int failed = Batch_run(batch, 2, report);
+    assert_pass(failed == 1 && batch->files[0].error == NULL && batch->files[1].error != NULL && batch->files[2].error == NULL,
+        "Batch, the wrong files failed", &pass);
+
+    char* sources[] = {first, NULL, second};
+    for (int i = 0; i < 3; i++) {
+        struct stat st;
+        if (sources[i] == NULL) {
+            assert_pass(stat(batch->files[i].output, &st) != 0, "Batch, a failed file left an output", &pass);
+            continue;
+        }
+
+        char* expected = compile_source(sources[i], DEFAULT_OPT_LEVEL, &options);
+        char* output = read_file(batch->files[i].output);
+        assert_pass(strncmp(output, expected, strlen(expected)) == 0 && strcmp(output + strlen(expected), "\n") == 0,
+            "Batch, an output differs from compiling the file alone", &pass);
+        free(expected);
+        free(output);
+    }
+
+    Batch_free(batch);
+    TimeReport_free(report);
+    Arraylist_free(disabled);
+    Arraylist_free(paths);
+    test_remove_dir(dir);
+    free(dir);
+    return pass;
+}
+
+// Waits up to two seconds for path to exist
+bool test_wait_for(char* path)
+{
+    struct timespec pause = { 0, 10000000 };
+    struct stat st;
+
+    for (int i = 0; i < 200; i++) {
+        if (stat(path, &st) == 0)
+            return true;
+        nanosleep(&pause, NULL);
+    }
+    return false;
+}
+
+void* test_server_thread(void* socket_path)
+{
+    server_run(socket_path);
+    return NULL;
+}
+
+// Output of comp --client for the source, read back from -o
+char* test_client_compile(char* socket_path, char* source_path, char* output_path, int* status)
+{
+    char* argv[] = {"-o", output_path, source_path};
+    *status = client_run(socket_path, 3, argv);
+    return *status == 0 ? read_file(output_path) : NULL;
+}
+
+bool Server_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    char* before = "function main() : void\n{\n\tvar a : i32 = (3)\n\ta = (a * 4 + 2);\n}\n";
+    char* after = "function main() : void\n{\n\tvar a : i32 = (3)\n\tvar b : i32 = (a - 1)\n\ta = (a * 4 + b);\n}\n";
+    char* dir = test_temp_dir();
+    char* socket_path = test_file(dir, "server.sock", NULL);
+    char* source_path = test_file(dir, "prog.bc", before);
+    char* output_path = test_file(dir, "prog.nni", NULL);
+
+    pthread_t server;
+    pthread_create(&server, NULL, test_server_thread, socket_path);
+    assert_pass(test_wait_for(socket_path), "Server, did not start listening", &pass);
+
+    GenOptions options;
+    GenOptions_init(&options);
+    int status;
+
+    // The second request is answered from the result cache, the third
+    // after the source changed has to compile again
+    for (int i = 0; i < 3 && pass; i++) {
+        if (i == 2)
+            free(test_file(dir, "prog.bc", after));
+        char* expected = compile_source(i < 2 ? before : after, DEFAULT_OPT_LEVEL, &options);
+        char* output = test_client_compile(socket_path, source_path, output_path, &status);
+        assert_pass(status == 0 && output != NULL && strncmp(output, expected, strlen(expected)) == 0,
+            "Server, an answer differs from compiling the file here", &pass);
+        free(expected);
+        free(output);
+    }
+
+    // A request claiming more arguments than it could hold is dropped
+    // without allocating for them, and the server keeps answering
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    uint32_t count = UINT32_MAX;
+    char answer;
+    assert_pass(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0
+        && write(fd, &count, sizeof(count)) == sizeof(count) && read(fd, &answer, 1) == 0,
+        "Server, a request with too many arguments was not dropped", &pass);
+    close(fd);
+    char* output = test_client_compile(socket_path, source_path, output_path, &status);
+    assert_pass(status == 0 && output != NULL, "Server, stopped answering after a bad request", &pass);
+    free(output);
+
+    char* stop[] = {"--stop"};
+    assert_pass(client_run(socket_path, 1, stop) == 0, "Server, did not stop", &pass);
+    pthread_join(server, NULL);
+
+    free(output_path);
+    free(source_path);
+    free(socket_path);
+    test_remove_dir(dir);
+    free(dir);
+    return pass;
+}
+
+bool DiskCache_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    char* dir = test_temp_dir();
+    char* cache_dir = test_file(dir, "cache", NULL);
+    free(test_file(dir, "lib.nnivm", "FS twice\nFE twice\n"));
+    ModuleRegistry* modules = ModuleRegistry_new();
+    ModuleRegistry_add_path(modules, dir);
+
+    char* source = "import lib\n\nfunction main() : void\n{\n\ttwice(2)\n}\n";
+    // Holds a NUL, the output is bytes and not a string
+    char output[] = "FS main\n\0CALL twice 0\nFE main\n";
+    long size = sizeof(output) - 1;
+    Arraylist* imports = Arraylist_new(free);
+    Arraylist_add(imports, String_from("lib"));
+
+    DiskCache* cache = DiskCache_new(cache_dir, DISK_CACHE_DEFAULT_SIZE, "-O2\n", modules);
+    char key[DISK_CACHE_KEY_SIZE];
+    DiskCache_key(cache, source, key);
+    long got_size = 0;
+    char* got = DiskCache_get(cache, key, &got_size);
+    assert_pass(got == NULL, "DiskCache, an empty cache hit", &pass);
+    DiskCache_put(cache, key, imports, output, size);
+    DiskCache_free(cache);
+
+    // A new cache on the directory is another process finding the entry
+    cache = DiskCache_new(cache_dir, DISK_CACHE_DEFAULT_SIZE, "-O2\n", modules);
+    got = DiskCache_get(cache, key, &got_size);
+    assert_pass(got != NULL && got_size == size && memcmp(got, output, size) == 0,
+        "DiskCache, get did not return the bytes that were put", &pass);
+    free(got);
+    DiskCache_free(cache);
+
+    char other_key[DISK_CACHE_KEY_SIZE];
+    cache = DiskCache_new(cache_dir, DISK_CACHE_DEFAULT_SIZE, "-O1\n", modules);
+    DiskCache_key(cache, source, other_key);
+    assert_pass(strcmp(key, other_key) != 0, "DiskCache, other flags gave the same key", &pass);
+    DiskCache_free(cache);
+
+    // A registry keeps what it loaded, a new one sees the change
+    free(test_file(dir, "lib.nnivm", "FS twice\nSET 0 NUM 2\nFE twice\n"));
+    ModuleRegistry_free(modules);
+    modules = ModuleRegistry_new();
+    ModuleRegistry_add_path(modules, dir);
+    cache = DiskCache_new(cache_dir, DISK_CACHE_DEFAULT_SIZE, "-O2\n", modules);
+    got = DiskCache_get(cache, key, &got_size);
+    assert_pass(got == NULL, "DiskCache, an entry was used after its module changed", &pass);
+    free(got);
+    DiskCache_free(cache);
+
+    Arraylist_free(imports);
+    ModuleRegistry_free(modules);
+    free(cache_dir);
+    test_remove_dir(dir);
+    free(dir);
+    return pass;
+}
+
+struct test_watch
+{
+    Watch* watch;
+    int status;
+};
+
+void* test_watch_thread(void* ptr)
+{
+    struct test_watch* tw = ptr;
+    tw->status = Watch_run(tw->watch, 1);
+    return NULL;
+}
+
+// Program output for the source with modules found in dir, the way the
+// watched build writes it
+char* test_expected_output(char* source, char* dir)
+{
+    GenOptions options;
+    GenOptions_init(&options);
+    options.modules = ModuleRegistry_new();
+    ModuleRegistry_add_path(options.modules, dir);
+
+    char* output = compile_source(source, DEFAULT_OPT_LEVEL, &options);
+    StringBuilder* sb = StringBuilder_new();
+    StringBuilder_add_arr(sb, output);
+    StringBuilder_add(sb, '\n');
+    free(output);
+    output = StringBuilder_get(sb);
+
+    StringBuilder_free(sb);
+    ModuleRegistry_free(options.modules);
+    return output;
+}
+
+// Waits up to three seconds for the file to hold exactly expected
+bool test_wait_for_output(char* path, char* expected)
+{
+    struct timespec pause = { 0, 10000000 };
+    struct stat st;
+
+    for (int i = 0; i < 300; i++) {
+        if (stat(path, &st) == 0 && st.st_size == (long)strlen(expected)) {
+            char* content = read_file(path);
+            bool same = strcmp(content, expected) == 0;
+            free(content);
+            if (same)
+                return true;
+        }
+        nanosleep(&pause, NULL);
+    }
+    return false;
+}
+
+bool Watch_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    char* uses = "import lib\n\nfunction main() : void\n{\n\ttwice(2)\n}\n";
+    char* alone = "function main() : void\n{\n\tvar a : i32 = (3)\n}\n";
+    char* edited = "function main() : void\n{\n\tvar a : i32 = (3)\n\ta = (a * 4 + 2);\n}\n";
+    char* dir = test_temp_dir();
+    free(test_file(dir, "lib.nnivm", "FS twice\nFE twice 1\n"));
+    free(test_file(dir, "uses.bc", uses));
+    free(test_file(dir, "alone.bc", alone));
+    char* uses_output = test_file(dir, "uses.nni", NULL);
+    char* alone_output = test_file(dir, "alone.nni", NULL);
+
+    GenOptions options;
+    GenOptions_init(&options);
+    options.modules = ModuleRegistry_new();
+    Arraylist* disabled = Arraylist_new(free);
+    struct test_watch tw;
+    tw.watch = Watch_new(dir, dir, &options, false, false, DEFAULT_OPT_LEVEL, disabled);
+    tw.status = 0;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, test_watch_thread, &tw);
+
+    char* expected = test_expected_output(uses, dir);
+    assert_pass(test_wait_for_output(uses_output, expected), "Watch, the first build is missing a file", &pass);
+    free(expected);
+    expected = test_expected_output(alone, dir);
+    assert_pass(test_wait_for_output(alone_output, expected), "Watch, the first build is missing a file", &pass);
+    free(expected);
+
+    // A changed module rebuilds the file importing it and only that one
+    unlink(alone_output);
+    free(test_file(dir, "lib.nnivm", "FS twice\nSET 0 NUM 2\nFE twice 1\n"));
+    expected = test_expected_output(uses, dir);
+    assert_pass(test_wait_for_output(uses_output, expected), "Watch, a module change was not rebuilt", &pass);
+    free(expected);
+    struct stat st;
+    assert_pass(stat(alone_output, &st) != 0, "Watch, a file that does not import the module was rebuilt", &pass);
+
+    free(test_file(dir, "alone.bc", edited));
+    expected = test_expected_output(edited, dir);
+    assert_pass(test_wait_for_output(alone_output, expected), "Watch, an edited file was not rebuilt", &pass);
+    free(expected);
+
+    // Watching ends once the directory is gone. Rebuilds caused by the
+    // removal may write into it again, so it is removed until it stays gone
+    struct timespec pause = { 0, 20000000 };
+    for (int i = 0; i < 100 && stat(dir, &st) == 0; i++) {
+        test_remove_dir(dir);
+        nanosleep(&pause, NULL);
+    }
+    pthread_join(thread, NULL);
+    assert_pass(tw.status == 1, "Watch, did not stop when its directory was removed", &pass);
+
+    Watch_free(tw.watch);
+    ModuleRegistry_free(options.modules);
+    Arraylist_free(disabled);
+    free(uses_output);
+    free(alone_output);
+    free(dir);
+    return pass;
+}
+
+// Message of the panic lexing or parsing the source raises, NULL when it
+// parses. What a failed parse built is not freed
+char* test_parse_error(char* source)
+{
+    PanicHandler handler;
+
+    if (setjmp(handler.env) == 0) {
+        panic_push_handler(&handler);
+        Arraylist* tokens = tokenize(source);
+        AST* ast = AST_from(tokens);
+        panic_pop_handler();
+        AST_free(ast);
+        Arraylist_free(tokens);
+        return NULL;
+    }
+
+    return String_from(handler.message);
+}
+
+bool Parse_error_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    // Call arguments are names and literals, an operator between them is
+    // an error and not an argument that is freed twice
+    char* calls[] = {
+        "function main() : void\n{\n\tvar a : i32 = (3)\n\tprint(a + 1)\n}\n",
+        "function main() : void\n{\n\tvar a : i32 = (3)\n\tvar b : i32 = (print(a * 4))\n}\n",
+        "function main() : void\n{\n\tvar a : i32 = (3)\n\ta = (print(a + a));\n}\n",
+    };
+    for (int i = 0; i < 3; i++) {
+        char* message = test_parse_error(calls[i]);
+        assert_pass(message != NULL && strncmp(message, "Unexpected token at line: 4:", 28) == 0,
+            "Parse errors, an operator in a call argument was accepted", &pass);
+        free(message);
+    }
+
+    // Literals that do not fit in 64 bits, decimal, hex and float
+    char* numbers[] = {"9223372036854775808", "0x10000000000000000", "1e309"};
+    for (int i = 0; i < 3; i++) {
+        char source[128];
+        sprintf(source, "function main() : void\n{\n\tvar a : i64 = (%s)\n}\n", numbers[i]);
+        char* message = test_parse_error(source);
+        assert_pass(message != NULL && strcmp(message, "Number out of range at line: 3:17") == 0,
+            "Parse errors, a literal out of range was accepted", &pass);
+        free(message);
+    }
+
+    return pass;
+}
+
+typedef void (*test_compile_mode)(char* source, PassManager* pm, GenOptions* options, bool emit_ir, TimeReport* report, Sink* out);
+
+// Message of the panic compiling the source in the mode raises, NULL when it
+// compiles
+char* test_mode_error(test_compile_mode compile, char* source)
+{
+    PanicHandler handler;
+    GenOptions options;
+    GenOptions_init(&options);
+    PassManager* pm = PassManager_standard(DEFAULT_OPT_LEVEL);
+    TimeReport* report = TimeReport_new();
+    Sink* out = Sink_memory();
+    char* message = NULL;
+
+    if (setjmp(handler.env) == 0) {
+        panic_push_handler(&handler);
+        compile(source, pm, &options, false, report, out);
+        panic_pop_handler();
+    }
+    else {
+        message = String_from(handler.message);
+    }
+
+    free(Sink_memory_get(out));
+    Sink_free(out);
+    TimeReport_free(report);
+    PassManager_free(pm);
+    return message;
+}
+
+bool Stream_error_tests()
+{
+    bool pass = true;
+    assert_begin();
+
+    // scripts/test1.bc, the assignment without a semicolon runs over the
+    // closing braces so main is never closed
+    char* source = "import sys\n\nfunction main() : void\n{\n\tvar tmp : char = \"hi\"\n\tvar num : i32 = (24/12+2)\n"
+        "\tprint(num)\n\twhile (num > 0) {\n\t\tprint(\"success\")\n\t\tnum = (num-1)\n\t}\n\tprint4(tmp)\n}\n\n"
+        "function print4(val : char) : void\n{\n\tvar counter : i32 = (0)\n\twhile (counter < 4) {\n"
+        "\t\tprint(val)\n\t\tcounter = (counter + 1)\n\t}\n}\n";
+
+    char* message = test_parse_error(source);
+    assert_pass(message != NULL, "Stream errors, the whole program compiled", &pass);
+    free(message);
+    message = test_mode_error(compile_stream, source);
+    assert_pass(message != NULL && strcmp(message, "Expected } at line: 13:1") == 0,
+        "Stream errors, --stream missed an unclosed function", &pass);
+    free(message);
+    message = test_mode_error(compile_pipeline, source);
+    assert_pass(message != NULL && strcmp(message, "Expected } at line: 13:1") == 0,
+        "Stream errors, --pipeline missed an unclosed function", &pass);
+    free(message);
+
+    return pass;
+}
+
 bool Expression_tests() {
     int pos = 0;
     Arraylist* expr = tokenize("((1 + var1) - vare * var2 == 5) {");
@@ -156,7 +1157,24 @@ bool run_tests()
 {
     return Arraylist_test() 
         && Hashmap_tests() 
+        && HashTable_tests()
+        && Sha256_tests()
         && Tokenizer_tests() 
+        && Tokenizer_parallel_tests()
+        && Incremental_tests()
+        && Linker_tests()
+        && Simplify_tests()
+        && Licm_tests()
+        && Cse_tests()
+        && Typed_tests()
+        && Output_mode_tests()
+        && Sink_tests()
+        && Batch_tests()
+        && Server_tests()
+        && DiskCache_tests()
+        && Watch_tests()
+        && Parse_error_tests()
+        && Stream_error_tests()
         && Expression_tests()
         && AST_gen_tests();
 }
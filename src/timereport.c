@@ -0,0 +1,192 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "timereport.h"
+#include "arraylist.h"
+#include "memstat.h"
+#include "stringbuilder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#define ALLOC_SUBSYSTEM OtherAlloc
+#include "alloc.h"
+
+void Phase_free(void* ptr)
+{
+    Phase* phase = (Phase*)ptr;
+    free(phase->name);
+    free(phase);
+}
+
+double report_wall_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+double report_cpu_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+long report_peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+TimeReport* TimeReport_new()
+{
+    TimeReport* report = malloc(sizeof(TimeReport));
+    report->phases = Arraylist_new(Phase_free);
+    report->current = NULL;
+    report->tokens = 0;
+    report->output_bytes = 0;
+    return report;
+}
+
+void TimeReport_start(TimeReport* report, char* name)
+{
+    MemStats stats;
+
+    if (report->current != NULL)
+        TimeReport_stop(report);
+
+    Phase* phase = malloc(sizeof(Phase));
+    phase->name = String_from(name);
+    report->current = phase;
+
+    MemStats_get(&stats);
+    report->start_allocations = stats.allocations;
+    report->start_bytes = stats.bytes;
+    report->start_rss = report_peak_rss_kb();
+    report->start_cpu = report_cpu_ms();
+    report->start_wall = report_wall_ms();
+}
+
+void TimeReport_stop(TimeReport* report)
+{
+    Phase* phase = report->current;
+    MemStats stats;
+
+    if (phase == NULL)
+        return;
+
+    phase->wall_ms = report_wall_ms() - report->start_wall;
+    phase->cpu_ms = report_cpu_ms() - report->start_cpu;
+    phase->rss_delta_kb = report_peak_rss_kb() - report->start_rss;
+    MemStats_get(&stats);
+    phase->allocations = stats.allocations - report->start_allocations;
+    phase->bytes = stats.bytes - report->start_bytes;
+
+    report->current = NULL;
+
+    for (int i = 0; i < Arraylist_size(report->phases); i++) {
+        Phase* earlier = Arraylist_get(report->phases, i);
+        if (strcmp(earlier->name, phase->name) != 0)
+            continue;
+
+        earlier->wall_ms += phase->wall_ms;
+        earlier->cpu_ms += phase->cpu_ms;
+        earlier->rss_delta_kb += phase->rss_delta_kb;
+        earlier->allocations += phase->allocations;
+        earlier->bytes += phase->bytes;
+        Phase_free(phase);
+        return;
+    }
+
+    Arraylist_add(report->phases, phase);
+}
+
+Phase report_total(TimeReport* report)
+{
+    Phase total = {"total", 0, 0, 0, 0, 0};
+
+    for (int i = 0; i < Arraylist_size(report->phases); i++) {
+        Phase* phase = Arraylist_get(report->phases, i);
+        total.wall_ms += phase->wall_ms;
+        total.cpu_ms += phase->cpu_ms;
+        total.rss_delta_kb += phase->rss_delta_kb;
+        total.allocations += phase->allocations;
+        total.bytes += phase->bytes;
+    }
+
+    return total;
+}
+
+double report_phase_wall_ms(TimeReport* report, char* name)
+{
+    for (int i = 0; i < Arraylist_size(report->phases); i++) {
+        Phase* phase = Arraylist_get(report->phases, i);
+        if (strcmp(phase->name, name) == 0)
+            return phase->wall_ms;
+    }
+    return 0;
+}
+
+// Items per second, tokens are rated against lexing and output bytes
+// against the whole compile
+double report_rate(long count, double ms)
+{
+    return ms > 0 ? count / (ms / 1000.0) : 0;
+}
+
+void report_print_phase(FILE* out, Phase* phase)
+{
+    fprintf(out, "%-10s %10.3f %10.3f %10ld %10ld %12ld\n", phase->name, phase->wall_ms,
+        phase->cpu_ms, phase->rss_delta_kb, phase->allocations, phase->bytes);
+}
+
+void TimeReport_print(TimeReport* report, FILE* out)
+{
+    Phase total = report_total(report);
+
+    fprintf(out, "%-10s %10s %10s %10s %10s %12s\n", "phase", "wall ms", "cpu ms", "rss kb", "allocs", "bytes");
+    for (int i = 0; i < Arraylist_size(report->phases); i++)
+        report_print_phase(out, Arraylist_get(report->phases, i));
+    report_print_phase(out, &total);
+
+    fprintf(out, "%ld tokens, %.0f tokens/s\n", report->tokens,
+        report_rate(report->tokens, report_phase_wall_ms(report, "lex")));
+    fprintf(out, "%ld output bytes, %.0f bytes/s\n", report->output_bytes,
+        report_rate(report->output_bytes, total.wall_ms));
+}
+
+void report_write_json_phase(FILE* out, Phase* phase)
+{
+    fprintf(out, "{\"name\": \"%s\", \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"rss_delta_kb\": %ld, \"allocations\": %ld, \"bytes\": %ld}",
+        phase->name, phase->wall_ms, phase->cpu_ms, phase->rss_delta_kb, phase->allocations, phase->bytes);
+}
+
+void TimeReport_write_json(TimeReport* report, FILE* out)
+{
+    Phase total = report_total(report);
+
+    fprintf(out, "{\n  \"phases\": [\n");
+    for (int i = 0; i < Arraylist_size(report->phases); i++) {
+        fprintf(out, "    ");
+        report_write_json_phase(out, Arraylist_get(report->phases, i));
+        fprintf(out, i+1 < Arraylist_size(report->phases) ? ",\n" : "\n");
+    }
+    fprintf(out, "  ],\n  \"total\": ");
+    report_write_json_phase(out, &total);
+    fprintf(out, ",\n  \"tokens\": %ld,\n  \"tokens_per_sec\": %.0f,\n", report->tokens,
+        report_rate(report->tokens, report_phase_wall_ms(report, "lex")));
+    fprintf(out, "  \"output_bytes\": %ld,\n  \"output_bytes_per_sec\": %.0f\n}\n", report->output_bytes,
+        report_rate(report->output_bytes, total.wall_ms));
+}
+
+void TimeReport_free(TimeReport* report)
+{
+    if (report->current != NULL)
+        Phase_free(report->current);
+    Arraylist_free(report->phases);
+    free(report);
+}
@@ -0,0 +1,48 @@
+#ifndef TIMEREPORT_H
+#define TIMEREPORT_H
+
+#include "arraylist.h"
+
+#include <stdio.h>
+
+struct phase
+{
+    char* name;
+    double wall_ms;
+    double cpu_ms;
+    // Growth of the peak resident set while the phase ran
+    long rss_delta_kb;
+    long allocations;
+    long bytes;
+};
+
+typedef struct phase Phase;
+
+// Measures consecutive phases of a compile, start a phase and stop it when
+// the work is done
+struct time_report
+{
+    // Phase*, in the order they ran
+    Arraylist* phases;
+    Phase* current;
+    double start_wall;
+    double start_cpu;
+    long start_rss;
+    long start_allocations;
+    long start_bytes;
+    long tokens;
+    long output_bytes;
+};
+
+typedef struct time_report TimeReport;
+
+TimeReport* TimeReport_new();
+// Starting a phase stops the current one. A phase started again under the
+// same name adds to its earlier row
+void TimeReport_start(TimeReport* report, char* name);
+void TimeReport_stop(TimeReport* report);
+void TimeReport_print(TimeReport* report, FILE* out);
+void TimeReport_write_json(TimeReport* report, FILE* out);
+void TimeReport_free(TimeReport* report);
+
+#endif
@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+
+#define ALLOC_SUBSYSTEM LexerAlloc
+#include "alloc.h"
 
 Token* Token_new(TokenType type, char* name, int line, int column) 
 {
@@ -10,10 +14,38 @@ Token* Token_new(TokenType type, char* name, int line, int column)
     t->line = line;
     t->column = column;
     t->name = name;
+    t->number.is_float = false;
+    t->number.as.i = 0;
+    return t;
+}
+
+Token* Token_new_number(NumberValue number, int line, int column)
+{
+    Token* t = Token_new(Number, NULL, line, column);
+    t->number = number;
+    return t;
+}
+
+// Writes the value the way NNI expects it, floats always keep a decimal point
+// and use the shortest form that reads back as the same double
+void NumberValue_format(NumberValue number, char* buf)
+{
+    if (!number.is_float) {
+        snprintf(buf, NUMBER_TEXT_SIZE, "%lld", (long long)number.as.i);
+        return;
+    }
+
+    snprintf(buf, NUMBER_TEXT_SIZE, "%.15g", number.as.f);
+    if (strtod(buf, NULL) != number.as.f)
+        snprintf(buf, NUMBER_TEXT_SIZE, "%.17g", number.as.f);
+
+    if (strpbrk(buf, ".en") == NULL)
+        strcat(buf, ".0");
 }
 
-void Token_free(Token* tk)
+void Token_free(void* ptr)
 {
+    Token* tk = (Token*)ptr;
     free(tk->name);
     free(tk);
 }
\ No newline at end of file
@@ -1,7 +1,12 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #define MAX_NAME_SIZE 40
+// Longest text NumberValue_format writes, terminator included
+#define NUMBER_TEXT_SIZE 32
 
 enum tokentype
 {
@@ -60,17 +65,33 @@ enum tokentype
 
 typedef enum tokentype TokenType;
 
+struct number_value
+{
+    bool is_float;
+    union
+    {
+        int64_t i;
+        double f;
+    } as;
+};
+
+typedef struct number_value NumberValue;
+
 struct token
 {
     int line;
     int column;
     TokenType type;
+    // NULL for numbers, which carry their parsed value instead
     char* name;
+    NumberValue number;
 };
 
 typedef struct token Token;
 
 Token* Token_new(TokenType type, char* name, int line, int column);
-void Token_free(Token* tk);
+Token* Token_new_number(NumberValue number, int line, int column);
+void Token_free(void* ptr);
+void NumberValue_format(NumberValue number, char* buf);
 
 #endif
\ No newline at end of file
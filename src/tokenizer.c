@@ -3,16 +3,24 @@
 #include "token.h"
 #include "panic.h"
 #include "stringbuilder.h"
+#include "workpool.h"
 
+#include <errno.h>
+#include <math.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 
+#define ALLOC_SUBSYSTEM LexerAlloc
+#include "alloc.h"
+
 #define UNEXPECTED_TOKEN(position) \
 panic("Unexpected token %i at line: %i:%i:%i", (int)tokens[position], line, col, pos);
 
 #define IS_NUMERIC(x) (x >= '0' && x <= '9')
 
+#define IS_HEX(x) (IS_NUMERIC(x) || (x >= 'a' && x <= 'f') || (x >= 'A' && x <= 'F'))
+
 #define IS_ALPHA(x) (x >= 'A' && x <= 'Z') ||\
                     (x >= 'a' && x <= 'z')
 
@@ -36,28 +44,73 @@ if (tokens[position] == matcher) {\
     ADVANCE(1)\
 }
 
+// Matches a keyword at pos that is not the prefix of a longer identifier.
+// Only looks at the characters it needs, the source can be long
 bool compare(char* str1, const char* str2, int pos)
 {
     int i = 0;
-    for (; i < strlen(str2); ++i)
+    for (; str2[i]; ++i)
         if (str1[pos+i] != str2[i])
             return false;
-    if (strlen(str1) > strlen(str2) + pos && IS_ALPHANUMERIC(str1[pos+i])) {
-        return false;
+    return !(IS_ALPHANUMERIC(str1[pos+i]));
+}
+
+// Scans an integer, float (1.5, 2e10) or hex (0xff) literal starting at str
+// and parses it in the same pass, returns the number of characters used.
+// Panics on a literal that does not fit, line and col are where it starts
+int scan_number(char* str, NumberValue* number, int line, int col)
+{
+    char* end;
+    int i = 0;
+
+    errno = 0;
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X') && IS_HEX(str[2])) {
+        number->is_float = false;
+        number->as.i = (int64_t)strtoull(str + 2, &end, 16);
+        if (errno == ERANGE)
+            panic("Number out of range at line: %i:%i", line, col);
+        return end - str;
     }
-    return true;
+
+    while (IS_NUMERIC(str[i]))
+        ++i;
+
+    bool fraction = str[i] == '.' && IS_NUMERIC(str[i+1]);
+    int exponent = fraction ? i+1 : i;
+    while (fraction && IS_NUMERIC(str[exponent]))
+        ++exponent;
+    bool has_exponent = (str[exponent] == 'e' || str[exponent] == 'E')
+        && (IS_NUMERIC(str[exponent+1]) || ((str[exponent+1] == '+' || str[exponent+1] == '-') && IS_NUMERIC(str[exponent+2])));
+
+    number->is_float = fraction || has_exponent;
+    if (number->is_float)
+        number->as.f = strtod(str, &end);
+    else
+        number->as.i = strtoll(str, &end, 10);
+
+    // A float too small for a double is read as 0 or a denormal, only one
+    // too large for it is an error
+    if (errno == ERANGE && (!number->is_float || number->as.f == HUGE_VAL))
+        panic("Number out of range at line: %i:%i", line, col);
+
+    return end - str;
 }
 
-Arraylist* tokenize(char* tokens) 
+// Tokenizes from where the lexer stopped, up to the end of the source or,
+// with one_function, up to the brace that closes the next function
+Arraylist* lex(Lexer* lexer, bool one_function)
 {
     Arraylist* token_list = Arraylist_new(Token_free);
-    int size = strlen(tokens);           
+    char* tokens = lexer->source;
+    int size = lexer->size;
 
-    int line = 1;
-    int col = 1;
-    int pos = 0;
+    int line = lexer->line;
+    int col = lexer->col;
+    int pos = lexer->pos;
+    int depth = 0;
+    bool done = false;
 
-    while (pos < size) {
+    while (pos < size && !done) {
 
         if (IS_WHITESPACE(tokens[pos])) {
             
@@ -111,18 +164,11 @@ Arraylist* tokenize(char* tokens)
         }
         else if (IS_NUMERIC(tokens[pos])) {
             
-            int i = 0;
-
-            StringBuilder *sb = StringBuilder_new();
-
-            for (; IS_NUMERIC(tokens[pos+i]); ++i) {
-                StringBuilder_add(sb, tokens[pos+i]);
-            }
+            NumberValue number;
+            int i = scan_number(tokens + pos, &number, line, col);
             
             ADVANCE(i)
-            Arraylist_add(token_list, Token_new(Number, StringBuilder_get(sb), line, col));
-
-            StringBuilder_free(sb);
+            Arraylist_add(token_list, Token_new_number(number, line, col));
         }
         else {
             switch (tokens[pos])
@@ -216,10 +262,13 @@ Arraylist* tokenize(char* tokens)
             case '{':
                 Arraylist_add(token_list, Token_new(OpenBrace, NULL, line, col));
                 ADVANCE(1)
+                ++depth;
                 break;
             case '}':
                 Arraylist_add(token_list, Token_new(CloseBrace, NULL, line, col));
                 ADVANCE(1)
+                --depth;
+                done = one_function && depth == 0;
                 break;
             case ',':
                 Arraylist_add(token_list, Token_new(Comma, NULL, line, col));
@@ -230,6 +279,8 @@ Arraylist* tokenize(char* tokens)
                 StringBuilder* sb = StringBuilder_new();
                 ADVANCE(1)
                 while(tokens[pos] != '"') {
+                    if (tokens[pos] == '\0')
+                        panic("Unterminated string at line: %i:%i:%i", line, col, pos);
                     StringBuilder_add(sb, tokens[pos]);
                     ADVANCE(1)
                 }
@@ -244,5 +295,184 @@ Arraylist* tokenize(char* tokens)
         }
     }
 
+    lexer->line = line;
+    lexer->col = col;
+    lexer->pos = pos;
     return token_list;
+}
+
+Arraylist* tokenize(char* tokens) 
+{
+    Lexer lexer = { tokens, strlen(tokens), 0, 1, 1 };
+    return lex(&lexer, false);
+}
+
+// Chunks per thread, a few more than one even out chunks that lex slower
+#define LEX_CHUNKS_PER_THREAD 4
+// Chunks are never smaller than this, a thread costs more than lexing less
+#define LEX_MIN_CHUNK_SIZE 65536
+
+// A piece of the source that starts right after a newline, lexed as if no
+// string was open there. Its lines are counted from 0
+struct lex_chunk
+{
+    int start;
+    int end;
+    Arraylist* tokens;
+    // State the lexer was left in, pos can be past end when a string ran on
+    int end_pos;
+    int end_line;
+    int end_col;
+    bool failed;
+};
+
+typedef struct lex_chunk LexChunk;
+
+struct lex_chunks
+{
+    char* source;
+    LexChunk* chunks;
+};
+
+typedef struct lex_chunks LexChunks;
+
+void lex_chunk(void* arg, int index)
+{
+    LexChunks* lc = arg;
+    LexChunk* chunk = &lc->chunks[index];
+    Lexer lexer = { lc->source, chunk->end, chunk->start, 0, 1 };
+    PanicHandler handler;
+
+    // A chunk that really starts inside a string can fail where the serial
+    // lexer would not, it is lexed again in tokenize_parallel
+    if (setjmp(handler.env) != 0) {
+        chunk->failed = true;
+        return;
+    }
+
+    panic_push_handler(&handler);
+    chunk->tokens = lex(&lexer, false);
+    panic_pop_handler();
+
+    chunk->end_pos = lexer.pos;
+    chunk->end_line = lexer.line;
+    chunk->end_col = lexer.col;
+}
+
+Arraylist* tokenize_parallel(char* source, int threads)
+{
+    int size = strlen(source);
+    int count = threads * LEX_CHUNKS_PER_THREAD;
+    if (count > size / LEX_MIN_CHUNK_SIZE)
+        count = size / LEX_MIN_CHUNK_SIZE;
+    if (threads <= 1 || count <= 1)
+        return tokenize(source);
+
+    LexChunks lc;
+    lc.source = source;
+    lc.chunks = calloc(count, sizeof(LexChunk));
+
+    int start = 0;
+    for (int i = 0; i < count; i++) {
+        int end = i == count - 1 ? size : (int)((long)size * (i + 1) / count);
+        while (end < size && source[end - 1] != '\n')
+            end++;
+        lc.chunks[i].start = start;
+        lc.chunks[i].end = end > start ? end : start;
+        start = lc.chunks[i].end;
+    }
+
+    WorkPool_run(threads, count, lex_chunk, &lc);
+
+    // Stitches the chunks in order, following the serial lexer. A chunk is
+    // only taken when the lexer really was at its start, at the start of a
+    // line; after a string that ran on, or a failure, that part is lexed
+    // again serially from the real state, which also gives the same error
+    long total = 0;
+    for (int i = 0; i < count; i++)
+        if (!lc.chunks[i].failed)
+            total += Arraylist_size(lc.chunks[i].tokens);
+
+    Arraylist* token_list = Arraylist_new_with_size(Token_free, total > 0 ? total : 1);
+    Lexer lexer = { source, size, 0, 1, 1 };
+
+    for (int i = 0; i < count; i++) {
+        LexChunk* chunk = &lc.chunks[i];
+        Arraylist* tokens = chunk->tokens;
+        bool usable = !chunk->failed && lexer.pos == chunk->start && lexer.col == 1;
+
+        if (usable) {
+            for (int t = 0; t < Arraylist_size(tokens); t++) {
+                Token* token = Arraylist_get(tokens, t);
+                token->line += lexer.line;
+                Arraylist_add(token_list, token);
+            }
+            lexer.pos = chunk->end_pos;
+            lexer.line += chunk->end_line;
+            lexer.col = chunk->end_col;
+            // The tokens moved to token_list
+            tokens->size = 0;
+        }
+        else if (lexer.pos < chunk->end) {
+            lexer.size = chunk->end;
+            Arraylist* rescanned = lex(&lexer, false);
+            for (int t = 0; t < Arraylist_size(rescanned); t++)
+                Arraylist_add(token_list, Arraylist_get(rescanned, t));
+            rescanned->size = 0;
+            Arraylist_free(rescanned);
+        }
+
+        if (tokens != NULL)
+            Arraylist_free(tokens);
+    }
+
+    free(lc.chunks);
+    return token_list;
+}
+
+Lexer* Lexer_new(char* source)
+{
+    Lexer* lexer = malloc(sizeof(Lexer));
+    lexer->source = source;
+    lexer->size = strlen(source);
+    lexer->pos = 0;
+    lexer->line = 1;
+    lexer->col = 1;
+    return lexer;
+}
+
+Arraylist* Lexer_next_function(Lexer* lexer)
+{
+    Arraylist* tokens = lex(lexer, true);
+
+    if (Arraylist_size(tokens) == 0) {
+        Arraylist_free(tokens);
+        return NULL;
+    }
+
+    return tokens;
+}
+
+void Lexer_free(Lexer* lexer)
+{
+    free(lexer);
+}
+
+Arraylist* tokenize_imports(char* source)
+{
+    Lexer* lexer = Lexer_new(source);
+    Arraylist* tokens = Lexer_next_function(lexer);
+    Arraylist* imports = Arraylist_new(free);
+
+    for (int i = 0; tokens != NULL && i + 1 < Arraylist_size(tokens); i += 2) {
+        Token* tk = Arraylist_get(tokens, i);
+        if (tk->type != Import)
+            break;
+        Arraylist_add(imports, String_from(((Token*)Arraylist_get(tokens, i + 1))->name));
+    }
+
+    if (tokens != NULL)
+        Arraylist_free(tokens);
+    Lexer_free(lexer);
+    return imports;
 }
\ No newline at end of file
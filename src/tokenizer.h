@@ -3,6 +3,33 @@
 
 #include "arraylist.h"
 
+// Position in a source that is tokenized a piece at a time
+struct lexer
+{
+    char* source;
+    int size;
+    int pos;
+    int line;
+    int col;
+};
+
+typedef struct lexer Lexer;
+
 Arraylist* tokenize(char* tokens);
+// Same tokens as tokenize, for large sources lexed in chunks on up to
+// threads threads. Chunks start after a newline; where a string literal runs
+// over a chunk end, the chunks after it are lexed again once the real state
+// there is known
+Arraylist* tokenize_parallel(char* source, int threads);
+
+Lexer* Lexer_new(char* source);
+// Tokens up to the closing brace of the next top level function, together
+// with anything in front of it (the imports). NULL once the source is used up
+Arraylist* Lexer_next_function(Lexer* lexer);
+void Lexer_free(Lexer* lexer);
+
+// char*, names of the modules the source imports. Imports come before the
+// first function, so only that much is lexed
+Arraylist* tokenize_imports(char* source);
 
 #endif
\ No newline at end of file
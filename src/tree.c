@@ -1,9 +1,13 @@
 #include "tree.h"
 #include "panic.h"
 #include "token.h"
+#include "stringbuilder.h"
 
 #include <stdlib.h>
 
+#define ALLOC_SUBSYSTEM TreeAlloc
+#include "alloc.h"
+
 #ifdef DEBUG
 
 #endif
@@ -43,8 +47,9 @@ GenericNode* GenericNode_new(NodeType type, void* ptr)
     return gn;
 }
 
-void GenericNode_free(GenericNode* gn)
+void GenericNode_free(void* ptr)
 {
+    GenericNode* gn = (GenericNode*)ptr;
     switch (gn->type)
     {
     case VariableNode_t:
@@ -91,6 +96,41 @@ void GenericNode_free(GenericNode* gn)
     free(gn);
 }
 
+// Deep copy of the nodes that can appear inside an expression
+GenericNode* GenericNode_copy(GenericNode* gn)
+{
+    VariableNode* vn;
+    LiteralNode* ln;
+    OperatorNode* on;
+    CallNode* cn;
+    CallNode* copy;
+
+    switch (gn->type)
+    {
+    case VariableNode_t:
+        vn = (VariableNode*)gn->node;
+        return GenericNode_new(VariableNode_t, VariableNode_new(String_from(vn->name), vn->scope ? String_from(vn->scope) : NULL, vn->type));
+    case LiteralNode_t:
+        ln = (LiteralNode*)gn->node;
+        return GenericNode_new(LiteralNode_t, LiteralNode_copy(ln));
+    case OperatorNode_t:
+        on = OperatorNode_new(((OperatorNode*)gn->node)->op_t);
+        on->type = ((OperatorNode*)gn->node)->type;
+        return GenericNode_new(OperatorNode_t, on);
+    case CallNode_t:
+        cn = (CallNode*)gn->node;
+        copy = CallNode_new(String_from(cn->name));
+        for (int i = 0; i < Arraylist_size(cn->args); i++)
+            CallNode_add_arg(copy, GenericNode_copy(Arraylist_get(cn->args, i)));
+        return GenericNode_new(CallNode_t, copy);
+    default:
+        panic("Invalid node, report bug: https://github.com/alexburroughs/BC-2/issues");
+        break;
+    }
+
+    return NULL;
+}
+
 NodeType GenericNode_get_last_node_type(GenericNode* gn)
 {
     switch(gn->type) {
@@ -138,9 +178,50 @@ LiteralNode* LiteralNode_new(char* name, Type type)
     LiteralNode* ln = malloc(sizeof(LiteralNode));
     ln->name = name;
     ln->type = type;
+    ln->value.is_float = false;
+    ln->value.as.i = 0;
+    return ln;
+}
+
+LiteralNode* LiteralNode_new_number(NumberValue value)
+{
+    LiteralNode* ln = LiteralNode_new(NULL, value.is_float ? F64_t : I32_t);
+    ln->value = value;
     return ln;
 }
 
+LiteralNode* LiteralNode_copy(LiteralNode* ln)
+{
+    LiteralNode* copy = LiteralNode_new(ln->name ? String_from(ln->name) : NULL, ln->type);
+    copy->value = ln->value;
+    return copy;
+}
+
+// Text of the literal as NNI takes it, without quotes for strings
+char* LiteralNode_text(LiteralNode* ln)
+{
+    char buf[NUMBER_TEXT_SIZE];
+
+    if (ln->name != NULL)
+        return String_from(ln->name);
+
+    NumberValue_format(ln->value, buf);
+    return String_from(buf);
+}
+
+void LiteralNode_append(StringBuilder* sb, LiteralNode* ln)
+{
+    char buf[NUMBER_TEXT_SIZE];
+
+    if (ln->name != NULL) {
+        StringBuilder_add_arr(sb, ln->name);
+        return;
+    }
+
+    NumberValue_format(ln->value, buf);
+    StringBuilder_add_arr(sb, buf);
+}
+
 void LiteralNode_free(LiteralNode* ln) 
 {
     free(ln->name);
@@ -186,10 +267,57 @@ void ExpressionNode_add(ExpressionNode *en, GenericNode *gn)
     Arraylist_add(en->nodes, gn);
 }
 
+// For every node of the postfix list, the index where its subtree starts
+int* ExpressionNode_subtree_starts(ExpressionNode *en)
+{
+    int size = Arraylist_size(en->nodes);
+    int* starts = malloc(sizeof(int) * (size+1));
+    int* stack = malloc(sizeof(int) * (size+1));
+    int top = 0;
+
+    for (int i = 0; i < size; i++) {
+        GenericNode* gn = Arraylist_get(en->nodes, i);
+        int arity = 0;
+
+        if (gn->type == OperatorNode_t)
+            arity = ((OperatorNode*)gn->node)->op_t == Not_t ? 1 : 2;
+
+        if (top < arity)
+            panic("Malformed expression, report bug: https://github.com/alexburroughs/BC-2/issues");
+
+        top -= arity;
+        starts[i] = arity ? stack[top] : i;
+        stack[top++] = starts[i];
+    }
+
+    free(stack);
+    return starts;
+}
+
+ExpressionNode* ExpressionNode_copy_range(ExpressionNode *en, int start, int end)
+{
+    ExpressionNode* copy = ExpressionNode_new();
+
+    for (int i = start; i <= end; i++)
+        ExpressionNode_add(copy, GenericNode_copy(Arraylist_get(en->nodes, i)));
+
+    return copy;
+}
+
+// Replaces the nodes from start to end with a single node
+void ExpressionNode_replace_range(ExpressionNode *en, int start, int end, GenericNode *gn)
+{
+    for (int i = end; i >= start; i--)
+        Arraylist_remove(en->nodes, i);
+
+    Arraylist_insert(en->nodes, gn, start);
+}
+
 OperatorNode* OperatorNode_new(OpType opt)
 {
     OperatorNode *op = malloc(sizeof(OperatorNode));
     op->op_t = opt;
+    op->type = Void_t;
     return op;
 }
 
@@ -215,6 +343,7 @@ void FunctionNode_free(FunctionNode *fn)
     if (fn->name)
         free(fn->name);
     Arraylist_free(fn->statements);
+    Arraylist_free(fn->args);
     free(fn);
 }
 
@@ -332,7 +461,7 @@ CallNode* CallNode_new(char* name)
     CallNode* cn = malloc(sizeof(CallNode));
 
     cn->name = name;
-    cn->args = Arraylist_new(free);
+    cn->args = Arraylist_new(GenericNode_free);
 
     return cn;
 }
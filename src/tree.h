@@ -5,6 +5,7 @@
 #include "hashmap.h"
 #include "type.h"
 #include "token.h"
+#include "stringbuilder.h"
 
 enum node_type
 {
@@ -38,6 +39,9 @@ enum op_type
     NotEqual_t, //11
     Not_t, //12
     Equal_t, //13
+    Shl_t, //14
+    Shr_t, //15
+    BitAnd_t, //16
 };
 
 typedef enum node_type NodeType;
@@ -121,13 +125,17 @@ typedef struct call_node CallNode;
 struct operator_node
 {
     OpType op_t;
+    // Type of both operands when the type checker could prove it, Void_t otherwise
+    Type type;
 };
 typedef struct operator_node OperatorNode;
 
 struct literal_node
 {
+    // Text of string literals, NULL for numbers
     char* name;
     Type type;
+    NumberValue value;
 };
 typedef struct literal_node LiteralNode;
 
@@ -139,13 +147,17 @@ typedef struct return_node ReturnNode;
 
 OpType from_token(TokenType tok);
 GenericNode* GenericNode_new(NodeType type, void* ptr);
-void GenericNode_free(GenericNode* gn);
+void GenericNode_free(void* ptr);
+GenericNode* GenericNode_copy(GenericNode* gn);
 void GenericNode_add_statement(GenericNode* gn, GenericNode* statement);
 NodeType GenericNode_get_last_node_type(GenericNode* gn);
 VariableNode* VariableNode_new(char* name, char* scope, Type type);
 void VariableNode_free(VariableNode *vn);
 ExpressionNode* ExpressionNode_new();
 void ExpressionNode_free(ExpressionNode *en);
+int* ExpressionNode_subtree_starts(ExpressionNode *en);
+ExpressionNode* ExpressionNode_copy_range(ExpressionNode *en, int start, int end);
+void ExpressionNode_replace_range(ExpressionNode *en, int start, int end, GenericNode *gn);
 FunctionNode* FunctionNode_new(char* name);
 void FunctionNode_free(FunctionNode *fn);
 void FunctionNode_add_arg(FunctionNode *fn, VariableNode *vn);
@@ -167,6 +179,10 @@ OperatorNode* OperatorNode_new(OpType opt);
 void OperatorNode_free(OperatorNode *op);
 void ExpressionNode_add(ExpressionNode *en, GenericNode *gn);
 LiteralNode* LiteralNode_new(char* name, Type type);
+LiteralNode* LiteralNode_new_number(NumberValue value);
+LiteralNode* LiteralNode_copy(LiteralNode* ln);
+char* LiteralNode_text(LiteralNode* ln);
+void LiteralNode_append(StringBuilder* sb, LiteralNode* ln);
 void LiteralNode_free(LiteralNode* ln);
 ReturnNode* ReturnNode_new(char* name);
 void ReturnNode_free(ReturnNode* rn) ;
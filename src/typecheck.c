@@ -0,0 +1,373 @@
+#include "typecheck.h"
+#include "simplify.h"
+#include "ast.h"
+#include "tree.h"
+#include "type.h"
+#include "hashmap.h"
+#include "arraylist.h"
+#include "panic.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define ALLOC_SUBSYSTEM PassesAlloc
+#include "alloc.h"
+
+// Void_t never describes a value, so it marks an unknown type. Calls are
+// always unknown, the VM converts their result when it is stored
+#define UNKNOWN_TYPE Void_t
+
+char* typecheck_type_names[] = {"i64", "i32", "i16", "i8", "u64", "u32", "u16", "u8", "f64", "f32", "char", "void"};
+
+struct typecheck_state
+{
+    char* fn_name;
+    // Type* by variable name
+    Hashmap* types;
+    // DeclarationNode* of compiler temporaries, whose type is inferred
+    Hashmap* temporaries;
+    // ExpressionNode*, values of temporaries no type holds, put back where
+    // the temporary was used
+    Hashmap* inlined;
+    int typed;
+};
+
+typedef struct typecheck_state TypecheckState;
+
+struct typecheck_value
+{
+    Type type;
+    // Set when the value is an integer literal that can still take another type
+    LiteralNode* literal;
+    // Narrowest type that holds every value this can have, what a compiler
+    // temporary storing it is declared as. Known for mixed operands too
+    Type stored;
+};
+
+typedef struct typecheck_value TypecheckValue;
+
+void typecheck_expression_free(void* ptr)
+{
+    ExpressionNode_free((ExpressionNode*)ptr);
+}
+
+void typecheck_declare(TypecheckState* state, char* name, Type type)
+{
+    Type* t = malloc(sizeof(Type));
+    *t = type;
+    Hashmap_insert_or_set(state->types, name, t);
+}
+
+Type typecheck_lookup(TypecheckState* state, char* name)
+{
+    Type* type = Hashmap_get(state->types, name);
+    return type ? *type : UNKNOWN_TYPE;
+}
+
+void typecheck_error(TypecheckState* state, char* what, Type left, Type right)
+{
+    panic("Type error in %s: %s %s and %s", state->fn_name, what, typecheck_type_names[left], typecheck_type_names[right]);
+}
+
+// Strings only combine with strings, unknown types combine with anything
+bool typecheck_compatible(Type left, Type right)
+{
+    return left == UNKNOWN_TYPE || right == UNKNOWN_TYPE || (left == Char_t) == (right == Char_t);
+}
+
+// An integer literal next to a known numeric value takes its type, like in C,
+// unless the type cannot hold it. Then the operation stays untyped and the VM
+// converts
+void typecheck_unify_literal(TypecheckValue* value, Type other)
+{
+    if (value->literal != NULL && other != UNKNOWN_TYPE && IS_NUMERIC_TYPE(other)
+        && (!IS_INTEGER_LITERAL_TYPE(other) || simplify_fits(value->literal->value.as.i, other))) {
+        value->literal->type = other;
+        value->type = other;
+        value->stored = other;
+    }
+}
+
+int typecheck_bits(Type type)
+{
+    switch (type) {
+    case I64_t: case U64_t: return 64;
+    case I32_t: case U32_t: return 32;
+    case I16_t: case U16_t: return 16;
+    default: return 8;
+    }
+}
+
+// The narrowest type holding every value of both, like C's conversions
+// except that signed and unsigned meet in a wider signed type. Floats meet
+// in F64. Nothing holds both u64 and a signed type
+Type typecheck_widest(Type left, Type right)
+{
+    if (left == right)
+        return left;
+    if (left == UNKNOWN_TYPE || right == UNKNOWN_TYPE || !IS_NUMERIC_TYPE(left) || !IS_NUMERIC_TYPE(right))
+        return UNKNOWN_TYPE;
+    if (!IS_INTEGER_LITERAL_TYPE(left) || !IS_INTEGER_LITERAL_TYPE(right))
+        return F64_t;
+
+    bool left_unsigned = left >= U64_t;
+    bool right_unsigned = right >= U64_t;
+    if (left_unsigned == right_unsigned)
+        return typecheck_bits(left) >= typecheck_bits(right) ? left : right;
+
+    Type uns = left_unsigned ? left : right;
+    Type sig = left_unsigned ? right : left;
+    if (typecheck_bits(sig) > typecheck_bits(uns))
+        return sig;
+
+    switch (uns) {
+    case U32_t: return I64_t;
+    case U16_t: return I32_t;
+    case U8_t: return I16_t;
+    default: return UNKNOWN_TYPE;
+    }
+}
+
+bool typecheck_is_boolean(OpType op)
+{
+    return op >= And_t && op <= Equal_t;
+}
+
+TypecheckValue typecheck_leaf(TypecheckState* state, GenericNode* gn)
+{
+    TypecheckValue value;
+    LiteralNode* ln;
+
+    value.type = UNKNOWN_TYPE;
+    value.literal = NULL;
+
+    switch (gn->type) {
+    case VariableNode_t:
+        value.type = typecheck_lookup(state, ((VariableNode*)gn->node)->name);
+        break;
+    case LiteralNode_t:
+        ln = (LiteralNode*)gn->node;
+        value.type = ln->type;
+        if (IS_INTEGER_LITERAL_TYPE(ln->type))
+            value.literal = ln;
+        break;
+    default:
+        break;
+    }
+
+    value.stored = value.type;
+    return value;
+}
+
+// Puts the value of every inlined temporary back in place of its name
+void typecheck_inline(TypecheckState* state, ExpressionNode* en)
+{
+    if (state->inlined->size == 0)
+        return;
+
+    for (int i = 0; i < Arraylist_size(en->nodes); i++) {
+        GenericNode* gn = Arraylist_get(en->nodes, i);
+        if (gn->type != VariableNode_t)
+            continue;
+
+        ExpressionNode* value = Hashmap_get(state->inlined, ((VariableNode*)gn->node)->name);
+        if (value == NULL)
+            continue;
+
+        Arraylist_remove(en->nodes, i);
+        for (int j = 0; j < Arraylist_size(value->nodes); j++)
+            Arraylist_insert(en->nodes, GenericNode_copy(Arraylist_get(value->nodes, j)), i + j);
+        i += Arraylist_size(value->nodes) - 1;
+    }
+}
+
+TypecheckValue typecheck_value(TypecheckState* state, ExpressionNode* en)
+{
+    typecheck_inline(state, en);
+
+    TypecheckValue value;
+    int size = Arraylist_size(en->nodes);
+    if (size == 0) {
+        value.type = UNKNOWN_TYPE;
+        value.literal = NULL;
+        value.stored = UNKNOWN_TYPE;
+        return value;
+    }
+
+    TypecheckValue* stack = malloc(sizeof(TypecheckValue) * size);
+    int top = 0;
+
+    for (int i = 0; i < size; i++) {
+        GenericNode* gn = Arraylist_get(en->nodes, i);
+
+        if (gn->type != OperatorNode_t) {
+            stack[top++] = typecheck_leaf(state, gn);
+            continue;
+        }
+
+        OperatorNode* on = (OperatorNode*)gn->node;
+        TypecheckValue result;
+        result.literal = NULL;
+
+        if (on->op_t == Not_t) {
+            result.type = I32_t;
+            result.stored = I32_t;
+            stack[top-1] = result;
+            continue;
+        }
+
+        TypecheckValue right = stack[--top];
+        TypecheckValue left = stack[--top];
+
+        if (!typecheck_compatible(left.type, right.type))
+            typecheck_error(state, "cannot combine", left.type, right.type);
+
+        if (left.literal == NULL)
+            typecheck_unify_literal(&right, left.type);
+        if (right.literal == NULL)
+            typecheck_unify_literal(&left, right.type);
+
+        // Mixed widths stay untyped so the VM still converts them
+        if (left.type == right.type && left.type != UNKNOWN_TYPE && IS_NUMERIC_TYPE(left.type)) {
+            on->type = left.type;
+            state->typed++;
+        }
+
+        if (typecheck_is_boolean(on->op_t)) {
+            result.type = I32_t;
+            result.stored = I32_t;
+        }
+        else {
+            result.type = left.type == right.type ? left.type : UNKNOWN_TYPE;
+            result.stored = typecheck_widest(left.stored, right.stored);
+        }
+
+        stack[top++] = result;
+    }
+
+    value = stack[top-1];
+    free(stack);
+    return value;
+}
+
+Type typecheck_expression(TypecheckState* state, ExpressionNode* en)
+{
+    return typecheck_value(state, en).type;
+}
+
+// Returns false when the assignment is to a temporary no type can hold,
+// whose value then goes back to where the temporary is used
+bool typecheck_assignment(TypecheckState* state, AssignmentNode* an)
+{
+    Type declared = typecheck_lookup(state, an->left);
+    TypecheckValue result = typecheck_value(state, an->right);
+    Type value = result.type;
+    DeclarationNode* temporary = Hashmap_get(state->temporaries, an->left);
+
+    if (temporary != NULL && result.stored == UNKNOWN_TYPE) {
+        int size = Arraylist_size(an->right->nodes);
+        Hashmap_insert(state->inlined, an->left, ExpressionNode_copy_range(an->right, 0, size-1));
+        return false;
+    }
+
+    if (temporary != NULL) {
+        temporary->type = result.stored;
+        typecheck_declare(state, an->left, result.stored);
+        return true;
+    }
+
+    if (!typecheck_compatible(declared, value))
+        typecheck_error(state, "cannot assign", value, declared);
+
+    if (Arraylist_size(an->right->nodes) == 1) {
+        TypecheckValue single = typecheck_leaf(state, Arraylist_get(an->right->nodes, 0));
+        if (single.literal != NULL && IS_INTEGER_LITERAL_TYPE(declared) && !simplify_fits(single.literal->value.as.i, declared))
+            panic("Type error in %s: %lld does not fit %s", state->fn_name, (long long)single.literal->value.as.i, typecheck_type_names[declared]);
+        typecheck_unify_literal(&single, declared);
+    }
+    return true;
+}
+
+// Drops the temporary's declaration and the assignment at index, returns
+// the index of the statement before the assignment
+int typecheck_drop_temporary(TypecheckState* state, Arraylist* statements, int index, char* name)
+{
+    DeclarationNode* dn = Hashmap_get(state->temporaries, name);
+
+    Arraylist_remove(statements, index);
+    for (int i = index-1; i >= 0; i--) {
+        GenericNode* gn = Arraylist_get(statements, i);
+        if (gn->type == DeclarationNode_t && gn->node == dn) {
+            Arraylist_remove(statements, i);
+            index--;
+            break;
+        }
+    }
+    return index-1;
+}
+
+void typecheck_block(TypecheckState* state, Arraylist* statements)
+{
+    for (int i = 0; i < Arraylist_size(statements); i++) {
+        GenericNode* gn = Arraylist_get(statements, i);
+        DeclarationNode* dn;
+
+        switch (gn->type) {
+        case DeclarationNode_t:
+            dn = (DeclarationNode*)gn->node;
+            typecheck_declare(state, dn->name, dn->type);
+            // Names of compiler temporaries contain a space
+            if (strchr(dn->name, ' ') != NULL)
+                Hashmap_insert_or_set(state->temporaries, dn->name, dn);
+            break;
+        case AssignmentNode_t:
+            if (!typecheck_assignment(state, (AssignmentNode*)gn->node))
+                i = typecheck_drop_temporary(state, statements, i, ((AssignmentNode*)gn->node)->left);
+            break;
+        case IfNode_t:
+            typecheck_expression(state, ((IfNode*)gn->node)->condition);
+            typecheck_block(state, ((IfNode*)gn->node)->statements);
+            break;
+        case ElseNode_t:
+            typecheck_block(state, ((ElseNode*)gn->node)->statements);
+            break;
+        case WhileNode_t:
+            typecheck_expression(state, ((WhileNode*)gn->node)->condition);
+            typecheck_block(state, ((WhileNode*)gn->node)->statements);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+int typecheck_run(AST* ast)
+{
+    TypecheckState state;
+    state.typed = 0;
+
+    for (Hashmap_Node* iter = Hashmap_get_iter(ast->functions); iter != NULL; iter = Hashmap_iter_next(iter)) {
+        GenericNode* gn = iter->val;
+        if (gn->type != FunctionNode_t)
+            continue;
+
+        FunctionNode* fn = (FunctionNode*)gn->node;
+        state.fn_name = fn->name;
+        state.types = Hashmap_new(free);
+        state.temporaries = Hashmap_new(Arraylist_no_free);
+        state.inlined = Hashmap_new(typecheck_expression_free);
+
+        for (int i = 0; i < Arraylist_size(fn->args); i++) {
+            VariableNode* arg = Arraylist_get(fn->args, i);
+            typecheck_declare(&state, arg->name, arg->type);
+        }
+        typecheck_block(&state, fn->statements);
+
+        Hashmap_free(state.types);
+        Hashmap_free(state.temporaries);
+        Hashmap_free(state.inlined);
+    }
+
+    return state.typed;
+}
@@ -0,0 +1,19 @@
+#ifndef TYPECHECK_H
+#define TYPECHECK_H
+
+#include "ast.h"
+
+#define IS_NUMERIC_TYPE(type) \
+(type <= F32_t)
+
+#define IS_INTEGER_LITERAL_TYPE(type) \
+(type <= U8_t)
+
+// Checks that strings and numbers are never mixed in an operation or an
+// assignment, gives integer literals the type of the other operand and the
+// compiler's temporaries the type of their value, and records on every
+// operator the operand type when both sides agree. Returns the number of
+// operators that got a type, panics on a type error
+int typecheck_run(AST* ast);
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef VERSION_H
+#define VERSION_H
+
+// Part of every disk cache key, change it whenever the generated code does
+#define COMPILER_VERSION "2.0.0"
+
+#endif
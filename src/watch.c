@@ -0,0 +1,346 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "watch.h"
+#include "batch.h"
+#include "tokenizer.h"
+#include "stringbuilder.h"
+#include "timereport.h"
+#include "panic.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ALLOC_SUBSYSTEM OtherAlloc
+#include "alloc.h"
+
+// A burst of events ends once none came for this long, editors write a
+// file in several steps
+#define WATCH_QUIET_MS 50
+// Longest a rebuild waits for a burst to end, a file that keeps changing
+// still gets built
+#define WATCH_MAX_DELAY_MS 500
+// Saves land as a close after writing or as a rename over the old file
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+#define WATCH_BUFFER_SIZE 4096
+
+#define SOURCE_EXTENSION ".bc"
+#define MODULE_EXTENSION ".nnivm"
+
+double watch_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+bool has_extension(char* name, char* extension)
+{
+    int length = strlen(name);
+    int ext_length = strlen(extension);
+    return length > ext_length && strcmp(name + length - ext_length, extension) == 0;
+}
+
+bool watch_contains(Arraylist* names, char* name)
+{
+    for (int i = 0; i < Arraylist_size(names); i++)
+        if (strcmp(Arraylist_get(names, i), name) == 0)
+            return true;
+    return false;
+}
+
+void watch_add_name(Arraylist* names, char* name, int length)
+{
+    char* copy = malloc(length + 1);
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+
+    if (watch_contains(names, copy))
+        free(copy);
+    else
+        Arraylist_add(names, copy);
+}
+
+void WatchedFile_free(void* ptr)
+{
+    WatchedFile* file = ptr;
+    Arraylist_free(file->imports);
+    free(file->name);
+    free(file->path);
+    free(file);
+}
+
+// Modules the file imports. A file that can not be read or lexed imports
+// nothing, its compile reports why
+Arraylist* watch_imports(char* path)
+{
+    PanicHandler handler;
+    char* volatile code = NULL;
+    Arraylist* imports = NULL;
+
+    if (setjmp(handler.env) == 0) {
+        panic_push_handler(&handler);
+        code = read_file(path);
+        imports = tokenize_imports(code);
+        panic_pop_handler();
+    }
+    else {
+        imports = Arraylist_new_with_size(free, 1);
+    }
+
+    free(code);
+    return imports;
+}
+
+Watch* Watch_new(char* dir, char* outdir, GenOptions* options, bool emit_ir, bool object, int opt_level, Arraylist* disabled)
+{
+    Watch* watch = malloc(sizeof(Watch));
+    watch->dir = dir;
+    watch->outdir = outdir;
+    watch->options = options;
+    watch->emit_ir = emit_ir;
+    watch->object = object;
+    watch->opt_level = opt_level;
+    watch->disabled = disabled;
+    watch->cache = NULL;
+    watch->files = Arraylist_new(WatchedFile_free);
+    watch->fd = -1;
+    watch->dir_wd = -1;
+
+    ModuleRegistry_add_path(options->modules, dir);
+    return watch;
+}
+
+// Reads the file name of dir again, adding, refreshing or dropping it
+void watch_update(Watch* watch, char* name)
+{
+    int index = 0;
+    while (index < Arraylist_size(watch->files)
+        && strcmp(((WatchedFile*)Arraylist_get(watch->files, index))->name, name) < 0)
+        index++;
+    WatchedFile* file = index < Arraylist_size(watch->files) ? Arraylist_get(watch->files, index) : NULL;
+    if (file != NULL && strcmp(file->name, name) != 0)
+        file = NULL;
+
+    StringBuilder* sb = StringBuilder_new();
+    StringBuilder_add_arr(sb, watch->dir);
+    if (sb->size > 0 && sb->str[sb->size - 1] != '/')
+        StringBuilder_add(sb, '/');
+    StringBuilder_add_arr(sb, name);
+    char* path = StringBuilder_get(sb);
+    StringBuilder_free(sb);
+
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (file != NULL)
+            Arraylist_remove(watch->files, index);
+        free(path);
+        return;
+    }
+
+    if (file == NULL) {
+        file = malloc(sizeof(WatchedFile));
+        file->name = String_from(name);
+        file->path = path;
+        file->imports = watch_imports(path);
+        Arraylist_insert(watch->files, file, index);
+        return;
+    }
+
+    Arraylist_free(file->imports);
+    file->imports = watch_imports(path);
+    free(path);
+}
+
+void watch_scan(Watch* watch)
+{
+    DIR* dir = opendir(watch->dir);
+    if (dir == NULL)
+        panic("Could not open %s: %s", watch->dir, strerror(errno));
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+        if (has_extension(entry->d_name, SOURCE_EXTENSION))
+            watch_update(watch, entry->d_name);
+    closedir(dir);
+}
+
+// Compiles the paths as one batch, returns how many failed
+int watch_build(Watch* watch, Arraylist* paths, int jobs)
+{
+    if (Arraylist_size(paths) == 0)
+        return 0;
+
+    Batch* batch = Batch_new(paths, watch->outdir, watch->options, watch->emit_ir, watch->object, watch->opt_level, watch->disabled);
+    batch->cache = watch->cache;
+    TimeReport* report = TimeReport_new();
+    int failed = Batch_run(batch, jobs, report);
+    TimeReport_free(report);
+    Batch_free(batch);
+    return failed;
+}
+
+// Takes the pending events, changed .bc names go to sources and changed
+// module names to modules. Returns how many events mattered, -1 once dir
+// is gone
+int watch_read_events(Watch* watch, Arraylist* sources, Arraylist* modules, bool* rescan)
+{
+    char buffer[WATCH_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    long length = read(watch->fd, buffer, sizeof(buffer));
+    if (length < 0) {
+        if (errno == EINTR || errno == EAGAIN)
+            return 0;
+        panic("Could not read events: %s", strerror(errno));
+    }
+
+    int count = 0;
+    for (char* at = buffer; at < buffer + length; ) {
+        struct inotify_event* event = (struct inotify_event*)at;
+        at += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            *rescan = true;
+            count++;
+        }
+        else if ((event->mask & IN_IGNORED) && event->wd == watch->dir_wd) {
+            return -1;
+        }
+        else if (event->len == 0) {
+            continue;
+        }
+        else if (event->wd == watch->dir_wd && has_extension(event->name, SOURCE_EXTENSION)) {
+            watch_add_name(sources, event->name, strlen(event->name));
+            count++;
+        }
+        else if (has_extension(event->name, MODULE_EXTENSION)) {
+            watch_add_name(modules, event->name, strlen(event->name) - strlen(MODULE_EXTENSION));
+            count++;
+        }
+    }
+
+    return count;
+}
+
+bool watch_imports_any(WatchedFile* file, Arraylist* modules)
+{
+    for (int i = 0; i < Arraylist_size(file->imports); i++)
+        if (watch_contains(modules, Arraylist_get(file->imports, i)))
+            return true;
+    return false;
+}
+
+int Watch_run(Watch* watch, int jobs)
+{
+    watch->fd = inotify_init1(IN_CLOEXEC);
+    if (watch->fd < 0)
+        panic("Could not start watching: %s", strerror(errno));
+    watch->dir_wd = inotify_add_watch(watch->fd, watch->dir, WATCH_EVENTS);
+    if (watch->dir_wd < 0)
+        panic("Could not watch %s: %s", watch->dir, strerror(errno));
+
+    // Modules come from the working directory and the search paths, which
+    // need not exist
+    inotify_add_watch(watch->fd, ".", WATCH_EVENTS);
+    for (int i = 0; i < Arraylist_size(watch->options->modules->search_paths); i++)
+        inotify_add_watch(watch->fd, Arraylist_get(watch->options->modules->search_paths, i), WATCH_EVENTS);
+
+    // Watching starts before the scan, a save in between is not lost
+    watch_scan(watch);
+    double start = watch_now_ms();
+    Arraylist* paths = Arraylist_new(free);
+    for (int i = 0; i < Arraylist_size(watch->files); i++)
+        Arraylist_add(paths, String_from(((WatchedFile*)Arraylist_get(watch->files, i))->path));
+    int failed = watch_build(watch, paths, jobs);
+    fprintf(stderr, "watch: built %i files in %.2f ms, %i failed\n",
+        Arraylist_size(paths), watch_now_ms() - start, failed);
+    Arraylist_free(paths);
+
+    while (true) {
+        Arraylist* sources = Arraylist_new_with_size(free, 8);
+        Arraylist* modules = Arraylist_new_with_size(free, 8);
+        bool rescan = false;
+
+        // Waits for the first event that matters, then takes more until
+        // the burst is over
+        double first = -1;
+        int timeout = -1;
+        while (true) {
+            struct pollfd pfd = { watch->fd, POLLIN, 0 };
+            int ready = poll(&pfd, 1, timeout);
+            if (ready < 0 && errno == EINTR)
+                continue;
+            if (ready < 0)
+                panic("Could not wait for events: %s", strerror(errno));
+            if (ready == 0)
+                break;
+
+            int count = watch_read_events(watch, sources, modules, &rescan);
+            if (count < 0)
+                break;
+            if (count > 0 && first < 0)
+                first = watch_now_ms();
+            if (first < 0)
+                continue;
+
+            double left = first + WATCH_MAX_DELAY_MS - watch_now_ms();
+            if (left <= 0)
+                break;
+            timeout = left < WATCH_QUIET_MS ? (int)left : WATCH_QUIET_MS;
+        }
+
+        // A removed directory that something still holds open sends no
+        // event of its own
+        struct stat st;
+        if (stat(watch->dir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_nlink == 0) {
+            fprintf(stderr, "watch: %s is gone\n", watch->dir);
+            Arraylist_free(sources);
+            Arraylist_free(modules);
+            return 1;
+        }
+
+        start = watch_now_ms();
+        int changes = Arraylist_size(sources) + Arraylist_size(modules);
+        // Modules are mapped once, a changed one has to be read again
+        if (rescan || Arraylist_size(modules) > 0)
+            ModuleRegistry_clear(watch->options->modules);
+        if (rescan) {
+            Arraylist_free(watch->files);
+            watch->files = Arraylist_new(WatchedFile_free);
+            watch_scan(watch);
+        }
+        for (int i = 0; i < Arraylist_size(sources); i++)
+            watch_update(watch, Arraylist_get(sources, i));
+
+        paths = Arraylist_new(free);
+        for (int i = 0; i < Arraylist_size(watch->files); i++) {
+            WatchedFile* file = Arraylist_get(watch->files, i);
+            if (rescan || watch_contains(sources, file->name) || watch_imports_any(file, modules))
+                Arraylist_add(paths, String_from(file->path));
+        }
+
+        failed = watch_build(watch, paths, jobs);
+        double done = watch_now_ms();
+        fprintf(stderr, "watch: %i change%s, rebuilt %i of %i files in %.2f ms (%.2f ms after the first change), %i failed\n",
+            changes, changes == 1 ? "" : "s", Arraylist_size(paths), Arraylist_size(watch->files),
+            done - start, done - first, failed);
+
+        Arraylist_free(paths);
+        Arraylist_free(sources);
+        Arraylist_free(modules);
+    }
+}
+
+void Watch_free(Watch* watch)
+{
+    if (watch->fd >= 0)
+        close(watch->fd);
+    Arraylist_free(watch->files);
+    free(watch);
+}
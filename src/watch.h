@@ -0,0 +1,55 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "arraylist.h"
+#include "nonamegenerator.h"
+#include "diskcache.h"
+
+#include <stdbool.h>
+
+// A .bc file in the watched directory and the modules it imports
+struct watched_file
+{
+    char* name;
+    char* path;
+    // char*, module names, empty when the file could not be lexed
+    Arraylist* imports;
+};
+
+typedef struct watched_file WatchedFile;
+
+// comp --watch <dir> compiles every .bc file in dir the way a batch does,
+// then waits on inotify for .bc and .nnivm files to change. A burst of
+// events is let settle and then handled as one rebuild: a changed .bc file
+// is compiled again, a changed module compiles again every file importing
+// it, and nothing else is touched. Modules are looked for in the watched
+// directory after the usual places, and changes to them in every place
+// they are looked for are seen
+struct watch
+{
+    char* dir;
+    char* outdir;
+    GenOptions* options;
+    bool emit_ir;
+    bool object;
+    int opt_level;
+    // char*, passes turned off in every compile
+    Arraylist* disabled;
+    // Where outputs are looked up and stored, NULL for none
+    DiskCache* cache;
+    // WatchedFile*, sorted by name
+    Arraylist* files;
+    int fd;
+    // Watch descriptor of dir, the others only matter for modules
+    int dir_wd;
+};
+
+typedef struct watch Watch;
+
+Watch* Watch_new(char* dir, char* outdir, GenOptions* options, bool emit_ir, bool object, int opt_level, Arraylist* disabled);
+// Builds everything, then rebuilds on change on jobs threads and reports
+// every rebuild on stderr. Only returns, with 1, when dir stops existing
+int Watch_run(Watch* watch, int jobs);
+void Watch_free(Watch* watch);
+
+#endif
@@ -0,0 +1,68 @@
+#include "workpool.h"
+#include "memstat.h"
+#include "panic.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define ALLOC_SUBSYSTEM OtherAlloc
+#include "alloc.h"
+
+struct work_pool
+{
+    void (*work)(void* arg, int index);
+    void* arg;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+};
+
+typedef struct work_pool WorkPool;
+
+void* work_pool_thread(void* arg)
+{
+    WorkPool* pool = arg;
+
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        int next = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (next >= pool->count)
+            break;
+        pool->work(pool->arg, next);
+    }
+
+    MemStats_thread_done();
+    return NULL;
+}
+
+void WorkPool_run(int threads, int count, void (*work)(void* arg, int index), void* arg)
+{
+    if (threads > count)
+        threads = count;
+
+    if (threads <= 1) {
+        for (int i = 0; i < count; i++)
+            work(arg, i);
+        return;
+    }
+
+    WorkPool pool;
+    pool.work = work;
+    pool.arg = arg;
+    pool.count = count;
+    pool.next = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    pthread_t* workers = malloc(sizeof(pthread_t) * threads);
+    for (int i = 0; i < threads; i++)
+        if (pthread_create(&workers[i], NULL, work_pool_thread, &pool) != 0)
+            panic("Could not start a worker thread");
+    for (int i = 0; i < threads; i++)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+    pthread_mutex_destroy(&pool.lock);
+}
@@ -0,0 +1,10 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+// Calls work(arg, index) for every index below count on up to threads
+// threads and returns once all calls are done. Indices are handed out in
+// order, one at a time. With one thread, or one index, the calling thread
+// does the work itself
+void WorkPool_run(int threads, int count, void (*work)(void* arg, int index), void* arg);
+
+#endif